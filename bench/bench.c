@@ -0,0 +1,104 @@
+#include "bench.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "../client/protocol.h"
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void die(const char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+void raise_nofile(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+int connect_nb(const struct addrinfo *ai) {
+    int fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) die("socket");
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS) die("connect");
+    return fd;
+}
+
+void grow(char **p, size_t *cap, size_t need) {
+    if (need <= *cap) return;
+    size_t n = *cap ? *cap : 4096;
+    while (n < need) n *= 2;
+    char *q = realloc(*p, n);
+    if (!q) die("realloc");
+    *p = q;
+    *cap = n;
+}
+
+/* ---- frames ---- */
+
+void put_u32(char *p, uint32_t v) {
+    p[0] = (char)(v >> 24);
+    p[1] = (char)(v >> 16);
+    p[2] = (char)(v >> 8);
+    p[3] = (char)v;
+}
+
+uint32_t get_u32(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return (uint32_t)u[0] << 24 | (uint32_t)u[1] << 16 | (uint32_t)u[2] << 8 | u[3];
+}
+
+void frame_begin(Wbuf *w, unsigned id) {
+    grow(&w->data, &w->cap, w->len + WIRE_HEADER);
+    w->frame = w->len;
+    put_u32(w->data + w->len + 4, id);
+    w->data[w->len + 8] = 0;
+    w->data[w->len + 9] = 0;
+    w->len += WIRE_HEADER;
+}
+
+void frame_str(Wbuf *w, const char *s, size_t n) {
+    grow(&w->data, &w->cap, w->len + 5 + n);
+    w->data[w->len] = WIRE_STR;
+    put_u32(w->data + w->len + 1, (uint32_t)n);
+    memcpy(w->data + w->len + 5, s, n);
+    w->len += 5 + n;
+}
+
+void frame_int(Wbuf *w, int v) {
+    grow(&w->data, &w->cap, w->len + 5);
+    w->data[w->len] = WIRE_INT;
+    put_u32(w->data + w->len + 1, (uint32_t)v);
+    w->len += 5;
+}
+
+void frame_end(Wbuf *w) {
+    put_u32(w->data + w->frame, (uint32_t)(w->len - w->frame - 4));
+}
+
+/* ---- latency histogram ---- */
+
+void hist_print_json(FILE *out, const char *name, const Hist *h, int last) {
+    fprintf(out,
+            "    \"%s\": {\"count\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, "
+            "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}%s\n",
+            name, (unsigned long long)h->n, h->n ? (double)h->sum / h->n : 0.0,
+            (unsigned long long)hist_quantile(h, 0.50), (unsigned long long)hist_quantile(h, 0.90),
+            (unsigned long long)hist_quantile(h, 0.99), (unsigned long long)hist_quantile(h, 0.999),
+            (unsigned long long)h->max, last ? "" : ",");
+}
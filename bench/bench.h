@@ -0,0 +1,51 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Pieces shared by the bench tools: clock, growable buffers, binary frame
+// encoding (see protocol.h) and latency histograms.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../server/hist.h"
+
+uint64_t now_ns(void);              // CLOCK_MONOTONIC
+void die(const char *msg);          // perror and exit(1)
+
+// Lift the open-file limit to its hard maximum, for many connections.
+void raise_nofile(void);
+
+struct addrinfo;
+// Start a non-blocking connect to ai; dies if the socket cannot be made.
+int connect_nb(const struct addrinfo *ai);
+
+// Make room for need bytes in *p (capacity *cap).
+void grow(char **p, size_t *cap, size_t need);
+
+/* ---- frames ---- */
+
+typedef struct {
+    char *data;
+    size_t len, off, cap;   // off: bytes already sent
+    size_t frame;           // start of the frame being built
+} Wbuf;
+
+void frame_begin(Wbuf *w, unsigned id);
+void frame_str(Wbuf *w, const char *s, size_t n);
+void frame_int(Wbuf *w, int v);
+void frame_end(Wbuf *w);
+
+void put_u32(char *p, uint32_t v);
+uint32_t get_u32(const char *p);
+
+/* ---- latency histogram ---- */
+
+// Latencies in microseconds go in the server's own Hist (server/hist.h), so
+// bench and STATS percentiles come from the same buckets.
+
+// One "name": {count, mean, p50, p90, p99, p999, max} JSON member, with a
+// trailing comma unless last.
+void hist_print_json(FILE *out, const char *name, const Hist *h, int last);
+
+#endif
@@ -0,0 +1,354 @@
+// Fill a new database with synthetic data at production scale: users,
+// projects with their members, tasks with date ranges, comments,
+// attachments and chat. The schema comes from the server's own db_init, so
+// the file is exactly what the server would have made; rows go in through
+// prepared statements, many thousands per transaction.
+//
+// Work is skewed the way real use is: a few projects hold most tasks and
+// chat, a few tasks most comments (-z sets how strongly; 1 is uniform).
+// Every user's password is -P, for loadgen, replay and the clients.
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../server/db.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DAY 86400
+
+static struct {
+    long users;
+    long projects;
+    int members;        // per project, owner included
+    long tasks;
+    long comments;
+    long attachments;
+    long chat;
+    double skew;
+    int batch;          // rows per transaction
+    const char *prefix;
+    const char *password;
+    uint64_t seed;
+    int force;
+} opt = { 10000, 1000, 10, 100000, 200000, 20000, 500000, 2.0, 50000, "user", "bench", 1, 0 };
+
+static uint64_t rng;
+static time_t window_start;     // timestamps fall within the last two years
+static const time_t window = 730L * DAY;
+
+static int *members;            // projects x members user ids
+static int *member_count;
+static int *task_project;
+
+static uint64_t rand64(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static long uniform(long n) {
+    return (long)(rand64() % (uint64_t)n);
+}
+
+// 0..n-1, low values much more likely when skew > 1.
+static long skewed(long n) {
+    double u = (rand64() >> 11) * (1.0 / 9007199254740992.0);
+    long v = (long)(n * pow(u, opt.skew));
+    return v < n ? v : n - 1;
+}
+
+static void format_time(char *out, size_t size, time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+static void format_date(char *out, size_t size, time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(out, size, "%Y-%m-%d", &tm);
+}
+
+static void exec_sql(const char *sql) {
+    char *err = NULL;
+    if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", sql, err);
+        exit(1);
+    }
+}
+
+static sqlite3_stmt *prepare(const char *sql) {
+    sqlite3_stmt *st;
+    if (sqlite3_prepare_v2(db, sql, -1, &st, NULL) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", sql, sqlite3_errmsg(db));
+        exit(1);
+    }
+    return st;
+}
+
+// Run st with what is bound, then commit every opt.batch rows.
+static long batch_rows;
+
+static void step(sqlite3_stmt *st) {
+    if (sqlite3_step(st) != SQLITE_DONE) {
+        fprintf(stderr, "insert failed: %s\n", sqlite3_errmsg(db));
+        exit(1);
+    }
+    sqlite3_reset(st);
+    if (++batch_rows % opt.batch == 0) exec_sql("COMMIT; BEGIN");
+}
+
+// Progress for one table: rows done and rate.
+static void report(const char *table, long rows, uint64_t t0) {
+    double s = (now_ns() - t0) / 1e9;
+    fprintf(stderr, "%-18s %10ld rows %7.2fs %10.0f rows/s\n", table, rows, s, s > 0 ? rows / s : 0.0);
+}
+
+/* ---- tables ---- */
+
+static void gen_users(void) {
+    uint64_t t0 = now_ns();
+    sqlite3_stmt *st = prepare("INSERT INTO users(username, password, created_at) VALUES(?, ?, ?)");
+    char name[64], at[32];
+    for (long i = 0; i < opt.users; i++) {
+        snprintf(name, sizeof(name), "%s%ld", opt.prefix, i);
+        format_time(at, sizeof(at), window_start + i * (window / 2) / opt.users);
+        sqlite3_bind_text(st, 1, name, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 2, opt.password, -1, SQLITE_STATIC);
+        sqlite3_bind_text(st, 3, at, -1, SQLITE_TRANSIENT);
+        step(st);
+    }
+    sqlite3_finalize(st);
+    report("users", opt.users, t0);
+}
+
+// User ids are 1..users in a new file; owners and members are picked
+// among them, each project's members kept for tasks, comments and chat.
+static void gen_projects(void) {
+    uint64_t t0 = now_ns();
+    sqlite3_stmt *pst = prepare("INSERT INTO projects(name, description, owner_id, created_at) "
+                                "VALUES(?, ?, ?, ?)");
+    sqlite3_stmt *mst = prepare("INSERT OR IGNORE INTO project_members(project_id, user_id, joined_at) "
+                                "VALUES(?, ?, ?)");
+    char name[64], at[32];
+    long nmembers = 0;
+    for (long p = 0; p < opt.projects; p++) {
+        int owner = (int)uniform(opt.users) + 1;
+        time_t created = window_start + p * (window / 2) / opt.projects;
+        format_time(at, sizeof(at), created);
+        snprintf(name, sizeof(name), "Project %ld", p + 1);
+        sqlite3_bind_text(pst, 1, name, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(pst, 2, "Generated project", -1, SQLITE_STATIC);
+        sqlite3_bind_int(pst, 3, owner);
+        sqlite3_bind_text(pst, 4, at, -1, SQLITE_TRANSIENT);
+        step(pst);
+
+        int *m = &members[p * opt.members];
+        int n = 0;
+        m[n++] = owner;
+        for (int tries = 0; n < opt.members && tries < opt.members * 4; tries++) {
+            int u = (int)uniform(opt.users) + 1;
+            int dup = 0;
+            for (int k = 0; k < n && !dup; k++) dup = m[k] == u;
+            if (!dup) m[n++] = u;
+        }
+        member_count[p] = n;
+        for (int k = 0; k < n; k++) {
+            format_time(at, sizeof(at), created + k * 3600);
+            sqlite3_bind_int(mst, 1, (int)p + 1);
+            sqlite3_bind_int(mst, 2, m[k]);
+            sqlite3_bind_text(mst, 3, at, -1, SQLITE_TRANSIENT);
+            step(mst);
+        }
+        nmembers += n;
+    }
+    sqlite3_finalize(pst);
+    sqlite3_finalize(mst);
+    report("projects", opt.projects, t0);
+    report("project_members", nmembers, t0);
+}
+
+static int pick_member(long project) {
+    return members[project * opt.members + uniform(member_count[project])];
+}
+
+// Tasks run for a day to three months inside the window; progress and
+// status follow from where "now" falls in that range.
+static void gen_tasks(void) {
+    static const char *words[] = { "Design", "Implement", "Review", "Test", "Deploy", "Document",
+                                   "Fix", "Refactor", "Measure", "Plan" };
+    static const char *areas[] = { "login", "task list", "chat", "gantt view", "attachments",
+                                   "database", "server", "client", "reports", "settings" };
+    uint64_t t0 = now_ns();
+    sqlite3_stmt *st = prepare("INSERT INTO tasks(project_id, title, description, assignee_id, status, "
+                               "progress, start_date, end_date, created_at) VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    char title[96], sd[16], ed[16], at[32];
+    time_t now = time(NULL);
+    for (long t = 0; t < opt.tasks; t++) {
+        long p = skewed(opt.projects);
+        task_project[t] = (int)p;
+        time_t start = window_start + uniform(window);
+        time_t end = start + (1 + uniform(90)) * DAY;
+        int progress = now >= end ? 100 : now <= start ? 0 : (int)(100 * (now - start) / (end - start));
+        const char *status = progress == 100 ? "DONE" : progress == 0 ? "NOT_STARTED" : "IN_PROGRESS";
+
+        snprintf(title, sizeof(title), "%s %s #%ld", words[uniform(10)], areas[uniform(10)], t + 1);
+        format_date(sd, sizeof(sd), start);
+        format_date(ed, sizeof(ed), end);
+        format_time(at, sizeof(at), start - uniform(7 * DAY));
+        sqlite3_bind_int(st, 1, (int)p + 1);
+        sqlite3_bind_text(st, 2, title, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 3, "Generated task with a short description of the work.", -1, SQLITE_STATIC);
+        sqlite3_bind_int(st, 4, pick_member(p));
+        sqlite3_bind_text(st, 5, status, -1, SQLITE_STATIC);
+        sqlite3_bind_int(st, 6, progress);
+        sqlite3_bind_text(st, 7, sd, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 8, ed, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 9, at, -1, SQLITE_TRANSIENT);
+        step(st);
+    }
+    sqlite3_finalize(st);
+    report("tasks", opt.tasks, t0);
+}
+
+static void gen_comments(void) {
+    uint64_t t0 = now_ns();
+    sqlite3_stmt *st = prepare("INSERT INTO task_comments(task_id, user_id, content, created_at) "
+                               "VALUES(?, ?, ?, ?)");
+    char text[64], at[32];
+    for (long i = 0; i < opt.comments; i++) {
+        long t = skewed(opt.tasks);
+        snprintf(text, sizeof(text), "Comment %ld on this task", i + 1);
+        format_time(at, sizeof(at), window_start + i * window / opt.comments);
+        sqlite3_bind_int(st, 1, (int)t + 1);
+        sqlite3_bind_int(st, 2, pick_member(task_project[t]));
+        sqlite3_bind_text(st, 3, text, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 4, at, -1, SQLITE_TRANSIENT);
+        step(st);
+    }
+    sqlite3_finalize(st);
+    report("task_comments", opt.comments, t0);
+}
+
+static void gen_attachments(void) {
+    static const char *ext[] = { "pdf", "png", "docx", "xlsx", "zip" };
+    uint64_t t0 = now_ns();
+    sqlite3_stmt *st = prepare("INSERT INTO task_attachments(task_id, filename, filepath, created_at) "
+                               "VALUES(?, ?, ?, ?)");
+    char name[64], path[128], at[32];
+    for (long i = 0; i < opt.attachments; i++) {
+        long t = uniform(opt.tasks);
+        snprintf(name, sizeof(name), "file%ld.%s", i + 1, ext[uniform(5)]);
+        snprintf(path, sizeof(path), "uploads/%ld/%s", t + 1, name);
+        format_time(at, sizeof(at), window_start + i * window / opt.attachments);
+        sqlite3_bind_int(st, 1, (int)t + 1);
+        sqlite3_bind_text(st, 2, name, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 3, path, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 4, at, -1, SQLITE_TRANSIENT);
+        step(st);
+    }
+    sqlite3_finalize(st);
+    report("task_attachments", opt.attachments, t0);
+}
+
+// Chat is written in time order, as the server does: ids and created_at
+// rise together.
+static void gen_chat(void) {
+    uint64_t t0 = now_ns();
+    sqlite3_stmt *st = prepare("INSERT INTO project_chat(project_id, user_id, content, created_at) "
+                               "VALUES(?, ?, ?, ?)");
+    char text[64], at[32];
+    for (long i = 0; i < opt.chat; i++) {
+        long p = skewed(opt.projects);
+        snprintf(text, sizeof(text), "Message %ld", i + 1);
+        format_time(at, sizeof(at), window_start + i * window / opt.chat);
+        sqlite3_bind_int(st, 1, (int)p + 1);
+        sqlite3_bind_int(st, 2, pick_member(p));
+        sqlite3_bind_text(st, 3, text, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 4, at, -1, SQLITE_TRANSIENT);
+        step(st);
+    }
+    sqlite3_finalize(st);
+    report("project_chat", opt.chat, t0);
+}
+
+/* ---- main ---- */
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-u users] [-p projects] [-m members_per_project] [-t tasks]\n"
+            "          [-c comments] [-a attachments] [-C chat] [-z skew] [-b batch]\n"
+            "          [-U user_prefix] [-P password] [-s seed] [-f] database.db\n"
+            "  counts are totals; -z 1 spreads tasks, comments and chat evenly,\n"
+            "  higher piles them onto fewer projects and tasks; -f replaces the file\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int ch;
+    while ((ch = getopt(argc, argv, "u:p:m:t:c:a:C:z:b:U:P:s:f")) != -1) {
+        switch (ch) {
+        case 'u': opt.users = atol(optarg); break;
+        case 'p': opt.projects = atol(optarg); break;
+        case 'm': opt.members = atoi(optarg); break;
+        case 't': opt.tasks = atol(optarg); break;
+        case 'c': opt.comments = atol(optarg); break;
+        case 'a': opt.attachments = atol(optarg); break;
+        case 'C': opt.chat = atol(optarg); break;
+        case 'z': opt.skew = atof(optarg); break;
+        case 'b': opt.batch = atoi(optarg); break;
+        case 'U': opt.prefix = optarg; break;
+        case 'P': opt.password = optarg; break;
+        case 's': opt.seed = strtoull(optarg, NULL, 10); break;
+        case 'f': opt.force = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc || opt.users <= 0 || opt.projects <= 0 || opt.members <= 0 ||
+        opt.tasks < 0 || opt.comments < 0 || opt.attachments < 0 || opt.chat < 0 ||
+        opt.skew < 1 || opt.batch <= 0)
+        usage(argv[0]);
+    if ((opt.comments || opt.attachments) && opt.tasks == 0) usage(argv[0]);
+    if (opt.members > opt.users) opt.members = (int)opt.users;
+    rng = opt.seed ? opt.seed : 1;
+    window_start = time(NULL) - window + 90L * DAY;   // some tasks end in the future
+
+    const char *path = argv[optind];
+    if (access(path, F_OK) == 0) {
+        if (!opt.force) {
+            fprintf(stderr, "%s exists; -f to replace it\n", path);
+            return 1;
+        }
+        char side[1024];
+        unlink(path);
+        snprintf(side, sizeof(side), "%s-wal", path);
+        unlink(side);
+        snprintf(side, sizeof(side), "%s-shm", path);
+        unlink(side);
+    }
+
+    members = malloc((size_t)opt.projects * (size_t)opt.members * sizeof(int));
+    member_count = malloc((size_t)opt.projects * sizeof(int));
+    task_project = malloc(((size_t)opt.tasks + 1) * sizeof(int));
+    if (!members || !member_count || !task_project) die("malloc");
+
+    if (!db_init(path)) return 1;
+    uint64_t t0 = now_ns();
+    exec_sql("PRAGMA synchronous=OFF; PRAGMA cache_size=-262144; BEGIN");
+    gen_users();
+    gen_projects();
+    gen_tasks();
+    gen_comments();
+    gen_attachments();
+    gen_chat();
+    exec_sql("COMMIT; PRAGMA synchronous=NORMAL; PRAGMA wal_checkpoint(TRUNCATE)");
+    report("total", batch_rows, t0);
+    db_close();
+    return 0;
+}
@@ -0,0 +1,361 @@
+// Microbenchmarks for the db_* functions in server/db.c, called in-process
+// with no networking: ns/op, heap allocations and bytes per op, and rows/s
+// for the list functions, as JSON on stdout (and a table on stderr).
+//
+// Runs against a database file, typically one made by bench/dataset, to
+// which it adds its own fixture once: projects of exactly 10, 1000 and
+// 100000 tasks, a task with comments and attachments, a project with chat,
+// and a project the write benchmarks change. Write benchmarks go through
+// the server's writer thread, so they include its group commit.
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../server/db.h"
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LIST_SIZES 3
+
+static const int list_size[LIST_SIZES] = { 10, 1000, 100000 };
+
+static struct {
+    double seconds;     // per benchmark
+    const char *only;   // run names containing this
+    int binary;         // rows in wire form instead of text
+} opt = { 1.0, NULL, 0 };
+
+/* ---- allocation counting ---- */
+
+// Every malloc in the process, SQLite's included, passes through here;
+// the writer thread's are counted too since a write's cost includes them.
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t n);
+extern void __libc_free(void *p);
+
+static unsigned long allocs, alloc_bytes;
+
+void *malloc(size_t n) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_bytes, n, __ATOMIC_RELAXED);
+    return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_bytes, n * size, __ATOMIC_RELAXED);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_bytes, n, __ATOMIC_RELAXED);
+    return __libc_realloc(p, n);
+}
+
+void free(void *p) {
+    __libc_free(p);
+}
+
+/* ---- fixture ---- */
+
+static struct {
+    int user, member, writer;       // user ids
+    int list_project[LIST_SIZES];
+    int list_task;                  // first task of the 10-task project
+    int busy_task;                  // has comments and attachments
+    int chat_project;
+    int chat_last;                  // newest message id there
+    int write_project;
+    int write_task;
+} fx;
+
+static void exec_sql(const char *sql) {
+    char *err = NULL;
+    if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", sql, err);
+        exit(1);
+    }
+}
+
+static void exec_sqlf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    char *sql = sqlite3_vmprintf(fmt, ap);
+    va_end(ap);
+    exec_sql(sql);
+    sqlite3_free(sql);
+}
+
+// First column of the first row of the sqlite3_mprintf-formatted query, or 0.
+static int query_int(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    char *sql = sqlite3_vmprintf(fmt, ap);
+    va_end(ap);
+    sqlite3_stmt *st;
+    int v = 0;
+    if (sqlite3_prepare_v2(db, sql, -1, &st, NULL) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", sql, sqlite3_errmsg(db));
+        exit(1);
+    }
+    if (sqlite3_step(st) == SQLITE_ROW) v = sqlite3_column_int(st, 0);
+    sqlite3_finalize(st);
+    sqlite3_free(sql);
+    return v;
+}
+
+static int fixture_user(const char *name) {
+    exec_sqlf("INSERT OR IGNORE INTO users(username, password) VALUES(%Q, 'bench')", name);
+    return query_int("SELECT id FROM users WHERE username=%Q", name);
+}
+
+// Project name owned by the fixture user with ntasks tasks, made if missing.
+static int fixture_project(const char *name, int ntasks) {
+    int id = query_int("SELECT id FROM projects WHERE name=%Q AND owner_id=%d", name, fx.user);
+    if (id) return id;
+
+    exec_sqlf("INSERT INTO projects(name, owner_id) VALUES(%Q, %d)", name, fx.user);
+    id = (int)sqlite3_last_insert_rowid(db);
+    exec_sqlf("INSERT INTO project_members(project_id, user_id) VALUES(%d, %d), (%d, %d)",
+              id, fx.user, id, fx.member);
+
+    sqlite3_stmt *st;
+    sqlite3_prepare_v2(db,
+                       "INSERT INTO tasks(project_id, title, description, assignee_id, status, progress, "
+                       "start_date, end_date) VALUES(?, ?, 'Fixture task', ?, 'IN_PROGRESS', 50, "
+                       "'2026-01-01', '2026-03-31')",
+                       -1, &st, NULL);
+    char title[32];
+    for (int i = 0; i < ntasks; i++) {
+        snprintf(title, sizeof(title), "Task %d", i + 1);
+        sqlite3_bind_int(st, 1, id);
+        sqlite3_bind_text(st, 2, title, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(st, 3, i % 2 ? fx.member : fx.user);
+        sqlite3_step(st);
+        sqlite3_reset(st);
+    }
+    sqlite3_finalize(st);
+    return id;
+}
+
+static void fixture_init(void) {
+    exec_sql("PRAGMA synchronous=OFF; BEGIN");
+    fx.user = fixture_user("dbbench");
+    fx.member = fixture_user("dbbench-member");
+    fx.writer = fixture_user("dbbench-writer");
+
+    char name[32];
+    for (int i = 0; i < LIST_SIZES; i++) {
+        snprintf(name, sizeof(name), "dbbench-%d", list_size[i]);
+        fx.list_project[i] = fixture_project(name, list_size[i]);
+    }
+    fx.list_task = query_int("SELECT MIN(id) FROM tasks WHERE project_id=%d", fx.list_project[0]);
+
+    fx.busy_task = query_int("SELECT MIN(id) FROM tasks WHERE project_id=%d", fx.list_project[1]);
+    if (!query_int("SELECT COUNT(*) FROM task_comments WHERE task_id=%d", fx.busy_task)) {
+        for (int i = 0; i < 100; i++)
+            exec_sqlf("INSERT INTO task_comments(task_id, user_id, content) "
+                      "VALUES(%d, %d, 'Fixture comment %d')",
+                      fx.busy_task, i % 2 ? fx.member : fx.user, i + 1);
+        for (int i = 0; i < 20; i++)
+            exec_sqlf("INSERT INTO task_attachments(task_id, filename, filepath) "
+                      "VALUES(%d, 'file%d.pdf', 'uploads/file%d.pdf')",
+                      fx.busy_task, i + 1, i + 1);
+    }
+
+    fx.chat_project = fx.list_project[1];
+    if (!query_int("SELECT COUNT(*) FROM project_chat WHERE project_id=%d", fx.chat_project)) {
+        for (int i = 0; i < 1000; i++)
+            exec_sqlf("INSERT INTO project_chat(project_id, user_id, content) "
+                      "VALUES(%d, %d, 'Fixture message %d')",
+                      fx.chat_project, i % 2 ? fx.member : fx.user, i + 1);
+    }
+    fx.chat_last = query_int("SELECT MAX(id) FROM project_chat WHERE project_id=%d", fx.chat_project);
+
+    fx.write_project = fixture_project("dbbench-writes", 1);
+    fx.write_task = query_int("SELECT MIN(id) FROM tasks WHERE project_id=%d", fx.write_project);
+    exec_sql("COMMIT; PRAGMA synchronous=NORMAL");
+}
+
+/* ---- benchmarks ---- */
+
+// Each returns rows produced (0 for non-list calls), or -1 on failure.
+static Buf out;
+static int scratch;
+
+static void out_reset(void) {
+    buf_reset(&out);
+    out.binary = opt.binary;
+}
+
+static char new_user[64];
+
+static int ok(int r) { return r > 0 ? 0 : -1; }
+
+static int b_auth_user(long i) { return ok(db_auth_user("dbbench", "bench", &scratch)); }
+static int b_get_user_id(long i) { return ok(db_get_user_id("dbbench-member", &scratch)); }
+static int b_list_projects(long i) { return db_list_projects_for_user(fx.user, &out); }
+static int b_is_owner(long i) { return ok(db_is_project_owner(fx.list_project[0], fx.user)); }
+static int b_is_member(long i) { return ok(db_is_project_member(fx.list_project[0], fx.member)); }
+static int b_task_project(long i) { return ok(db_get_task_project_id(fx.list_task, &scratch)); }
+static int b_task_assignee(long i) { return ok(db_get_task_assignee_id(fx.list_task, &scratch)); }
+static int b_list_tasks_10(long i) { return db_list_tasks_in_project(fx.list_project[0], &out); }
+static int b_list_tasks_1k(long i) { return db_list_tasks_in_project(fx.list_project[1], &out); }
+static int b_list_tasks_100k(long i) { return db_list_tasks_in_project(fx.list_project[2], &out); }
+static int b_gantt_10(long i) { return db_list_tasks_gantt(fx.list_project[0], &out); }
+static int b_gantt_1k(long i) { return db_list_tasks_gantt(fx.list_project[1], &out); }
+static int b_gantt_100k(long i) { return db_list_tasks_gantt(fx.list_project[2], &out); }
+static int b_task_detail(long i) { return ok(db_get_task_detail(fx.list_task, &out)); }
+static int b_list_comments(long i) { return db_list_comments(fx.busy_task, &out); }
+static int b_list_attachments(long i) { return db_list_attachments(fx.busy_task, &out); }
+static int b_list_chat_all(long i) { return db_list_chat(fx.chat_project, 0, &out); }
+static int b_list_chat_tail(long i) { return db_list_chat(fx.chat_project, fx.chat_last - 10, &out); }
+
+static void count_row(void *ctx, int id, const char *u, const char *c, const char *at) {}
+static int b_recent_chat(long i) { return db_recent_chat(fx.chat_project, 50, count_row, NULL); }
+
+static int b_register_user(long i) {
+    snprintf(new_user, sizeof(new_user), "dbbench-u%d-%ld", (int)getpid(), i);
+    return ok(db_register_user(new_user, "bench"));
+}
+
+static int b_create_project(long i) { return ok(db_create_project("dbbench-new", fx.writer, &scratch)); }
+
+// Already a member after the first round; that path is measured too.
+static int b_invite_member(long i) {
+    return db_invite_member(fx.write_project, 1 + (int)(i % 1000)) != 0 ? 0 : -1;
+}
+
+static int b_create_task_full(long i) {
+    return ok(db_create_task_full(fx.write_project, "New task", "Benchmark task", fx.user,
+                                  "2026-01-01", "2026-02-01", &scratch));
+}
+
+static int b_create_task(long i) { return ok(db_create_task(fx.write_project, "New task", "Benchmark task", &scratch)); }
+static int b_assign_task(long i) { return ok(db_assign_task(fx.write_task, i % 2 ? fx.member : fx.user)); }
+static int b_update_status(long i) { return ok(db_update_task_status(fx.write_task, i % 2 ? "DONE" : "IN_PROGRESS")); }
+static int b_update_progress(long i) { return ok(db_update_task_progress(fx.write_task, (int)(i % 101))); }
+static int b_set_dates(long i) { return ok(db_set_task_dates(fx.write_task, "2026-01-01", "2026-06-30")); }
+static int b_add_comment(long i) { return ok(db_add_comment(fx.write_task, fx.user, "Benchmark comment")); }
+
+static int b_add_attachment(long i) {
+    return ok(db_add_attachment(fx.write_task, "bench.pdf", "uploads/bench.pdf"));
+}
+
+static int b_add_chat(long i) { return ok(db_add_chat(fx.write_project, fx.user, "Benchmark message", NULL)); }
+
+static const struct {
+    const char *name;
+    int (*fn)(long i);
+} benches[] = {
+    { "auth_user",              b_auth_user },
+    { "get_user_id",            b_get_user_id },
+    { "list_projects_for_user", b_list_projects },
+    { "is_project_owner",       b_is_owner },
+    { "is_project_member",      b_is_member },
+    { "get_task_project_id",    b_task_project },
+    { "get_task_assignee_id",   b_task_assignee },
+    { "list_tasks_in_project/10",     b_list_tasks_10 },
+    { "list_tasks_in_project/1000",   b_list_tasks_1k },
+    { "list_tasks_in_project/100000", b_list_tasks_100k },
+    { "list_tasks_gantt/10",          b_gantt_10 },
+    { "list_tasks_gantt/1000",        b_gantt_1k },
+    { "list_tasks_gantt/100000",      b_gantt_100k },
+    { "get_task_detail",        b_task_detail },
+    { "list_comments/100",      b_list_comments },
+    { "list_attachments/20",    b_list_attachments },
+    { "list_chat/1000",         b_list_chat_all },
+    { "list_chat/10",           b_list_chat_tail },
+    { "recent_chat/50",         b_recent_chat },
+    { "register_user",          b_register_user },
+    { "create_project",         b_create_project },
+    { "invite_member",          b_invite_member },
+    { "create_task_full",       b_create_task_full },
+    { "create_task",            b_create_task },
+    { "assign_task",            b_assign_task },
+    { "update_task_status",     b_update_status },
+    { "update_task_progress",   b_update_progress },
+    { "set_task_dates",         b_set_dates },
+    { "add_comment",            b_add_comment },
+    { "add_attachment",         b_add_attachment },
+    { "add_chat",               b_add_chat },
+};
+
+#define BENCH_COUNT ((int)(sizeof(benches) / sizeof(benches[0])))
+
+// Run one benchmark for opt.seconds (at least 3 ops) after a few warm-up
+// calls that fill the statement cache; print its JSON object.
+static void run(int b, int first) {
+    for (long i = 0; i < 3; i++) {
+        out_reset();
+        benches[b].fn(i);
+    }
+
+    unsigned long a0 = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+    unsigned long by0 = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED);
+    uint64_t t0 = now_ns(), t;
+    long ops = 0, rows = 0, failures = 0;
+    do {
+        out_reset();
+        int r = benches[b].fn(3 + ops);
+        if (r < 0) failures++;
+        else rows += r;
+        ops++;
+        t = now_ns();
+    } while (ops < 3 || t - t0 < (uint64_t)(opt.seconds * 1e9));
+    double ns = (double)(t - t0);
+    double na = (double)(__atomic_load_n(&allocs, __ATOMIC_RELAXED) - a0);
+    double nb = (double)(__atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED) - by0);
+
+    fprintf(stderr, "%-30s %10ld ops %12.0f ns/op %9.1f allocs/op %11.0f B/op %12.0f rows/s%s\n",
+            benches[b].name, ops, ns / ops, na / ops, nb / ops, rows / (ns / 1e9),
+            failures ? "  FAILURES" : "");
+    printf("%s    {\"name\": \"%s\", \"ops\": %ld, \"ns_per_op\": %.0f, \"allocs_per_op\": %.1f, "
+           "\"bytes_per_op\": %.0f, \"rows_per_op\": %.1f, \"rows_per_s\": %.0f, \"failures\": %ld}",
+           first ? "" : ",\n", benches[b].name, ops, ns / ops, na / ops, nb / ops,
+           (double)rows / ops, rows / (ns / 1e9), failures);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-t seconds_per_benchmark] [-n name_filter] [-B] database.db\n"
+            "  -B writes list rows in binary wire form, as for binary clients\n"
+            "  the file gets a dbbench fixture added; use a copy of real data\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int ch;
+    while ((ch = getopt(argc, argv, "t:n:B")) != -1) {
+        switch (ch) {
+        case 't': opt.seconds = atof(optarg); break;
+        case 'n': opt.only = optarg; break;
+        case 'B': opt.binary = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc || opt.seconds <= 0) usage(argv[0]);
+
+    if (!db_init(argv[optind])) return 1;
+    uint64_t t0 = now_ns();
+    fixture_init();
+    fprintf(stderr, "fixture ready in %.2fs\n", (now_ns() - t0) / 1e9);
+
+    buf_init(&out);
+    int first = 1;
+    printf("{\n  \"binary\": %d,\n  \"benchmarks\": [\n", opt.binary);
+    for (int b = 0; b < BENCH_COUNT; b++) {
+        if (opt.only && !strstr(benches[b].name, opt.only)) continue;
+        run(b, first);
+        first = 0;
+    }
+    printf("\n  ]\n}\n");
+    buf_free(&out);
+    db_close();
+    return 0;
+}
@@ -0,0 +1,592 @@
+// Load generator for the server: opens many connections, logs each in as a
+// synthetic user with a project and a task of its own, then drives a mix of
+// commands at a fixed total rate and prints throughput and latency
+// percentiles as one JSON object.
+//
+// Latency is measured from when a request was due, not from when it was
+// written (open loop), so a stalled server shows up in the percentiles
+// instead of silently slowing the generator down. With -r 0 every
+// connection runs closed loop, one request at a time, for peak throughput.
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../client/protocol.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define MAX_INFLIGHT 256        // per connection; more waits for a slot (Conn.waiting)
+#define MAX_EVENTS 256
+#define DRAIN_SECONDS 5         // after the run, wait this long for answers
+
+/* ---- operations ---- */
+
+enum { OP_CREATE_TASK, OP_LIST_TASK, OP_SEND_CHAT, OP_LIST_CHAT, OP_UPDATE_PROGRESS, OP_COUNT };
+
+static const char *op_name[OP_COUNT] = {
+    [OP_CREATE_TASK] = CMD_CREATE_TASK,
+    [OP_LIST_TASK] = CMD_LIST_TASK,
+    [OP_SEND_CHAT] = CMD_SEND_CHAT,
+    [OP_LIST_CHAT] = CMD_LIST_CHAT,
+    [OP_UPDATE_PROGRESS] = CMD_UPDATE_TASK_PROGRESS,
+};
+
+static int op_weight[OP_COUNT] = { 10, 40, 20, 20, 10 };
+static int weight_total;
+
+// Requests made during setup; never measured.
+enum { OP_SETUP = OP_COUNT };
+
+/* ---- connections ---- */
+
+typedef enum {
+    ST_CONNECTING,
+    ST_HELLO,           // waiting for the text "0|BIN\n"
+    ST_REGISTER,
+    ST_LOGIN,
+    ST_CREATE_PROJECT,
+    ST_FIND_PROJECT,
+    ST_CREATE_TASK,
+    ST_FIND_TASK,
+    ST_READY,
+    ST_DEAD,
+} State;
+
+typedef struct {
+    unsigned id;
+    int op;
+    uint64_t due;       // ns: when the request should have gone out
+} Pending;
+
+typedef struct {
+    int fd;
+    State st;
+    int index;
+    char user[32];
+    char project[48];
+    int project_id;
+    int task_id;
+    int chat_after;
+
+    char *in;
+    size_t in_len, in_cap;
+    Wbuf out;
+
+    Pending pend[MAX_INFLIGHT];     // FIFO: the server answers in order
+    int ph, pn;
+    unsigned next_id;
+
+    // due times of requests that found every slot taken, oldest at wh; each
+    // goes out as an answer frees a slot, still timed from when it was due
+    uint64_t *waiting;
+    size_t wh, wn, wcap;
+
+    int found_id;       // from rows of the response being read
+} Conn;
+
+static struct {
+    const char *host;
+    const char *port;
+    int conns;
+    double rate;        // requests/s over all connections, 0 = closed loop
+    double duration;
+    double warmup;
+    const char *prefix;
+    uint64_t seed;
+} opt = { "127.0.0.1", "9000", 100, 1000, 10, 2, "bench", 1 };
+
+static int epfd;
+static Conn *conns;
+static int nready, ndead;
+static uint64_t rng;
+
+static uint64_t measure_start, measure_end;
+static Hist hist[OP_COUNT + 1];     // per op, then all
+static uint64_t sent, completed, errors, unsent, queued, late;
+
+static uint64_t rand64(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+/* ---- I/O ---- */
+
+static void conn_fail(Conn *c, const char *why) {
+    if (c->st == ST_DEAD) return;
+    if (c->st == ST_READY) nready--;
+    c->st = ST_DEAD;
+    ndead++;
+    errors += (uint64_t)c->pn + (c->wn - c->wh);
+    c->pn = 0;
+    c->wh = c->wn = 0;
+    fprintf(stderr, "conn %d: %s\n", c->index, why);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+}
+
+static void conn_flush(Conn *c) {
+    while (c->out.off < c->out.len) {
+        ssize_t n = send(c->fd, c->out.data + c->out.off, c->out.len - c->out.off, MSG_NOSIGNAL);
+        if (n > 0) {
+            c->out.off += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;     // EPOLLOUT finishes it
+        } else {
+            conn_fail(c, "send failed");
+            return;
+        }
+    }
+    c->out.off = c->out.len = 0;
+}
+
+// Queue one request; fields are "s" (string) or "i" (int) per character.
+static void conn_request(Conn *c, int op, uint64_t due, const char *types, ...) {
+    unsigned id = ++c->next_id ? c->next_id : ++c->next_id;
+    va_list ap;
+    va_start(ap, types);
+    frame_begin(&c->out, id);
+    for (const char *t = types; *t; t++) {
+        if (*t == 's') {
+            const char *str = va_arg(ap, const char *);
+            frame_str(&c->out, str, strlen(str));
+        } else {
+            frame_int(&c->out, va_arg(ap, int));
+        }
+    }
+    frame_end(&c->out);
+    va_end(ap);
+
+    Pending *p = &c->pend[(c->ph + c->pn) % MAX_INFLIGHT];
+    p->id = id;
+    p->op = op;
+    p->due = due;
+    c->pn++;
+    conn_flush(c);
+}
+
+/* ---- setup ---- */
+
+static void setup_next(Conn *c) {
+    switch (c->st) {
+    case ST_HELLO:
+        c->st = ST_REGISTER;
+        conn_request(c, OP_SETUP, 0, "sss", CMD_REGISTER, c->user, "bench");
+        break;
+    case ST_REGISTER:   // an existing user is fine
+        c->st = ST_LOGIN;
+        conn_request(c, OP_SETUP, 0, "sss", CMD_LOGIN, c->user, "bench");
+        break;
+    case ST_LOGIN:
+        c->st = ST_CREATE_PROJECT;
+        conn_request(c, OP_SETUP, 0, "ss", CMD_CREATE_PROJECT, c->project);
+        break;
+    case ST_CREATE_PROJECT:
+        c->st = ST_FIND_PROJECT;
+        c->found_id = 0;
+        conn_request(c, OP_SETUP, 0, "s", CMD_LIST_PROJECT);
+        break;
+    case ST_FIND_PROJECT:
+        if (!c->found_id) {
+            conn_fail(c, "own project not listed");
+            return;
+        }
+        c->project_id = c->found_id;
+        c->st = ST_CREATE_TASK;
+        conn_request(c, OP_SETUP, 0, "sisssss", CMD_CREATE_TASK, c->project_id, "bench task",
+                     "created by loadgen", c->user, "2026-01-01", "2026-12-31");
+        break;
+    case ST_CREATE_TASK:
+        c->st = ST_FIND_TASK;
+        c->found_id = 0;
+        conn_request(c, OP_SETUP, 0, "si", CMD_LIST_TASK, c->project_id);
+        break;
+    case ST_FIND_TASK:
+        if (!c->found_id) {
+            conn_fail(c, "own task not listed");
+            return;
+        }
+        c->task_id = c->found_id;
+        c->st = ST_READY;
+        nready++;
+        break;
+    default:
+        break;
+    }
+}
+
+/* ---- load ---- */
+
+static int pick_op(void) {
+    int r = (int)(rand64() % (uint64_t)weight_total);
+    for (int i = 0; i < OP_COUNT; i++) {
+        if (r < op_weight[i]) return i;
+        r -= op_weight[i];
+    }
+    return OP_LIST_TASK;
+}
+
+static void issue(Conn *c, uint64_t due) {
+    int op = pick_op();
+    char text[64];
+    switch (op) {
+    case OP_CREATE_TASK:
+        conn_request(c, op, due, "sisssss", CMD_CREATE_TASK, c->project_id, "load task",
+                     "created by loadgen", c->user, "2026-01-01", "2026-12-31");
+        break;
+    case OP_LIST_TASK:
+        conn_request(c, op, due, "si", CMD_LIST_TASK, c->project_id);
+        break;
+    case OP_SEND_CHAT:
+        snprintf(text, sizeof(text), "load %llu", (unsigned long long)sent);
+        conn_request(c, op, due, "sis", CMD_SEND_CHAT, c->project_id, text);
+        break;
+    case OP_LIST_CHAT:
+        conn_request(c, op, due, "sii", CMD_LIST_CHAT, c->project_id, c->chat_after);
+        break;
+    case OP_UPDATE_PROGRESS:
+        conn_request(c, op, due, "sii", CMD_UPDATE_TASK_PROGRESS, c->task_id, (int)(rand64() % 101));
+        break;
+    }
+    sent++;
+}
+
+// Hold a due request until c has a free slot.
+static void wait_for_slot(Conn *c, uint64_t due) {
+    grow((char **)&c->waiting, &c->wcap, (c->wn + 1) * sizeof(uint64_t));
+    c->waiting[c->wn++] = due;
+    queued++;
+}
+
+/* ---- responses ---- */
+
+// Look at the rows of one frame: remember the id (first column) of the row
+// whose second column is name, or of the last row if name is NULL.
+static void scan_rows(Conn *c, const char *p, size_t len, const char *name) {
+    size_t i = 0;
+    while (i < len) {
+        unsigned char t = (unsigned char)p[i++];
+        if (t == WIRE_ROW) {
+            if (i + 2 > len) return;
+            i += 2;
+            if (i + 5 > len || p[i] != WIRE_INT) continue;
+            int id = (int)get_u32(p + i + 1);
+            i += 5;
+            if (!name) {
+                c->found_id = id;
+            } else if (i + 5 <= len && p[i] == WIRE_STR) {
+                uint32_t n = get_u32(p + i + 1);
+                if (i + 5 + n <= len && n == strlen(name) && memcmp(p + i + 5, name, n) == 0)
+                    c->found_id = id;
+            }
+        } else if (t == WIRE_INT) {
+            i += 4;
+        } else if (t == WIRE_STR) {
+            if (i + 4 > len) return;
+            i += 4 + get_u32(p + i);
+        } else if (t != WIRE_NULL) {
+            return;
+        }
+    }
+}
+
+static void on_frame(Conn *c, const char *f, size_t len) {
+    if (len < WIRE_HEADER - 4 || c->pn == 0) {
+        conn_fail(c, "unexpected frame");
+        return;
+    }
+    unsigned id = get_u32(f);
+    int code = (unsigned char)f[4];
+    int more = f[5] & WIRE_MORE;
+    Pending *p = &c->pend[c->ph];
+    if (id != p->id) {
+        conn_fail(c, "response out of order");
+        return;
+    }
+
+    const char *body = f + WIRE_HEADER - 4;
+    size_t blen = len - (WIRE_HEADER - 4);
+    if (c->st == ST_FIND_PROJECT) scan_rows(c, body, blen, c->project);
+    else if (c->st == ST_FIND_TASK) scan_rows(c, body, blen, NULL);
+    else if (p->op == OP_LIST_CHAT) {
+        c->found_id = 0;
+        scan_rows(c, body, blen, NULL);
+        if (c->found_id > c->chat_after) c->chat_after = c->found_id;
+    }
+    if (more) return;
+
+    Pending done = *p;
+    c->ph = (c->ph + 1) % MAX_INFLIGHT;
+    c->pn--;
+
+    if (done.op == OP_SETUP) {
+        // REGISTER may fail when the user is left from an earlier run
+        if (code != 0 && c->st != ST_REGISTER) {
+            conn_fail(c, "setup request failed");
+            return;
+        }
+        setup_next(c);
+        return;
+    }
+
+    uint64_t now = now_ns();
+    if (done.due >= measure_start && done.due < measure_end) {
+        uint64_t us = (now - done.due) / 1000;
+        hist_add(&hist[done.op], us);
+        hist_add(&hist[OP_COUNT], us);
+        completed++;
+        if (code != 0) errors++;
+    }
+    if (c->wh < c->wn) {
+        uint64_t due = c->waiting[c->wh++];
+        if (c->wh == c->wn) c->wh = c->wn = 0;
+        issue(c, due);
+    } else if (opt.rate == 0 && now < measure_end) {
+        issue(c, now);
+    }
+}
+
+static void conn_read(Conn *c) {
+    for (;;) {
+        grow(&c->in, &c->in_cap, c->in_len + 65536);
+        ssize_t n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+        if (n == 0) {
+            conn_fail(c, "server closed the connection");
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) conn_fail(c, "recv failed");
+            break;
+        }
+        c->in_len += (size_t)n;
+    }
+
+    size_t off = 0;
+    if (c->st == ST_HELLO) {
+        if (c->in_len < 6) return;
+        if (memcmp(c->in, "0|BIN\n", 6) != 0) {
+            conn_fail(c, "server refused HELLO|BIN");
+            return;
+        }
+        off = 6;
+        setup_next(c);
+    }
+    while (c->st != ST_DEAD && c->in_len - off >= 4) {
+        uint32_t len = get_u32(c->in + off);
+        if (c->in_len - off - 4 < len) break;
+        on_frame(c, c->in + off + 4, len);
+        off += 4 + len;
+    }
+    if (c->st == ST_DEAD) return;
+    memmove(c->in, c->in + off, c->in_len - off);
+    c->in_len -= off;
+}
+
+static void on_event(Conn *c, uint32_t ev) {
+    if (c->st == ST_DEAD) return;
+    if (c->st == ST_CONNECTING && (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        int err = 0;
+        socklen_t l = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &l);
+        if (err) {
+            errno = err;
+            conn_fail(c, strerror(err));
+            return;
+        }
+        c->st = ST_HELLO;
+        grow(&c->out.data, &c->out.cap, 16);
+        memcpy(c->out.data, "HELLO|BIN\n", 10);
+        c->out.len = 10;
+    }
+    if (ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) conn_read(c);
+    if (c->st != ST_DEAD && (ev & EPOLLOUT)) conn_flush(c);
+}
+
+static void poll_once(int timeout_ms) {
+    struct epoll_event evs[MAX_EVENTS];
+    int n = epoll_wait(epfd, evs, MAX_EVENTS, timeout_ms);
+    if (n < 0 && errno != EINTR) die("epoll_wait");
+    for (int i = 0; i < n; i++) on_event(evs[i].data.ptr, evs[i].events);
+}
+
+/* ---- main ---- */
+
+static void open_conns(const struct addrinfo *ai) {
+    conns = calloc((size_t)opt.conns, sizeof(Conn));
+    if (!conns) die("calloc");
+    for (int i = 0; i < opt.conns; i++) {
+        Conn *c = &conns[i];
+        c->index = i;
+        snprintf(c->user, sizeof(c->user), "%s%d", opt.prefix, i);
+        snprintf(c->project, sizeof(c->project), "%s-%d-%llu", opt.prefix, i,
+                 (unsigned long long)time(NULL));
+        c->fd = connect_nb(ai);
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = c };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) die("epoll_ctl");
+        // don't flood the listen backlog
+        if (i % 256 == 255) poll_once(0);
+    }
+}
+
+static void parse_mix(const char *spec) {
+    char *copy = strdup(spec), *save = NULL;
+    for (int i = 0; i < OP_COUNT; i++) op_weight[i] = 0;
+    for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        int i = 0;
+        if (eq) *eq = '\0';
+        while (i < OP_COUNT && strcmp(op_name[i], tok) != 0) i++;
+        if (!eq || i == OP_COUNT) {
+            fprintf(stderr, "bad mix entry '%s'\n", tok);
+            exit(2);
+        }
+        op_weight[i] = atoi(eq + 1);
+    }
+    free(copy);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-c connections] [-r rate] [-d seconds]\n"
+            "          [-w warmup_seconds] [-m OP=weight,...] [-u user_prefix] [-s seed]\n"
+            "  -r 0 runs closed loop (one request in flight per connection)\n"
+            "  ops: CREATE_TASK LIST_TASK SEND_CHAT LIST_CHAT UPDATE_TASK_PROGRESS\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int ch;
+    while ((ch = getopt(argc, argv, "h:p:c:r:d:w:m:u:s:")) != -1) {
+        switch (ch) {
+        case 'h': opt.host = optarg; break;
+        case 'p': opt.port = optarg; break;
+        case 'c': opt.conns = atoi(optarg); break;
+        case 'r': opt.rate = atof(optarg); break;
+        case 'd': opt.duration = atof(optarg); break;
+        case 'w': opt.warmup = atof(optarg); break;
+        case 'm': parse_mix(optarg); break;
+        case 'u': opt.prefix = optarg; break;
+        case 's': opt.seed = strtoull(optarg, NULL, 10); break;
+        default: usage(argv[0]);
+        }
+    }
+    for (int i = 0; i < OP_COUNT; i++) weight_total += op_weight[i];
+    if (opt.conns <= 0 || opt.rate < 0 || opt.duration <= 0 || weight_total <= 0) usage(argv[0]);
+    rng = opt.seed ? opt.seed : 1;
+
+    raise_nofile();
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *ai;
+    int rc = getaddrinfo(opt.host, opt.port, &hints, &ai);
+    if (rc != 0) {
+        fprintf(stderr, "%s: %s\n", opt.host, gai_strerror(rc));
+        return 1;
+    }
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) die("epoll_create1");
+
+    // setup: every connection gets to ST_READY or gives up
+    uint64_t t0 = now_ns();
+    open_conns(ai);
+    freeaddrinfo(ai);
+    while (nready + ndead < opt.conns) poll_once(100);
+    double setup_s = (now_ns() - t0) / 1e9;
+    if (nready == 0) {
+        fprintf(stderr, "no connection got through setup\n");
+        return 1;
+    }
+    fprintf(stderr, "%d connections ready in %.2fs (%d failed)\n", nready, setup_s, ndead);
+
+    uint64_t start = now_ns();
+    measure_start = start + (uint64_t)(opt.warmup * 1e9);
+    measure_end = measure_start + (uint64_t)(opt.duration * 1e9);
+
+    if (opt.rate == 0) {
+        for (int i = 0; i < opt.conns; i++)
+            if (conns[i].st == ST_READY) issue(&conns[i], start);
+        while (now_ns() < measure_end) poll_once(10);
+    } else {
+        // one request every interval, each to the next connection in turn
+        double interval = 1e9 / opt.rate;
+        uint64_t k = 0;
+        int rr = 0;
+        for (;;) {
+            uint64_t now = now_ns();
+            uint64_t due;
+            while ((due = start + (uint64_t)(k * interval)) <= now && due < measure_end) {
+                // the next connection with a free slot; if every one is
+                // full, the request waits on the first ready one instead of
+                // being dropped, so overload still shows in the latencies
+                Conn *c = NULL, *full = NULL;
+                for (int tries = 0; tries < opt.conns && !c; tries++) {
+                    Conn *x = &conns[rr];
+                    rr = (rr + 1) % opt.conns;
+                    if (x->st != ST_READY) continue;
+                    if (x->pn < MAX_INFLIGHT && x->wh == x->wn) c = x;
+                    else if (!full) full = x;
+                }
+                if (c) issue(c, due);
+                else if (full) wait_for_slot(full, due);
+                else unsent++;      // no connection left
+                if (now - due > 1000000) late++;  // the generator itself fell behind
+                k++;
+            }
+            if (due >= measure_end) break;
+            uint64_t wait = (due - now) / 1000000;
+            poll_once(wait > 10 ? 10 : (int)wait);
+        }
+    }
+
+    // answers still on the way count, with their full latency
+    uint64_t drain_until = now_ns() + DRAIN_SECONDS * 1000000000ULL;
+    for (;;) {
+        int inflight = 0;
+        for (int i = 0; i < opt.conns; i++)
+            if (conns[i].st == ST_READY) inflight += conns[i].pn + (int)(conns[i].wn - conns[i].wh);
+        if (inflight == 0 || now_ns() >= drain_until) break;
+        poll_once(10);
+    }
+    uint64_t timeouts = 0;
+    for (int i = 0; i < opt.conns; i++) {
+        const Conn *c = &conns[i];
+        for (int j = 0; c->st == ST_READY && j < c->pn; j++) {
+            const Pending *p = &c->pend[(c->ph + j) % MAX_INFLIGHT];
+            if (p->due >= measure_start && p->due < measure_end) timeouts++;
+        }
+        for (size_t j = c->wh; c->st == ST_READY && j < c->wn; j++)
+            if (c->waiting[j] >= measure_start && c->waiting[j] < measure_end) timeouts++;
+    }
+
+    printf("{\n");
+    printf("  \"connections\": %d,\n  \"ready\": %d,\n  \"setup_s\": %.3f,\n", opt.conns, nready, setup_s);
+    printf("  \"target_rate\": %.1f,\n  \"duration_s\": %.3f,\n  \"warmup_s\": %.3f,\n",
+           opt.rate, opt.duration, opt.warmup);
+    printf("  \"mix\": {");
+    for (int i = 0; i < OP_COUNT; i++)
+        printf("\"%s\": %d%s", op_name[i], op_weight[i], i + 1 < OP_COUNT ? ", " : "");
+    printf("},\n");
+    printf("  \"sent\": %llu,\n  \"completed\": %llu,\n  \"errors\": %llu,\n  \"timeouts\": %llu,\n"
+           "  \"unsent\": %llu,\n  \"queued_for_slot\": %llu,\n  \"generator_late\": %llu,\n",
+           (unsigned long long)sent, (unsigned long long)completed, (unsigned long long)errors,
+           (unsigned long long)timeouts, (unsigned long long)unsent, (unsigned long long)queued,
+           (unsigned long long)late);
+    printf("  \"throughput_rps\": %.1f,\n", completed / opt.duration);
+    printf("  \"latency_us\": {\n");
+    hist_print_json(stdout, "all", &hist[OP_COUNT], 0);
+    for (int i = 0; i < OP_COUNT; i++) hist_print_json(stdout, op_name[i], &hist[i], i + 1 == OP_COUNT);
+    printf("  }\n}\n");
+    return 0;
+}
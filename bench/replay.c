@@ -0,0 +1,548 @@
+// Replay the requests recorded in server logs against a server.
+//
+// Reads the "RECV: [sN] CMD|..." lines the server writes at TRACE level
+// (see log_request in server/handler.c), groups them by session, and gives
+// each session its own connection that re-sends its requests in order:
+// at their original pacing (scaled by -x), or with -x 0 as fast as the
+// server answers, each session waiting for one answer before the next
+// request. A session's connection is closed where the log has its CLOSE.
+//
+// Masked passwords ("***") are replaced by -P, so replay against a server
+// whose users were made by the replayed REGISTERs or by bench/dataset.
+// Lines cut at the payload cap ("RECV cut:"), and HELLO requests (replay
+// always speaks the binary protocol), are skipped. Requests carry the ids
+// the original server handed out, so start the target from a copy of the
+// database as it was when the log began; ids of rows created concurrently
+// by several sessions may still come out differently, and show up as
+// errors.
+#define _GNU_SOURCE
+#include "bench.h"
+#include "../client/protocol.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define MAX_EVENTS 256
+#define MAX_COMMANDS 64         // distinct command names reported
+#define SESSION_BUCKETS 4096
+
+typedef struct {
+    uint64_t at;        // ms since the first recorded request
+    int sess;           // index into sessions
+    int close;          // CLOSE rather than a request
+    char *req;          // escaped "CMD|f1|f2..." (NUL-terminated)
+} Event;
+
+typedef enum { S_IDLE, S_CONNECTING, S_HELLO, S_READY, S_DONE } SessState;
+
+typedef struct {
+    unsigned id;        // session number in the log
+    SessState st;
+    int fd;
+    int closing;        // CLOSE seen: close once everything is answered
+    int *events;        // its requests, in order
+    int nevents, cap, next;
+    Wbuf out;
+    char *in;
+    size_t in_len, in_cap;
+    // answers outstanding, oldest first; the server answers in order
+    struct Pending { unsigned id; int cmd; uint64_t sent; } *pend;
+    int ph, pn, pcap;
+    unsigned next_id;
+    int link;           // next session with the same id hash
+} Session;
+
+static struct {
+    const char *host;
+    const char *port;
+    double speed;       // 1 = recorded pacing, 0 = as fast as possible
+    int concurrency;    // sessions open at once with -x 0
+    const char *password;
+    double drain;       // seconds to wait for answers at the end
+} opt = { "127.0.0.1", "9000", 1, 1000, "bench", 10 };
+
+static Event *events;
+static int nevents, events_cap;
+static Session *sessions;
+static int nsessions, sessions_cap;
+static int buckets[SESSION_BUCKETS];
+
+static const char *cmd_names[MAX_COMMANDS + 1];
+static int ncmds;
+static Hist hist[MAX_COMMANDS + 2];     // per command, "(other)", all
+static uint64_t cmd_errors[MAX_COMMANDS + 1];
+
+static int epfd;
+static const struct addrinfo *server;
+static int open_sessions;
+static uint64_t start;
+static uint64_t skipped, sent, completed, errors, failed_sessions;
+
+/* ---- reading the log ---- */
+
+static char *read_all(const char *path, size_t *len) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!f) die(path);
+    char *data = NULL;
+    size_t cap = 0, n = 0, got;
+    do {
+        grow(&data, &cap, n + 65536 + 1);
+        got = fread(data + n, 1, cap - n - 1, f);
+        n += got;
+    } while (got > 0);
+    if (f != stdin) fclose(f);
+    data[n] = '\0';
+    *len = n;
+    return data;
+}
+
+// "[dd-mm HH:MM:SS.mmm] " (milliseconds optional) to ms, or 0 if the line
+// does not start with a stamp. The year is not logged; this one is used.
+static uint64_t parse_stamp(const char *p, const char **rest) {
+    int d, mo, h, mi, s, ms = 0, n = 0;
+    if (sscanf(p, "[%d-%d %d:%d:%d.%d] %n", &d, &mo, &h, &mi, &s, &ms, &n) < 6 || n == 0) {
+        n = 0;
+        ms = 0;
+        if (sscanf(p, "[%d-%d %d:%d:%d] %n", &d, &mo, &h, &mi, &s, &n) < 5 || n == 0) return 0;
+    }
+    time_t now = time(NULL);
+    struct tm t;
+    localtime_r(&now, &t);
+    t.tm_mday = d;
+    t.tm_mon = mo - 1;
+    t.tm_hour = h;
+    t.tm_min = mi;
+    t.tm_sec = s;
+    t.tm_isdst = -1;
+    *rest = p + n;
+    return (uint64_t)mktime(&t) * 1000 + (uint64_t)ms;
+}
+
+// Session for log id, starting a new one if id has not been seen or was
+// closed (the server restarted and numbers began again).
+static int session_for(unsigned id) {
+    int b = (int)(id % SESSION_BUCKETS);
+    for (int i = buckets[b] - 1; i >= 0; i = sessions[i].link - 1)
+        if (sessions[i].id == id && !sessions[i].closing) return i;
+
+    if (nsessions == sessions_cap) {
+        sessions_cap = sessions_cap ? sessions_cap * 2 : 1024;
+        sessions = realloc(sessions, (size_t)sessions_cap * sizeof(Session));
+        if (!sessions) die("realloc");
+    }
+    Session *s = &sessions[nsessions];
+    memset(s, 0, sizeof(*s));
+    s->id = id;
+    s->fd = -1;
+    s->link = buckets[b];
+    buckets[b] = ++nsessions;
+    return nsessions - 1;
+}
+
+static void add_event(uint64_t at, int sess, int close, char *req) {
+    if (nevents == events_cap) {
+        events_cap = events_cap ? events_cap * 2 : 65536;
+        events = realloc(events, (size_t)events_cap * sizeof(Event));
+        if (!events) die("realloc");
+    }
+    events[nevents] = (Event){ at, sess, close, req };
+
+    Session *s = &sessions[sess];
+    if (close) {
+        s->closing = 1;     // later requests with this id are a new session
+    } else {
+        if (s->nevents == s->cap) {
+            s->cap = s->cap ? s->cap * 2 : 16;
+            s->events = realloc(s->events, (size_t)s->cap * sizeof(int));
+            if (!s->events) die("realloc");
+        }
+        s->events[s->nevents++] = nevents;
+    }
+    nevents++;
+}
+
+static void load_log(const char *path) {
+    size_t len;
+    char *data = read_all(path, &len);
+    static uint64_t first, last;
+
+    for (char *line = data; line < data + len;) {
+        char *nl = memchr(line, '\n', (size_t)(data + len - line));
+        char *end = nl ? nl : data + len;
+        *end = '\0';
+
+        const char *p;
+        uint64_t at = parse_stamp(line, &p);
+        unsigned id;
+        int n = 0, close = 0;
+        if (at && strncmp(p, "RECV: [s", 8) == 0) {
+            p += 8;
+        } else if (at && strncmp(p, "CLOSE: [s", 9) == 0) {
+            p += 9;
+            close = 1;
+        } else {
+            if (at && strncmp(p, "RECV cut: ", 10) == 0) skipped++;
+            line = end + 1;
+            continue;
+        }
+        if (sscanf(p, "%u] %n", &id, &n) < 1 || (n == 0 && !close)) {
+            skipped++;
+            line = end + 1;
+            continue;
+        }
+        char *req = (char *)p + n;
+
+        if (!first) first = at;
+        if (at < last) at = last;   // clock stepped back
+        last = at;
+
+        if (close) {
+            int b = (int)(id % SESSION_BUCKETS);
+            for (int i = buckets[b] - 1; i >= 0; i = sessions[i].link - 1) {
+                if (sessions[i].id == id && !sessions[i].closing) {
+                    add_event(at - first, i, 1, NULL);
+                    break;
+                }
+            }
+        } else if (req[0] == '(' || strncmp(req, "HELLO", 5) == 0) {
+            skipped++;      // malformed frame or protocol switch
+        } else {
+            add_event(at - first, session_for(id), 0, req);
+        }
+        line = end + 1;
+    }
+}
+
+/* ---- sending ---- */
+
+static int cmd_index(const char *name, size_t len) {
+    for (int i = 0; i < ncmds; i++)
+        if (strncmp(cmd_names[i], name, len) == 0 && cmd_names[i][len] == '\0') return i;
+    if (ncmds == MAX_COMMANDS) return MAX_COMMANDS;
+    cmd_names[ncmds] = strndup(name, len);
+    return ncmds++;
+}
+
+// Append req as one frame, every field a string (the server reads numbers
+// from either form). Fields end at a '|' not escaped by a backslash, are
+// unescaped, and a masked password restored.
+static int encode_request(Wbuf *w, unsigned id, const char *req) {
+    static char *field;
+    static size_t field_cap;
+    int cmd = -1, login = 0;
+
+    frame_begin(w, id);
+    for (int i = 0;; i++) {
+        const char *bar = req;
+        while (*bar && *bar != '|') bar += bar[0] == '\\' && bar[1] ? 2 : 1;
+        size_t n = (size_t)(bar - req);
+        if (i == 0) {
+            cmd = cmd_index(req, n);
+            login = (n == strlen(CMD_LOGIN) && memcmp(req, CMD_LOGIN, n) == 0) ||
+                    (n == strlen(CMD_REGISTER) && memcmp(req, CMD_REGISTER, n) == 0);
+        }
+        if (login && i == 2 && n == 3 && memcmp(req, "***", 3) == 0) {
+            frame_str(w, opt.password, strlen(opt.password));
+        } else {
+            size_t m = 0;
+            grow(&field, &field_cap, n + 1);
+            for (size_t j = 0; j < n; j++) {
+                char ch = req[j];
+                if (ch == '\\' && j + 1 < n) {
+                    ch = req[++j];
+                    if (ch == 'n') ch = '\n';
+                    else if (ch == 'r') ch = '\r';
+                }
+                field[m++] = ch;
+            }
+            frame_str(w, field, m);
+        }
+        if (!*bar) break;
+        req = bar + 1;
+    }
+    frame_end(w);
+    return cmd;
+}
+
+static void sess_close(Session *s, int failed) {
+    if (s->st == S_DONE) return;
+    if (s->fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, s->fd, NULL);
+        close(s->fd);
+        open_sessions--;
+    }
+    if (failed) {
+        failed_sessions++;
+        errors += (uint64_t)s->pn + (uint64_t)(s->nevents - s->next);
+    }
+    s->st = S_DONE;
+    s->fd = -1;
+    s->pn = 0;
+    free(s->out.data);
+    free(s->in);
+    free(s->pend);
+    s->out = (Wbuf){ 0 };
+    s->in = NULL;
+    s->pend = NULL;
+}
+
+static void sess_flush(Session *s) {
+    if (s->st != S_READY) return;   // held until HELLO is answered
+    while (s->out.off < s->out.len) {
+        ssize_t n = send(s->fd, s->out.data + s->out.off, s->out.len - s->out.off, MSG_NOSIGNAL);
+        if (n > 0) {
+            s->out.off += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        } else {
+            sess_close(s, 1);
+            return;
+        }
+    }
+    s->out.off = s->out.len = 0;
+}
+
+static void sess_open(Session *s) {
+    s->fd = connect_nb(server);
+    s->st = S_CONNECTING;
+    open_sessions++;
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = s };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev) < 0) die("epoll_ctl");
+}
+
+// Queue the session's next request; sent is when it should have gone out.
+static void sess_send_next(Session *s, uint64_t when) {
+    if (s->st == S_IDLE) sess_open(s);
+    if (s->st == S_DONE) return;
+
+    if (s->pn == s->pcap) {
+        int cap = s->pcap ? s->pcap * 2 : 8;
+        struct Pending *p = malloc((size_t)cap * sizeof(*p));
+        if (!p) die("malloc");
+        for (int i = 0; i < s->pn; i++) p[i] = s->pend[(s->ph + i) % s->pcap];
+        free(s->pend);
+        s->pend = p;
+        s->pcap = cap;
+        s->ph = 0;
+    }
+    unsigned id = ++s->next_id ? s->next_id : ++s->next_id;
+    int cmd = encode_request(&s->out, id, events[s->events[s->next++]].req);
+    s->pend[(s->ph + s->pn++) % s->pcap] = (struct Pending){ id, cmd, when };
+    sent++;
+    sess_flush(s);
+}
+
+// With -x 0: keep up to -c sessions open, each with one request out.
+static int next_fast;
+
+static void fast_fill(void) {
+    while (open_sessions < opt.concurrency && next_fast < nsessions) {
+        Session *s = &sessions[next_fast++];
+        if (s->nevents > 0) sess_send_next(s, now_ns());
+    }
+}
+
+/* ---- answers ---- */
+
+static void on_frame(Session *s, const char *f, size_t len) {
+    if (len < WIRE_HEADER - 4 || s->pn == 0 || get_u32(f) != s->pend[s->ph].id) {
+        sess_close(s, 1);
+        return;
+    }
+    if (f[5] & WIRE_MORE) return;
+
+    struct Pending p = s->pend[s->ph];
+    s->ph = (s->ph + 1) % s->pcap;
+    s->pn--;
+
+    uint64_t now = now_ns();
+    uint64_t us = (now - p.sent) / 1000;
+    hist_add(&hist[p.cmd], us);
+    hist_add(&hist[MAX_COMMANDS + 1], us);
+    completed++;
+    if (f[4] != 0) {
+        errors++;
+        cmd_errors[p.cmd]++;
+    }
+
+    if (opt.speed == 0 && s->next < s->nevents) sess_send_next(s, now);
+    else if (s->pn == 0 && (s->closing || opt.speed == 0) && s->next == s->nevents) sess_close(s, 0);
+}
+
+static void sess_read(Session *s) {
+    for (;;) {
+        grow(&s->in, &s->in_cap, s->in_len + 65536);
+        ssize_t n = recv(s->fd, s->in + s->in_len, s->in_cap - s->in_len, 0);
+        if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            sess_close(s, 1);
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        s->in_len += (size_t)n;
+    }
+
+    size_t off = 0;
+    if (s->st == S_HELLO) {
+        if (s->in_len < 6) return;
+        if (memcmp(s->in, "0|BIN\n", 6) != 0) {
+            sess_close(s, 1);
+            return;
+        }
+        off = 6;
+        s->st = S_READY;
+        sess_flush(s);
+    }
+    while (s->st == S_READY && s->in_len - off >= 4) {
+        uint32_t len = get_u32(s->in + off);
+        if (s->in_len - off - 4 < len) break;
+        on_frame(s, s->in + off + 4, len);
+        off += 4 + len;
+    }
+    if (s->st == S_DONE) return;
+    memmove(s->in, s->in + off, s->in_len - off);
+    s->in_len -= off;
+}
+
+static void on_event(Session *s, uint32_t ev) {
+    if (s->st == S_DONE) return;
+    if (s->st == S_CONNECTING && (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        int err = 0;
+        socklen_t l = sizeof(err);
+        getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &l);
+        if (err || send(s->fd, "HELLO|BIN\n", 10, MSG_NOSIGNAL) != 10) {
+            sess_close(s, 1);
+            return;
+        }
+        s->st = S_HELLO;
+    }
+    if (ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) sess_read(s);
+    if (s->st == S_READY && (ev & EPOLLOUT)) sess_flush(s);
+}
+
+static void poll_once(int timeout_ms) {
+    struct epoll_event evs[MAX_EVENTS];
+    int n = epoll_wait(epfd, evs, MAX_EVENTS, timeout_ms);
+    if (n < 0 && errno != EINTR) die("epoll_wait");
+    for (int i = 0; i < n; i++) on_event(evs[i].data.ptr, evs[i].events);
+    if (opt.speed == 0) fast_fill();
+}
+
+/* ---- main ---- */
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-x speed] [-c sessions] [-P password]\n"
+            "          [-t drain_seconds] server.log... (- for stdin)\n"
+            "  -x 1 keeps the recorded pacing, 2 replays twice as fast, 0 as fast as\n"
+            "     possible with up to -c sessions at once\n"
+            "  logs need RECV lines at trace level, e.g. QLCV_LOG=trace\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int ch;
+    while ((ch = getopt(argc, argv, "h:p:x:c:P:t:")) != -1) {
+        switch (ch) {
+        case 'h': opt.host = optarg; break;
+        case 'p': opt.port = optarg; break;
+        case 'x': opt.speed = atof(optarg); break;
+        case 'c': opt.concurrency = atoi(optarg); break;
+        case 'P': opt.password = optarg; break;
+        case 't': opt.drain = atof(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind == argc || opt.speed < 0 || opt.concurrency <= 0) usage(argv[0]);
+
+    for (int i = optind; i < argc; i++) load_log(argv[i]);
+    // ids may be reused by the next log's server, so closing flags were
+    // only for parsing
+    for (int i = 0; i < nsessions; i++) sessions[i].closing = 0;
+    int nrequests = nevents;
+    for (int i = 0; i < nevents; i++) nrequests -= events[i].close;
+    if (nrequests == 0) {
+        fprintf(stderr, "no replayable requests (%llu lines skipped)\n", (unsigned long long)skipped);
+        return 1;
+    }
+    fprintf(stderr, "%d requests in %d sessions over %.1fs\n", nrequests, nsessions,
+            events[nevents - 1].at / 1000.0);
+
+    raise_nofile();
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *ai;
+    int rc = getaddrinfo(opt.host, opt.port, &hints, &ai);
+    if (rc != 0) {
+        fprintf(stderr, "%s: %s\n", opt.host, gai_strerror(rc));
+        return 1;
+    }
+    server = ai;
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) die("epoll_create1");
+
+    start = now_ns();
+    if (opt.speed == 0) {
+        fast_fill();
+        while (open_sessions > 0 || next_fast < nsessions) poll_once(100);
+    } else {
+        for (int k = 0; k < nevents;) {
+            uint64_t due = start + (uint64_t)(events[k].at * 1e6 / opt.speed);
+            uint64_t now = now_ns();
+            if (due > now) {
+                uint64_t wait = (due - now) / 1000000;
+                poll_once(wait > 10 ? 10 : (int)wait);
+                continue;
+            }
+            Session *s = &sessions[events[k].sess];
+            if (!events[k].close) sess_send_next(s, due);
+            else if (s->pn == 0) sess_close(s, 0);
+            else s->closing = 1;
+            k++;
+        }
+        uint64_t until = now_ns() + (uint64_t)(opt.drain * 1e9);
+        while (open_sessions > 0 && now_ns() < until) {
+            int waiting = 0;
+            for (int i = 0; i < nsessions && !waiting; i++) waiting = sessions[i].pn > 0;
+            if (!waiting) break;
+            poll_once(10);
+        }
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    uint64_t unanswered = 0;
+    for (int i = 0; i < nsessions; i++) unanswered += (uint64_t)sessions[i].pn;
+    freeaddrinfo(ai);
+
+    printf("{\n");
+    printf("  \"sessions\": %d,\n  \"failed_sessions\": %llu,\n  \"speed\": %.2f,\n", nsessions,
+           (unsigned long long)failed_sessions, opt.speed);
+    printf("  \"recorded_s\": %.3f,\n  \"elapsed_s\": %.3f,\n", events[nevents - 1].at / 1000.0, elapsed);
+    printf("  \"requests\": %d,\n  \"skipped_lines\": %llu,\n  \"sent\": %llu,\n  \"completed\": %llu,\n"
+           "  \"errors\": %llu,\n  \"unanswered\": %llu,\n",
+           nrequests, (unsigned long long)skipped, (unsigned long long)sent,
+           (unsigned long long)completed, (unsigned long long)errors, (unsigned long long)unanswered);
+    printf("  \"throughput_rps\": %.1f,\n", elapsed > 0 ? completed / elapsed : 0.0);
+    printf("  \"command_errors\": {");
+    for (int i = 0; i < ncmds; i++)
+        printf("%s\"%s\": %llu", i ? ", " : "", cmd_names[i], (unsigned long long)cmd_errors[i]);
+    if (hist[MAX_COMMANDS].n)
+        printf(", \"(other)\": %llu", (unsigned long long)cmd_errors[MAX_COMMANDS]);
+    printf("},\n");
+    printf("  \"latency_us\": {\n");
+    hist_print_json(stdout, "all", &hist[MAX_COMMANDS + 1], ncmds == 0);
+    for (int i = 0; i < ncmds; i++)
+        hist_print_json(stdout, cmd_names[i], &hist[i], i + 1 == ncmds && !hist[MAX_COMMANDS].n);
+    if (hist[MAX_COMMANDS].n) hist_print_json(stdout, "(other)", &hist[MAX_COMMANDS], 1);
+    printf("  }\n}\n");
+    return 0;
+}
@@ -59,7 +59,7 @@ typedef struct {
     // gantt
     GtkDrawingArea *gantt_area;
     int gantt_project_id;
-    char gantt_cache[4096];
+    NetReply gantt;         // last LIST_TASK_GANTT reply, drawn by gantt_draw_cb
 
     // chat
     GtkComboBoxText *chat_project_combo;
@@ -138,57 +138,48 @@ static void on_task_row_activated(GtkTreeView *view, GtkTreePath *path, GtkTreeV
     int tid = get_selected_task_id(a);
     if (tid <= 0) return;
 
-    char cmd[128];
-    snprintf(cmd, sizeof(cmd), "%s|%d\n", CMD_LIST_TASK_DETAIL, tid);
-    char payload[2048] = {0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
+    NetReply rep;
+    int code = net_call(a->sockfd, &rep, CMD_LIST_TASK_DETAIL, "i", tid);
     if (code != 0) {
-        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+        net_reply_free(&rep);
         return;
     }
-    if (!payload[0] || strcmp(payload, "No detail") == 0) {
+    if (rep.nrows == 0 || rep.rows[0].n < 9) {
         show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_INFO, "Task Detail", "No detail");
+        net_reply_free(&rep);
         return;
     }
-    // payload example: id|project_id|title|description|Assignee:...|Status:...|Progress:...|Start:...|End:...
-    // Try to sync the Progress spinbutton with the returned detail.
-    {
-        char *tmp = g_strdup(payload);
-        char *save = NULL;
-        for (char *tok = strtok_r(tmp, "|", &save); tok; tok = strtok_r(NULL, "|", &save)) {
-            if (g_str_has_prefix(tok, "Progress:")) {
-                int p = atoi(tok + 9);
-                if (p < 0)
-                    p = 0;
-                else if (p > 100)
-                    p = 100;
-                if (a->progress_spin) gtk_spin_button_set_value(a->progress_spin, p);
-                break;
-            }
-        }
-        g_free(tmp);
-    }
-    show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_INFO, "Task Detail", payload);
+    // row: id|project_id|title|description|assignee|status|progress|start|end
+    NetField *f = rep.rows[0].f;
+
+    // Sync the Progress spinbutton with the returned detail.
+    int p = f[6].i;
+    if (p < 0)
+        p = 0;
+    else if (p > 100)
+        p = 100;
+    if (a->progress_spin) gtk_spin_button_set_value(a->progress_spin, p);
+
+    char *text = g_strdup_printf(
+        "Task #%s (project %s)\n%s\n%s\n\nAssignee: %s\nStatus: %s\nProgress: %s%%\nStart: %s\nEnd: %s",
+        f[0].s, f[1].s, f[2].s, f[3].s, f[4].s, f[5].s, f[6].s, f[7].s, f[8].s);
+    show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_INFO, "Task Detail", text);
+    g_free(text);
+    net_reply_free(&rep);
 }
 
-static void fill_projects_combo(GtkComboBoxText *combo, const char *projects_payload) {
+static void fill_projects_combo(GtkComboBoxText *combo, const NetReply *projects) {
     gtk_combo_box_text_remove_all(combo);
-    if (!projects_payload || !*projects_payload) return;
-
-    char *dup = g_strdup(projects_payload);
-    char *save = NULL;
-    for (char *line = strtok_r(dup, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
-        if (!*line) continue;
-        char *sep = strchr(line, '|');
-        if (!sep) continue;
-        *sep = '\0';
-        const char *id = line;
-        const char *name = sep + 1;
+
+    // row: id|name
+    for (int i = 0; i < projects->nrows; i++) {
+        const NetRow *row = &projects->rows[i];
+        if (row->n < 2) continue;
         char label[256];
-        snprintf(label, sizeof(label), "%s - %s", id, name);
-        gtk_combo_box_text_append(combo, id, label);
+        snprintf(label, sizeof(label), "%s - %s", row->f[0].s, row->f[1].s);
+        gtk_combo_box_text_append(combo, row->f[0].s, label);
     }
-    g_free(dup);
 
     // auto select first
     GtkTreeModel *m = gtk_combo_box_get_model(GTK_COMBO_BOX(combo));
@@ -198,42 +189,38 @@ static void fill_projects_combo(GtkComboBoxText *combo, const char *projects_pay
 }
 
 static void refresh_projects(App *a) {
-    char payload[4096] = {0};
-    int code = net_request(a->sockfd, CMD_LIST_PROJECT "\n", payload, sizeof(payload));
+    NetReply rep;
+    int code = net_call(a->sockfd, &rep, CMD_LIST_PROJECT, "");
     projects_store_clear(a);
 
     if (code != 0) {
-        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+        net_reply_free(&rep);
         return;
     }
 
-    if (!payload[0] || strcmp(payload, "No projects") == 0) {
+    if (rep.nrows == 0) {
         // keep empty
         gtk_label_set_text(a->login_status, "");
         gtk_combo_box_text_remove_all(a->tasks_project_combo);
         gtk_combo_box_text_remove_all(a->chat_project_combo);
+        net_reply_free(&rep);
         return;
     }
 
     // add rows to store
-    char *dup = g_strdup(payload);
-    char *save = NULL;
-    for (char *line = strtok_r(dup, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
-        if (!*line) continue;
-        char *sep = strchr(line, '|');
-        if (!sep) continue;
-        *sep = '\0';
-        int id = atoi(line);
-        const char *name = sep + 1;
+    for (int i = 0; i < rep.nrows; i++) {
+        const NetRow *row = &rep.rows[i];
+        if (row->n < 2) continue;
         GtkTreeIter iter;
         gtk_list_store_append(a->projects_store, &iter);
-        gtk_list_store_set(a->projects_store, &iter, 0, id, 1, name, -1);
+        gtk_list_store_set(a->projects_store, &iter, 0, row->f[0].i, 1, row->f[1].s, -1);
     }
-    g_free(dup);
 
     // fill combos
-    fill_projects_combo(a->tasks_project_combo, payload);
-    fill_projects_combo(a->chat_project_combo, payload);
+    fill_projects_combo(a->tasks_project_combo, &rep);
+    fill_projects_combo(a->chat_project_combo, &rep);
+    net_reply_free(&rep);
 }
 
 static void refresh_tasks(App *a) {
@@ -243,61 +230,36 @@ static void refresh_tasks(App *a) {
         return;
     }
 
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "%s|%s\n", CMD_LIST_TASK, pid);
-    char payload[4096] = {0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
+    NetReply rep;
+    int code = net_call(a->sockfd, &rep, CMD_LIST_TASK, "i", atoi(pid));
 
     tasks_store_clear(a);
 
     if (code != 0) {
-        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+        net_reply_free(&rep);
         return;
     }
-    if (!payload[0] || strcmp(payload, "No tasks") == 0) return;
-
-    // expected: id|title|Assignee:name|Status:...|Start:...|End:...
-    char *dup = g_strdup(payload);
-    char *save = NULL;
-    for (char *line = strtok_r(dup, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
-        if (!*line) continue;
-
-        // tokenize by |
-        char *parts[8] = {0};
-        int pc = 0;
-        char *save2 = NULL;
-        for (char *t = strtok_r(line, "|", &save2); t && pc < 8; t = strtok_r(NULL, "|", &save2)) {
-            parts[pc++] = t;
-        }
-        if (pc < 3) continue;
-        int id = atoi(parts[0]);
-        const char *title = parts[1];
-        const char *assignee = "";
-        const char *status = "";
-        const char *progress = "";
-        const char *start = "";
-        const char *end = "";
-        for (int i = 2; i < pc; i++) {
-            if (g_str_has_prefix(parts[i], "Assignee:")) assignee = parts[i] + 9;
-            else if (g_str_has_prefix(parts[i], "Status:")) status = parts[i] + 7;
-            else if (g_str_has_prefix(parts[i], "Progress:")) progress = parts[i] + 9;
-            else if (g_str_has_prefix(parts[i], "Start:")) start = parts[i] + 6;
-            else if (g_str_has_prefix(parts[i], "End:")) end = parts[i] + 4;
-        }
+
+    // row: id|title|assignee|status|progress|start|end
+    for (int i = 0; i < rep.nrows; i++) {
+        const NetRow *row = &rep.rows[i];
+        if (row->n < 7) continue;
+        const NetField *f = row->f;
 
         GtkTreeIter iter;
         gtk_list_store_append(a->tasks_store, &iter);
         gtk_list_store_set(a->tasks_store, &iter,
-            0, id,
-            1, title,
-            2, assignee,
-            3, status,
-            4, progress,
-            5, start,
-            6, end,
+            0, f[0].i,
+            1, f[1].s,
+            2, f[2].s,
+            3, f[3].s,
+            4, f[4].s,
+            5, f[5].s,
+            6, f[6].s,
             -1);
     }
-    g_free(dup);
+    net_reply_free(&rep);
 }
 
 static gboolean gantt_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer user_data) {
@@ -309,60 +271,42 @@ static gboolean gantt_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer user_data
     cairo_set_source_rgb(cr, 1, 1, 1);
     cairo_paint(cr);
 
-    if (!a->gantt_cache[0] || strcmp(a->gantt_cache, "No tasks") == 0) {
+    if (a->gantt.nrows == 0) {
         cairo_set_source_rgb(cr, 0.2, 0.2, 0.2);
         cairo_move_to(cr, 10, 20);
         cairo_show_text(cr, "No tasks to show");
         return FALSE;
     }
 
-    // Parse tasks. If missing dates, render sequential bars.
-    // We'll map each task to a row; each day is 20px.
+    // Map each task to a row; each day is 20px. Missing dates render as
+    // sequential bars.
     const int left = 140;
     const int top = 20;
     const int row_h = 26;
     const int day_w = 20;
 
     // collect
-    typedef struct { char title[128]; char assignee[64]; int start; int end; char status[32]; int progress; } T;
+    typedef struct { const char *title; const char *assignee; int start; int end; const char *status; int progress; } T;
     T tasks[128];
     int n = 0;
 
-    char *dup = g_strdup(a->gantt_cache);
-    char *save = NULL;
-    for (char *line = strtok_r(dup, "\n", &save); line && n < 128; line = strtok_r(NULL, "\n", &save)) {
-        if (!*line) continue;
-        char *parts[8] = {0};
-        int pc = 0;
-        char *save2 = NULL;
-        for (char *t = strtok_r(line, "|", &save2); t && pc < 8; t = strtok_r(NULL, "|", &save2)) parts[pc++] = t;
-        if (pc < 2) continue;
-        strncpy(tasks[n].title, parts[1], sizeof(tasks[n].title)-1);
-        strncpy(tasks[n].assignee, "", sizeof(tasks[n].assignee)-1);
-        strncpy(tasks[n].status, "NOT_STARTED", sizeof(tasks[n].status)-1);
-        tasks[n].progress = 0;
-        int st = -1, en = -1;
-        for (int i=2;i<pc;i++) {
-            if (g_str_has_prefix(parts[i], "Status:")) {
-                strncpy(tasks[n].status, parts[i]+7, sizeof(tasks[n].status)-1);
-            } else if (g_str_has_prefix(parts[i], "Progress:")) {
-                int p = atoi(parts[i]+9);
-                if (p < 0) p = 0;
-                if (p > 100) p = 100;
-                tasks[n].progress = p;
-            } else if (g_str_has_prefix(parts[i], "Assignee:")) {
-                strncpy(tasks[n].assignee, parts[i]+9, sizeof(tasks[n].assignee)-1);
-            } else if (g_str_has_prefix(parts[i], "Start:")) {
-                const char *d = parts[i]+6;
-                if (d && strlen(d) >= 10) {
-                    // naive day index: yyyy-mm-dd -> yyyymmdd as int then modulo
-                    st = atoi(d+8); // day of month
-                }
-            } else if (g_str_has_prefix(parts[i], "End:")) {
-                const char *d = parts[i]+4;
-                if (d && strlen(d) >= 10) en = atoi(d+8);
-            }
-        }
+    // row: id|title|status|progress|start|end|assignee
+    for (int r = 0; r < a->gantt.nrows && n < 128; r++) {
+        const NetRow *row = &a->gantt.rows[r];
+        if (row->n < 7) continue;
+        const NetField *f = row->f;
+
+        tasks[n].title = f[1].s;
+        tasks[n].status = f[2].s[0] ? f[2].s : "NOT_STARTED";
+        int p = f[3].i;
+        if (p < 0) p = 0;
+        if (p > 100) p = 100;
+        tasks[n].progress = p;
+        tasks[n].assignee = f[6].s;
+
+        // naive day index: day of month of yyyy-mm-dd
+        int st = strlen(f[4].s) >= 10 ? atoi(f[4].s + 8) : -1;
+        int en = strlen(f[5].s) >= 10 ? atoi(f[5].s + 8) : -1;
         if (st < 0) st = n + 1;
         if (en < 0) en = st + 1;
         if (en < st) en = st;
@@ -370,7 +314,6 @@ static gboolean gantt_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer user_data
         tasks[n].end = en;
         n++;
     }
-    g_free(dup);
 
     // draw grid (days 1..31)
     cairo_set_source_rgb(cr, 0.85, 0.85, 0.85);
@@ -421,22 +364,15 @@ static gboolean gantt_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer user_data
 
 static void refresh_gantt(App *a, int project_id) {
     a->gantt_project_id = project_id;
-    a->gantt_cache[0] = '\0';
+    net_reply_free(&a->gantt);
 
     if (project_id <= 0) {
         gtk_widget_queue_draw(GTK_WIDGET(a->gantt_area));
         return;
     }
 
-    char cmd[128];
-    snprintf(cmd, sizeof(cmd), "%s|%d\n", CMD_LIST_TASK_GANTT, project_id);
-    char payload[4096] = {0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) {
-        strncpy(a->gantt_cache, "", sizeof(a->gantt_cache)-1);
-    } else {
-        strncpy(a->gantt_cache, payload, sizeof(a->gantt_cache)-1);
-    }
+    if (net_call(a->sockfd, &a->gantt, CMD_LIST_TASK_GANTT, "i", project_id) != 0)
+        net_reply_free(&a->gantt);
     gtk_widget_queue_draw(GTK_WIDGET(a->gantt_area));
 }
 
@@ -448,16 +384,14 @@ static void on_login_or_register(App *a, gboolean is_register) {
         return;
     }
 
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "%s|%s|%s\n", is_register ? CMD_REGISTER : CMD_LOGIN, u, p);
-
-    char payload[4096] = {0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-
+    NetReply rep;
+    int code = net_call(a->sockfd, &rep, is_register ? CMD_REGISTER : CMD_LOGIN, "ss", u, p);
     if (code != 0) {
-        gtk_label_set_text(a->login_status, payload[0] ? payload : "Fail");
+        gtk_label_set_text(a->login_status, rep.msg[0] ? rep.msg : "Fail");
+        net_reply_free(&rep);
         return;
     }
+    net_reply_free(&rep);
 
     if (is_register) {
         gtk_label_set_text(a->login_status, "Register OK. Bạn có thể login.");
@@ -478,8 +412,6 @@ static void on_login_or_register(App *a, gboolean is_register) {
     const char *pid_str = gtk_combo_box_text_get_active_text(a->tasks_project_combo);
     if (pid_str) pid = atoi(pid_str);
     refresh_gantt(a, pid);
-
-    a->last_chat_id = 0;
 }
 
 static void on_btn_register(GtkButton *btn, gpointer user_data) {
@@ -493,11 +425,10 @@ static void on_btn_create_project(GtkButton *btn, gpointer user_data) {
     App *a = (App*)user_data;
     const char *name = gtk_entry_get_text(a->create_project_entry);
     if (!name || !*name) return;
-    char cmd[512];
-    snprintf(cmd, sizeof(cmd), "%s|%s\n", CMD_CREATE_PROJECT, name);
-    char payload[512]={0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+    NetReply rep;
+    if (net_call(a->sockfd, &rep, CMD_CREATE_PROJECT, "s", name) != 0)
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+    net_reply_free(&rep);
     gtk_entry_set_text(a->create_project_entry, "");
     refresh_projects(a);
 }
@@ -511,11 +442,10 @@ static void on_btn_invite(GtkButton *btn, gpointer user_data) {
     }
     const char *user = gtk_entry_get_text(a->invite_user_entry);
     if (!user || !*user) return;
-    char cmd[512];
-    snprintf(cmd, sizeof(cmd), "%s|%d|%s\n", CMD_INVITE_MEMBER, pid, user);
-    char payload[512]={0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+    NetReply rep;
+    if (net_call(a->sockfd, &rep, CMD_INVITE_MEMBER, "is", pid, user) != 0)
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+    net_reply_free(&rep);
     gtk_entry_set_text(a->invite_user_entry, "");
     refresh_projects(a);
 }
@@ -529,7 +459,6 @@ static void on_tasks_project_changed(GtkComboBox *combo, gpointer user_data) {
     refresh_tasks(a);
     const char *pid = gtk_combo_box_text_get_active_text(a->tasks_project_combo);
     refresh_gantt(a, pid ? atoi(pid) : 0);
-    a->last_chat_id = 0; // reset chat when switching projects
 }
 
 static void on_btn_create_task(GtkButton *btn, gpointer user_data) {
@@ -554,12 +483,11 @@ static void on_btn_create_task(GtkButton *btn, gpointer user_data) {
         return;
     }
     if (!desc) desc = "";
-    char cmd[1024];
-    // new format: CREATE_TASK|pid|title|desc|assignee_username|start|end
-    snprintf(cmd, sizeof(cmd), "%s|%s|%s|%s|%s|%s|%s\n", CMD_CREATE_TASK, pid, title, desc, assignee, start, end);
-    char payload[512]={0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+    // CREATE_TASK|pid|title|desc|assignee_username|start|end
+    NetReply rep;
+    if (net_call(a->sockfd, &rep, CMD_CREATE_TASK, "isssss", atoi(pid), title, desc, assignee, start, end) != 0)
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+    net_reply_free(&rep);
     gtk_entry_set_text(a->task_title_entry, "");
     gtk_entry_set_text(a->task_desc_entry, "");
     gtk_entry_set_text(a->assign_user_entry, "");
@@ -583,11 +511,10 @@ static void on_btn_assign_task(GtkButton *btn, gpointer user_data) {
     }
     const char *user = gtk_entry_get_text(a->assign_user_entry);
     if (!user || !*user) return;
-    char cmd[512];
-    snprintf(cmd, sizeof(cmd), "%s|%d|%s\n", CMD_ASSIGN_TASK, tid, user);
-    char payload[512]={0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+    NetReply rep;
+    if (net_call(a->sockfd, &rep, CMD_ASSIGN_TASK, "is", tid, user) != 0)
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+    net_reply_free(&rep);
     refresh_tasks(a);
 }
 
@@ -601,11 +528,10 @@ static void on_btn_update_status(GtkButton *btn, gpointer user_data) {
     const char *status = gtk_combo_box_text_get_active_text(a->status_combo);
     if (tid <= 0 || !status) return;
 
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "%s|%d|%s\n", CMD_UPDATE_TASK_STATUS, tid, status);
-    char payload[512]={0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+    NetReply rep;
+    if (net_call(a->sockfd, &rep, CMD_UPDATE_TASK_STATUS, "is", tid, status) != 0)
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+    net_reply_free(&rep);
     refresh_tasks(a);
 
     const char *pid = gtk_combo_box_text_get_active_text(a->tasks_project_combo);
@@ -628,11 +554,10 @@ static void on_btn_update_progress(GtkButton *btn, gpointer user_data) {
     if (progress < 0) progress = 0;
     if (progress > 100) progress = 100;
 
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "%s|%d|%d\n", CMD_UPDATE_TASK_PROGRESS, tid, progress);
-    char payload[512] = {0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+    NetReply rep;
+    if (net_call(a->sockfd, &rep, CMD_UPDATE_TASK_PROGRESS, "ii", tid, progress) != 0)
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+    net_reply_free(&rep);
 
     refresh_tasks(a);
     const char *pid = gtk_combo_box_text_get_active_text(a->tasks_project_combo);
@@ -652,11 +577,10 @@ static void on_btn_set_dates(GtkButton *btn, gpointer user_data) {
         show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_WARNING, "Info", "Nhập Task ID + Start/End (YYYY-MM-DD)");
         return;
     }
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "%s|%d|%s|%s\n", CMD_SET_TASK_DATES, tid, start, end);
-    char payload[512]={0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+    NetReply rep;
+    if (net_call(a->sockfd, &rep, CMD_SET_TASK_DATES, "iss", tid, start, end) != 0)
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+    net_reply_free(&rep);
     refresh_tasks(a);
     const char *pid = gtk_combo_box_text_get_active_text(a->tasks_project_combo);
     if (pid) refresh_gantt(a, atoi(pid));
@@ -679,11 +603,10 @@ static void on_btn_add_comment(GtkButton *btn, gpointer user_data) {
     char *content = gtk_text_buffer_get_text(buf, &start, &end, FALSE);
     if (!content || !*content) { g_free(content); return; }
 
-    char cmd[2048];
-    snprintf(cmd, sizeof(cmd), "%s|%d|%s\n", CMD_ADD_COMMENT, tid, content);
-    char payload[512]={0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+    NetReply rep;
+    if (net_call(a->sockfd, &rep, CMD_ADD_COMMENT, "is", tid, content) != 0)
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+    net_reply_free(&rep);
 
     gtk_text_buffer_set_text(buf, "", -1);
     g_free(content);
@@ -698,12 +621,22 @@ static void on_btn_list_comments(GtkButton *btn, gpointer user_data) {
     if (!tid_s || !*tid_s) return;
     int tid = atoi(tid_s);
 
-    char cmd[128];
-    snprintf(cmd, sizeof(cmd), "%s|%d\n", CMD_LIST_COMMENTS, tid);
-    char payload[4096]={0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
-    set_textview(a->comments_list_text, payload);
+    NetReply rep;
+    if (net_call(a->sockfd, &rep, CMD_LIST_COMMENTS, "i", tid) != 0) {
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+        net_reply_free(&rep);
+        return;
+    }
+    // row: id|username|content|created_at
+    GString *text = g_string_new(NULL);
+    for (int i = 0; i < rep.nrows; i++) {
+        const NetField *f = rep.rows[i].f;
+        if (rep.rows[i].n < 4) continue;
+        g_string_append_printf(text, "#%s [%s] %s: %s\n", f[0].s, f[3].s, f[1].s, f[2].s);
+    }
+    set_textview(a->comments_list_text, text->str);
+    g_string_free(text, TRUE);
+    net_reply_free(&rep);
 }
 
 static void on_btn_add_attachment(GtkButton *btn, gpointer user_data) {
@@ -713,11 +646,10 @@ static void on_btn_add_attachment(GtkButton *btn, gpointer user_data) {
     const char *filepath = gtk_entry_get_text(a->attach_filepath_entry);
     if (!tid_s || !*tid_s || !filename || !*filename || !filepath || !*filepath) return;
     int tid = atoi(tid_s);
-    char cmd[1024];
-    snprintf(cmd, sizeof(cmd), "%s|%d|%s|%s\n", CMD_ADD_ATTACHMENT, tid, filename, filepath);
-    char payload[512]={0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+    NetReply rep;
+    if (net_call(a->sockfd, &rep, CMD_ADD_ATTACHMENT, "iss", tid, filename, filepath) != 0)
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+    net_reply_free(&rep);
 
     // auto reload attachments
     on_btn_list_attachments(NULL, user_data);
@@ -728,50 +660,104 @@ static void on_btn_list_attachments(GtkButton *btn, gpointer user_data) {
     const char *tid_s = gtk_entry_get_text(a->attach_task_id_entry);
     if (!tid_s || !*tid_s) return;
     int tid = atoi(tid_s);
-    char cmd[128];
-    snprintf(cmd, sizeof(cmd), "%s|%d\n", CMD_LIST_ATTACHMENTS, tid);
-    char payload[4096]={0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
-    set_textview(a->attachments_list_text, payload);
+    NetReply rep;
+    if (net_call(a->sockfd, &rep, CMD_LIST_ATTACHMENTS, "i", tid) != 0) {
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+        net_reply_free(&rep);
+        return;
+    }
+    // row: id|filename|filepath|created_at
+    GString *text = g_string_new(NULL);
+    for (int i = 0; i < rep.nrows; i++) {
+        const NetField *f = rep.rows[i].f;
+        if (rep.rows[i].n < 4) continue;
+        g_string_append_printf(text, "#%s %s -> %s (%s)\n", f[0].s, f[1].s, f[2].s, f[3].s);
+    }
+    set_textview(a->attachments_list_text, text->str);
+    g_string_free(text, TRUE);
+    net_reply_free(&rep);
 }
 
-static gboolean poll_chat(gpointer user_data) {
-    App *a = (App*)user_data;
+// Chat rows on their way from the net reader thread to the GTK main loop
+// (through g_idle_add, which keeps them in arrival order): the
+// SUBSCRIBE_CHAT backlog, then one PUSH_CHAT per new message.
+typedef struct {
+    App *a;
+    int project_id;
+    NetReply *rep;
+} ChatRows;
+
+static gboolean chat_apply(gpointer data) {
+    ChatRows *cr = (ChatRows*)data;
+    App *a = cr->a;
+    NetReply *rep = cr->rep;
+
+    // drop rows for a project that is no longer shown
     const char *pid = gtk_combo_box_text_get_active_text(a->chat_project_combo);
-    if (!pid) return TRUE;
-
-    char cmd[128];
-    snprintf(cmd, sizeof(cmd), "%s|%s|%d\n", CMD_LIST_CHAT, pid, a->last_chat_id);
-    char payload[4096]={0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) return TRUE;
-    if (!payload[0]) return TRUE;
-
-    // append to chat view and update last id
-    GtkTextBuffer *b = gtk_text_view_get_buffer(a->chat_view);
-    GtkTextIter end;
-    gtk_text_buffer_get_end_iter(b, &end);
-
-    char *dup = g_strdup(payload);
-    char *save = NULL;
-    for (char *line = strtok_r(dup, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
-        if (!*line) continue;
-        // line: id|username|content|created_at
-        char *p1 = strtok(line, "|");
-        char *p2 = strtok(NULL, "|");
-        char *p3 = strtok(NULL, "|");
-        char *p4 = strtok(NULL, "|");
-        if (!p1 || !p2 || !p3 || !p4) continue;
-        int id = atoi(p1);
-        if (id > a->last_chat_id) a->last_chat_id = id;
-        char row[1024];
-        snprintf(row, sizeof(row), "[%s] %s: %s\n", p4, p2, p3);
-        gtk_text_buffer_insert(b, &end, row, -1);
+    if (rep && rep->code == 0 && pid && atoi(pid) == cr->project_id) {
+        // append to chat view and update last id
+        GtkTextBuffer *b = gtk_text_view_get_buffer(a->chat_view);
+        GtkTextIter end;
+        gtk_text_buffer_get_end_iter(b, &end);
+
+        // row: id|username|content|created_at
+        for (int i = 0; i < rep->nrows; i++) {
+            const NetRow *row = &rep->rows[i];
+            if (row->n < 4) continue;
+            if (row->f[0].i <= a->last_chat_id) continue;   // already shown
+            a->last_chat_id = row->f[0].i;
+            char *line = g_strdup_printf("[%s] %s: %s\n", row->f[3].s, row->f[1].s, row->f[2].s);
+            gtk_text_buffer_insert(b, &end, line, -1);
+            g_free(line);
+        }
+    }
+    if (rep) {
+        net_reply_free(rep);
+        free(rep);
     }
-    g_free(dup);
+    g_free(cr);
+    return G_SOURCE_REMOVE;
+}
 
-    return TRUE;
+static void chat_backlog(NetReply *rep, void *ctx) {
+    ChatRows *cr = (ChatRows*)ctx;
+    cr->rep = rep;
+    g_idle_add(chat_apply, cr);
+}
+
+// Push handler (net reader thread). Fields: PUSH_CHAT, project_id, then the row.
+static void chat_push(NetReply *rep, void *ctx) {
+    if (!rep || strcmp(rep->msg, PUSH_CHAT) != 0 || rep->nfields < 2 ||
+        rep->fields[1].type != WIRE_INT) {
+        if (rep) {
+            net_reply_free(rep);
+            free(rep);
+        }
+        return;
+    }
+    ChatRows *cr = g_new0(ChatRows, 1);
+    cr->a = (App*)ctx;
+    cr->project_id = rep->fields[1].i;
+    cr->rep = rep;
+    g_idle_add(chat_apply, cr);
+}
+
+// Follow the selected project: the server answers with its history and then
+// pushes each new message, so nothing needs polling.
+static void chat_subscribe(App *a) {
+    const char *pid = gtk_combo_box_text_get_active_text(a->chat_project_combo);
+    set_textview(a->chat_view, "");
+    a->last_chat_id = 0;
+    if (!pid) return;
+
+    ChatRows *cr = g_new0(ChatRows, 1);
+    cr->a = a;
+    cr->project_id = atoi(pid);
+    net_call_async(a->sockfd, chat_backlog, cr, CMD_SUBSCRIBE_CHAT, "ii", cr->project_id, 0);
+}
+
+static void on_chat_project_changed(GtkComboBox *combo, gpointer user_data) {
+    chat_subscribe((App*)user_data);
 }
 
 static void on_btn_send_chat(GtkButton *btn, gpointer user_data) {
@@ -780,14 +766,12 @@ static void on_btn_send_chat(GtkButton *btn, gpointer user_data) {
     const char *msg = gtk_entry_get_text(a->chat_entry);
     if (!pid || !msg || !*msg) return;
 
-    char cmd[2048];
-    snprintf(cmd, sizeof(cmd), "%s|%s|%s\n", CMD_SEND_CHAT, pid, msg);
-    char payload[512]={0};
-    int code = net_request(a->sockfd, cmd, payload, sizeof(payload));
-    if (code != 0) show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", payload);
+    NetReply rep;
+    if (net_call(a->sockfd, &rep, CMD_SEND_CHAT, "is", atoi(pid), msg) != 0)
+        show_msg(GTK_WINDOW(a->main_win), GTK_MESSAGE_ERROR, "Error", rep.msg);
+    net_reply_free(&rep);
 
     gtk_entry_set_text(a->chat_entry, "");
-    poll_chat(a);
 }
 
 static GtkWidget* make_tree_view(GtkListStore *store, const char **cols, int ncols) {
@@ -1089,12 +1073,10 @@ static GtkWidget* build_main(App *a) {
     gtk_box_pack_start(GTK_BOX(chat_box), chat_send_row, FALSE, FALSE, 0);
 
     g_signal_connect(btn_send, "clicked", G_CALLBACK(on_btn_send_chat), a);
+    g_signal_connect(a->chat_project_combo, "changed", G_CALLBACK(on_chat_project_changed), a);
 
     gtk_notebook_append_page(GTK_NOTEBOOK(tabs), chat_box, gtk_label_new("Chat"));
 
-    // poll chat
-    g_timeout_add(2000, poll_chat, a);
-
     return win;
 }
 
@@ -1107,6 +1089,13 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Cannot connect to server on 127.0.0.1:%d\n", SERVER_PORT);
         return 1;
     }
+    if (net_hello(a->sockfd) != 0) {
+        fprintf(stderr, "Server does not support the binary protocol\n");
+        close(a->sockfd);
+        return 1;
+    }
+
+    net_set_push_handler(chat_push, a);
 
     a->login_win = build_login(a);
     a->main_win  = build_main(a);
@@ -1119,6 +1108,7 @@ int main(int argc, char **argv) {
     gtk_main();
 
     if (a->sockfd >= 0) close(a->sockfd);
+    net_reply_free(&a->gantt);
     g_free(a);
     return 0;
 }
@@ -1,7 +1,11 @@
 #include "net.h"
 #include "../common.h"
+#include "../protocol.h"
 
 #include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -65,3 +69,426 @@ int net_request(int sockfd, const char *line, char *out_payload, size_t out_sz)
     pthread_mutex_unlock(&g_net_lock);
     return code;
 }
+
+int net_split_fields(char *row, char **out, int max) {
+    if (!row || max <= 0) return 0;
+    int n = 0;
+    char *p = row;
+    while (1) {
+        out[n++] = p;
+        if (n == max) break;
+        char *sep = strchr(p, '|');
+        if (!sep) break;
+        *sep = '\0';
+        p = sep + 1;
+    }
+    return n;
+}
+
+/* ==========================
+        BINARY PROTOCOL
+========================== */
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static int send_all(int sockfd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = send(sockfd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) return 0;
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int recv_all(int sockfd, void *data, size_t len) {
+    char *p = data;
+    while (len > 0) {
+        ssize_t n = recv(sockfd, p, len, 0);
+        if (n <= 0) return 0;
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// Growable byte string for building frames and collecting replies.
+typedef struct {
+    unsigned char *p;
+    size_t len, cap;
+} Bytes;
+
+static int bytes_grow(Bytes *b, size_t extra) {
+    if (b->len + extra <= b->cap) return 1;
+    size_t cap = b->cap ? b->cap : 256;
+    while (cap < b->len + extra) cap *= 2;
+    unsigned char *p = realloc(b->p, cap);
+    if (!p) return 0;
+    b->p = p;
+    b->cap = cap;
+    return 1;
+}
+
+static int bytes_add(Bytes *b, const void *data, size_t len) {
+    if (!bytes_grow(b, len)) return 0;
+    memcpy(b->p + b->len, data, len);
+    b->len += len;
+    return 1;
+}
+
+static void bytes_str(Bytes *b, const char *s) {
+    unsigned char hdr[5] = { WIRE_STR };
+    size_t n = s ? strlen(s) : 0;
+    put_u32(hdr + 1, (uint32_t)n);
+    bytes_add(b, hdr, 5);
+    bytes_add(b, s, n);
+}
+
+static void bytes_int(Bytes *b, int v) {
+    unsigned char f[5] = { WIRE_INT };
+    put_u32(f + 1, (uint32_t)v);
+    bytes_add(b, f, 5);
+}
+
+// Turn the collected field bytes into fields and rows.
+static int decode_reply(NetReply *rep, const unsigned char *p, size_t len) {
+    // pass 1: count
+    int nf = 0, nrows = 0;
+    for (size_t pos = 0; pos < len; ) {
+        int type = p[pos++];
+        if (type == WIRE_INT) pos += 4;
+        else if (type == WIRE_STR) {
+            if (len - pos < 4) return 0;
+            pos += 4 + get_u32(p + pos);
+        }
+        else if (type == WIRE_ROW) { pos += 2; nrows++; }
+        else if (type != WIRE_NULL) return 0;
+        if (pos > len) return 0;
+        if (type == WIRE_ROW) continue;
+        nf++;
+    }
+
+    rep->fields = calloc(nf ? nf : 1, sizeof(NetField));
+    rep->rows = calloc(nrows ? nrows : 1, sizeof(NetRow));
+    rep->strs = malloc(len + (size_t)nf * 12 + 1);   // every value + NUL, ints as decimal
+    if (!rep->fields || !rep->rows || !rep->strs) return 0;
+    rep->nfields = nf;
+
+    // pass 2: fill
+    char *out = rep->strs;
+    int fi = 0;
+    NetRow *row = NULL;
+    int row_left = 0;
+    for (size_t pos = 0; pos < len; ) {
+        int type = p[pos++];
+        if (type == WIRE_ROW) {
+            row = &rep->rows[rep->nrows++];
+            row->f = &rep->fields[fi];
+            row->n = 0;
+            row_left = (p[pos] << 8) | p[pos + 1];
+            pos += 2;
+            continue;
+        }
+
+        NetField *f = &rep->fields[fi++];
+        f->type = type;
+        f->s = out;
+        if (type == WIRE_INT) {
+            f->i = (int32_t)get_u32(p + pos);
+            pos += 4;
+            out += sprintf(out, "%d", f->i) + 1;
+        } else if (type == WIRE_STR) {
+            size_t n = get_u32(p + pos);
+            pos += 4;
+            memcpy(out, p + pos, n);
+            out[n] = '\0';
+            f->i = atoi(out);
+            f->len = n;
+            pos += n;
+            out += n + 1;
+        } else {
+            *out++ = '\0';
+        }
+
+        if (row_left > 0) {
+            row->n++;
+            row_left--;
+        } else if (!rep->msg[0] && type == WIRE_STR) {
+            rep->msg = f->s;
+        }
+    }
+    return 1;
+}
+
+/* ==========================
+        DEMULTIPLEXER
+========================== */
+
+// After net_hello() a reader thread owns the receive side of the socket.
+// Each call registers a Pending under its request id and sends its frame;
+// the reader appends incoming frames to the matching Pending and completes
+// it on the frame without WIRE_MORE. Any number of calls can be in flight,
+// and a slow reply only holds up its own caller.
+typedef struct Pending {
+    uint32_t id;
+    Bytes body;
+    int code;
+    int state;              // 0 waiting, 1 complete, -1 connection lost
+    net_callback cb;        // NULL for net_call(), which waits on g_done
+    void *ctx;
+    struct Pending *next;
+} Pending;
+
+static pthread_mutex_t g_pend_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_done = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t g_send_lock = PTHREAD_MUTEX_INITIALIZER;
+static Pending *g_pending = NULL;
+static uint32_t g_next_id = 1;
+static int g_fd = -1;       // socket served by the reader, -1 if none
+static int g_lost = 0;
+static net_callback g_push_cb = NULL;
+static void *g_push_ctx = NULL;
+
+// Caller holds g_pend_lock.
+static Pending *pending_take(uint32_t id, int unlink) {
+    for (Pending **pp = &g_pending; *pp; pp = &(*pp)->next) {
+        Pending *p = *pp;
+        if (p->id != id) continue;
+        if (unlink) *pp = p->next;
+        return p;
+    }
+    return NULL;
+}
+
+// Decode a finished Pending into a reply; consumes p->body.
+static void pending_reply(Pending *p, NetReply *rep) {
+    memset(rep, 0, sizeof(*rep));
+    rep->msg = "";
+    if (p->state > 0 && decode_reply(rep, p->body.p, p->body.len)) {
+        rep->code = p->code;
+    } else {
+        net_reply_free(rep);
+        rep->code = -1;
+        rep->msg = "Connection lost";
+    }
+    free(p->body.p);
+    p->body.p = NULL;
+}
+
+// Hand a finished async call to its callback. Called without g_pend_lock.
+static void pending_finish_async(Pending *p) {
+    NetReply *rep = malloc(sizeof(NetReply));
+    if (rep) pending_reply(p, rep);
+    else free(p->body.p);
+    p->cb(rep, p->ctx);
+    free(p);
+}
+
+void net_set_push_handler(net_callback cb, void *ctx) {
+    pthread_mutex_lock(&g_pend_lock);
+    g_push_cb = cb;
+    g_push_ctx = ctx;
+    pthread_mutex_unlock(&g_pend_lock);
+}
+
+static void *reader_main(void *arg) {
+    int sockfd = (int)(intptr_t)arg;
+    Bytes skip = {0};
+    Pending push = {0};     // req_id 0: a server push being collected
+
+    while (1) {
+        unsigned char h[WIRE_HEADER];
+        if (!recv_all(sockfd, h, sizeof(h))) break;
+        size_t n = get_u32(h);
+        if (n < WIRE_HEADER - 4) break;
+        n -= WIRE_HEADER - 4;
+        uint32_t id = get_u32(h + 4);
+        int more = h[9] & WIRE_MORE;
+
+        // Only the reader removes entries, so p stays valid without the lock.
+        pthread_mutex_lock(&g_pend_lock);
+        Pending *p = id ? pending_take(id, 0) : NULL;
+        if (!id && g_push_cb) {
+            push.cb = g_push_cb;
+            push.ctx = g_push_ctx;
+            p = &push;
+        }
+        pthread_mutex_unlock(&g_pend_lock);
+
+        Bytes *dst = p ? &p->body : &skip;      // unknown id: read and drop
+        if (!p) skip.len = 0;
+        if (!bytes_grow(dst, n) || !recv_all(sockfd, dst->p + dst->len, n)) break;
+        dst->len += n;
+        if (!p || more) continue;
+
+        if (p == &push) {
+            NetReply *rep = malloc(sizeof(NetReply));
+            push.code = h[8];
+            push.state = 1;
+            if (rep) pending_reply(&push, rep);
+            else free(push.body.p);
+            push.body = (Bytes){0};
+            push.cb(rep, push.ctx);
+            continue;
+        }
+
+        // a net_call() Pending lives on its caller's stack: once state is
+        // set and the lock dropped it may be gone, so decide first
+        int async = p->cb != NULL;
+        pthread_mutex_lock(&g_pend_lock);
+        pending_take(id, 1);
+        p->code = h[8];
+        p->state = 1;
+        if (!async) pthread_cond_broadcast(&g_done);
+        pthread_mutex_unlock(&g_pend_lock);
+        if (async) pending_finish_async(p);
+    }
+    free(skip.p);
+    free(push.body.p);
+
+    // connection gone: fail everything still waiting
+    pthread_mutex_lock(&g_pend_lock);
+    g_lost = 1;
+    Pending *async = NULL;
+    while (g_pending) {
+        Pending *p = g_pending;
+        g_pending = p->next;
+        p->state = -1;
+        if (p->cb) {
+            p->next = async;
+            async = p;
+        }
+    }
+    pthread_cond_broadcast(&g_done);
+    pthread_mutex_unlock(&g_pend_lock);
+
+    while (async) {
+        Pending *next = async->next;
+        pending_finish_async(async);
+        async = next;
+    }
+    return NULL;
+}
+
+static int reader_start(int sockfd) {
+    pthread_t t;
+    g_fd = sockfd;
+    g_lost = 0;
+    if (pthread_create(&t, NULL, reader_main, (void *)(intptr_t)sockfd) != 0) {
+        g_fd = -1;
+        return 0;
+    }
+    pthread_detach(t);
+    return 1;
+}
+
+// Build the frame for cmd + args, register p under a fresh id and send it.
+// Returns 0 (with p not registered) if the connection is unusable.
+static int pending_send(int sockfd, Pending *p, const char *cmd, const char *types, va_list ap) {
+    Bytes req = {0};
+    unsigned char hdr[WIRE_HEADER] = {0};
+    bytes_add(&req, hdr, sizeof(hdr));
+    bytes_str(&req, cmd);
+    for (const char *t = types; t && *t; t++) {
+        if (*t == 'i') bytes_int(&req, va_arg(ap, int));
+        else bytes_str(&req, va_arg(ap, const char *));
+    }
+
+    pthread_mutex_lock(&g_pend_lock);
+    int ok = sockfd == g_fd && !g_lost && req.p;
+    if (ok) {
+        p->id = g_next_id++;
+        if (g_next_id == 0) g_next_id = 1;
+        p->next = g_pending;
+        g_pending = p;
+    }
+    pthread_mutex_unlock(&g_pend_lock);
+
+    if (ok) {
+        put_u32(req.p, (uint32_t)(req.len - 4));
+        put_u32(req.p + 4, p->id);
+        pthread_mutex_lock(&g_send_lock);
+        ok = send_all(sockfd, req.p, req.len);
+        pthread_mutex_unlock(&g_send_lock);
+        if (!ok) {
+            // the reader may already have failed it; if not, take it back
+            pthread_mutex_lock(&g_pend_lock);
+            if (!pending_take(p->id, 1)) ok = -1;
+            pthread_mutex_unlock(&g_pend_lock);
+        }
+    }
+    free(req.p);
+    return ok;
+}
+
+int net_hello(int sockfd) {
+    const char *hello = CMD_HELLO "|BIN\n";
+    if (!send_all(sockfd, hello, strlen(hello))) return 1;
+
+    // the answer is a single text line; read it byte by byte so nothing of
+    // the first binary frame is consumed with it
+    char line[64];
+    size_t n = 0;
+    while (n < sizeof(line) - 1) {
+        if (recv(sockfd, line + n, 1, 0) != 1) return 1;
+        if (line[n] == '\n') break;
+        n++;
+    }
+    line[n] = '\0';
+    if (strcmp(line, "0|BIN") != 0) return 1;
+    return reader_start(sockfd) ? 0 : 1;
+}
+
+int net_call(int sockfd, NetReply *rep, const char *cmd, const char *types, ...) {
+    Pending p = {0};
+
+    va_list ap;
+    va_start(ap, types);
+    int sent = pending_send(sockfd, &p, cmd, types, ap);
+    va_end(ap);
+
+    if (sent) {
+        pthread_mutex_lock(&g_pend_lock);
+        while (p.state == 0)
+            pthread_cond_wait(&g_done, &g_pend_lock);
+        pthread_mutex_unlock(&g_pend_lock);
+    }
+    pending_reply(&p, rep);
+    return rep->code;
+}
+
+int net_call_async(int sockfd, net_callback cb, void *ctx, const char *cmd, const char *types, ...) {
+    Pending *p = calloc(1, sizeof(Pending));
+    if (!p) {
+        cb(NULL, ctx);
+        return 0;
+    }
+    p->cb = cb;
+    p->ctx = ctx;
+
+    va_list ap;
+    va_start(ap, types);
+    int sent = pending_send(sockfd, p, cmd, types, ap);
+    va_end(ap);
+
+    if (!sent) pending_finish_async(p);         // state 0: reported as lost
+    return sent > 0;
+}
+
+void net_reply_free(NetReply *rep) {
+    free(rep->fields);
+    free(rep->rows);
+    free(rep->strs);
+    memset(rep, 0, sizeof(*rep));
+    rep->msg = "";
+}
@@ -7,4 +7,69 @@
 // Returns 0 on success (server code==0), non-zero otherwise.
 int net_request(int sockfd, const char *line, char *out_payload, size_t out_sz);
 
+// Split a response row on '|' in place (reentrant, no allocation, empty
+// fields kept). The last of max fields takes the rest of the row.
+// Returns the number of fields.
+int net_split_fields(char *row, char **out, int max);
+
+/* ---- Binary protocol (see protocol.h) ---- */
+
+// One decoded field. s is always a NUL-terminated string (integers in
+// decimal, "" for NULL) and i the integer value (atoi of strings), so
+// callers can use whichever suits them.
+typedef struct {
+    int type;           // WIRE_INT, WIRE_STR or WIRE_NULL
+    int i;
+    const char *s;
+    size_t len;
+} NetField;
+
+typedef struct {
+    NetField *f;
+    int n;
+} NetRow;
+
+typedef struct {
+    int code;           // server status, -1 if the connection failed
+    const char *msg;    // first field outside a row (status text), or ""
+    NetRow *rows;       // list responses
+    int nrows;
+
+    // storage
+    NetField *fields;   // every field in order, rows' included
+    int nfields;
+    char *strs;
+} NetReply;
+
+// Switch the connection to binary frames (HELLO|BIN) and start the reader
+// thread that matches replies to requests by id. 0 on success. Only one
+// socket can be in binary mode at a time, and net_request() must not be
+// used on it afterwards.
+int net_hello(int sockfd);
+
+// Send cmd with typed arguments and wait for the complete reply. types has
+// one letter per argument: 'i' for int, 's' for const char *. Returns
+// rep->code. Free the reply with net_reply_free() whatever the result.
+// Safe to call from several threads at once; each waits only for its own
+// reply.
+int net_call(int sockfd, NetReply *rep, const char *cmd, const char *types, ...);
+void net_reply_free(NetReply *rep);
+
+// Called once per net_call_async(), on the reader thread (or before
+// net_call_async returns if the request could not be sent). rep is
+// heap-allocated and owned by the callback: net_reply_free() then free().
+// It is NULL only if memory ran out.
+typedef void (*net_callback)(NetReply *rep, void *ctx);
+
+// Frames with req_id 0 are pushes the server sends on its own (see
+// SUBSCRIBE_CHAT in protocol.h). cb gets each one on the reader thread,
+// decoded like a reply and owned the same way: rep->msg is the push name,
+// rep->fields the fields in order, rep->rows its rows. Without a handler
+// pushes are dropped.
+void net_set_push_handler(net_callback cb, void *ctx);
+
+// Like net_call() but returns right after sending. 1 if the request went
+// out, 0 if it failed (the callback has then already run).
+int net_call_async(int sockfd, net_callback cb, void *ctx, const char *cmd, const char *types, ...);
+
 #endif
@@ -26,8 +26,60 @@
 #define CMD_LIST_ATTACHMENTS     "LIST_ATTACHMENTS"
 
 #define CMD_SEND_CHAT            "SEND_CHAT"
+// With timeout_ms (capped at a minute; binary connections and project
+// members only), a request that finds no message after after_id waits until
+// one is posted or the time is up, then answers with the new rows or none.
+// Its response may come after those of later requests on the connection.
 #define CMD_LIST_CHAT            "LIST_CHAT"
 
+// Binary connections only. Answers like LIST_CHAT with the messages after
+// after_id, then pushes every new message of the project as a frame with
+// req_id 0: STR PUSH_CHAT, INT project_id, one ROW laid out like LIST_CHAT's.
+// A connection follows one project; subscribing again switches to the new one.
+#define CMD_SUBSCRIBE_CHAT       "SUBSCRIBE_CHAT"
+#define PUSH_CHAT                "CHAT"
+
 #define CMD_LIST_TASK_GANTT      "LIST_TASK_GANTT"
 
+// Logged-in connections only. Server counters and per-command latency
+// (microseconds): rows of name|value for the gauges, then
+// name|n=|err=|p50=|p99=|max=|parse99=|perm99=|db99=|send99= for each
+// command used so far, then
+// name|calls=|avg_us=|max_us=|rows=|vm=|scan=|sort=|slow= for each SQL
+// statement run so far.
+#define CMD_STATS                "STATS"
+
+// Request ids: a text request may start with "#<id>|" (id a non-zero decimal
+// number), e.g. "#7|LIST_TASK|3"; its response then starts with "#7|" as
+// well. Binary frames always carry one. Responses on a connection keep
+// request order (except a waiting LIST_CHAT), but clients should match them
+// by id.
+
+// Protocol negotiation: HELLO|BIN answers "0|BIN" in text, after which both
+// directions switch to the binary frames below. HELLO|TEXT is a no-op.
+#define CMD_HELLO                "HELLO"                // HELLO|BIN or HELLO|TEXT
+
+/* Binary framing. Integers are big-endian.
+ *
+ *   frame := u32 len | u32 req_id | u8 code | u8 flags | field*
+ *            (len counts every byte after itself)
+ *   field := u8 type, then
+ *            WIRE_INT : i32
+ *            WIRE_STR : u32 n, n bytes (may contain '|' and '\n')
+ *            WIRE_ROW : u16 n -- the next n fields are one row of a list
+ *            WIRE_NULL: nothing
+ *
+ * A request has code 0 and the command name as its first field; the other
+ * fields are the same arguments as in the text form. The response echoes
+ * req_id. A long response may be split into several frames; every frame
+ * but the last has WIRE_MORE set.
+ */
+#define WIRE_HEADER   10
+#define WIRE_MORE     0x01
+
+#define WIRE_NULL     0
+#define WIRE_INT      1
+#define WIRE_STR      2
+#define WIRE_ROW      3
+
 #endif
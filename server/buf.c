@@ -0,0 +1,170 @@
+#include "buf.h"
+#include "common.h"
+#include "protocol.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void buf_init(Buf *b) {
+    memset(b, 0, sizeof(*b));
+    b->col = -1;
+}
+
+void buf_free(Buf *b) {
+    free(b->data);
+    buf_init(b);
+}
+
+void buf_reset(Buf *b) {
+    b->len = 0;
+    b->flushed = 0;
+    b->head = 0;
+    b->binary = 0;
+    b->col = -1;
+    b->flush = NULL;
+    b->ctx = NULL;
+    b->flush_at = 0;
+    if (b->data) b->data[0] = '\0';
+}
+
+void buf_stream(Buf *b, buf_flush_fn fn, void *ctx, size_t flush_at) {
+    b->flush = fn;
+    b->ctx = ctx;
+    b->flush_at = flush_at;
+}
+
+// Make room for extra more bytes plus the terminating '\0'.
+static int buf_reserve(Buf *b, size_t extra) {
+    if (b->len + extra + 1 <= b->cap) return 1;
+
+    size_t cap = b->cap ? b->cap : BUF_SIZE;
+    while (cap < b->len + extra + 1) cap *= 2;
+    char *p = realloc(b->data, cap);
+    if (!p) return 0;
+    b->data = p;
+    b->cap = cap;
+    return 1;
+}
+
+int buf_reserve_head(Buf *b, size_t n) {
+    if (!buf_reserve(b, n)) return 0;
+    memset(b->data + b->len, 0, n);
+    b->len += n;
+    b->head = b->len;
+    b->data[b->len] = '\0';
+    return 1;
+}
+
+void buf_flush(Buf *b) {
+    if (!b->flush || b->len == b->head) return;
+    b->flush(b->ctx, b->data, b->len);
+    b->flushed += b->len - b->head;
+    b->len = b->head;
+    b->data[b->len] = '\0';
+}
+
+static void maybe_flush(Buf *b) {
+    // never split a row: a binary row is only decodable as a whole
+    if (b->flush && b->col < 0 && b->len >= b->flush_at) buf_flush(b);
+}
+
+int buf_append(Buf *b, const char *data, size_t len) {
+    if (!buf_reserve(b, len)) return 0;
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+    maybe_flush(b);
+    return 1;
+}
+
+int buf_puts(Buf *b, const char *s) {
+    return buf_append(b, s, strlen(s));
+}
+
+int buf_printf(Buf *b, const char *fmt, ...) {
+    if (!buf_reserve(b, 0)) return 0;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) return 0;
+
+    if ((size_t)n >= b->cap - b->len) {
+        // did not fit: grow once to the exact size and format again
+        if (!buf_reserve(b, (size_t)n)) {
+            b->data[b->len] = '\0';
+            return 0;
+        }
+        va_start(ap, fmt);
+        vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+    }
+    b->len += (size_t)n;
+    maybe_flush(b);
+    return 1;
+}
+
+void buf_put_u8(Buf *b, unsigned v) {
+    char c = (char)(v & 0xff);
+    buf_append(b, &c, 1);
+}
+
+void buf_put_u16(Buf *b, unsigned v) {
+    char c[2] = { (char)(v >> 8), (char)v };
+    buf_append(b, c, 2);
+}
+
+void buf_put_u32(Buf *b, unsigned v) {
+    char c[4] = { (char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v };
+    buf_append(b, c, 4);
+}
+
+void buf_put_str(Buf *b, const char *s, size_t len) {
+    buf_put_u8(b, WIRE_STR);
+    buf_put_u32(b, (unsigned)len);
+    buf_append(b, s, len);
+}
+
+void buf_row(Buf *b, int ncols) {
+    if (b->binary) {
+        buf_put_u8(b, WIRE_ROW);
+        buf_put_u16(b, (unsigned)ncols);
+    }
+    b->col = 0;
+}
+
+static void text_sep(Buf *b, const char *label) {
+    if (b->col > 0) buf_append(b, "|", 1);
+    if (label) buf_puts(b, label);
+}
+
+void buf_col_int(Buf *b, const char *label, int v) {
+    if (b->binary) {
+        buf_put_u8(b, WIRE_INT);
+        buf_put_u32(b, (unsigned)v);
+    } else {
+        text_sep(b, label);
+        buf_printf(b, "%d", v);
+    }
+    b->col++;
+}
+
+void buf_col_str(Buf *b, const char *label, const char *s) {
+    if (b->binary) {
+        if (s) buf_put_str(b, s, strlen(s));
+        else buf_put_u8(b, WIRE_NULL);
+    } else {
+        text_sep(b, label);
+        buf_puts(b, s ? s : "(null)");
+    }
+    b->col++;
+}
+
+void buf_row_end(Buf *b) {
+    if (!b->binary) buf_append(b, "\n", 1);
+    b->col = -1;
+    maybe_flush(b);
+}
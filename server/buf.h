@@ -0,0 +1,59 @@
+#ifndef BUF_H
+#define BUF_H
+
+#include <stddef.h>
+
+typedef void (*buf_flush_fn)(void *ctx, char *data, size_t len);
+
+// Growable byte buffer. Appends are amortized O(1) (capacity doubles) and
+// data[len] is always '\0'. With a flush callback attached, the contents are
+// handed off and the buffer emptied whenever it passes flush_at bytes, so a
+// response of any size streams out in chunks instead of piling up.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    buf_flush_fn flush;
+    void *ctx;
+    size_t flush_at;
+    size_t flushed;     // bytes already handed to flush
+    size_t head;        // bytes kept at the front (a frame header) across flushes
+    int binary;         // rows are typed wire fields instead of "a|b|c\n"
+    int col;            // columns written in the open row, -1 outside a row
+} Buf;
+
+void buf_init(Buf *b);
+void buf_free(Buf *b);
+
+// Empty the buffer and detach any flush callback; keeps the memory.
+void buf_reset(Buf *b);
+void buf_stream(Buf *b, buf_flush_fn fn, void *ctx, size_t flush_at);
+
+// Reserve n bytes at the front. They are passed to every flush (so the
+// callback can fill in a header) and survive it.
+int buf_reserve_head(Buf *b, size_t n);
+
+// Return 0 if memory ran out (the buffer is left as it was).
+int buf_append(Buf *b, const char *data, size_t len);
+int buf_puts(Buf *b, const char *s);
+int buf_printf(Buf *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// One row of a list response. Text mode writes "a|b|c\n" and puts label in
+// front of the value; binary mode writes a WIRE_ROW marker followed by typed
+// fields and ignores labels. A NULL string is "(null)" in text, WIRE_NULL
+// in binary. The buffer is only flushed between rows.
+void buf_row(Buf *b, int ncols);
+void buf_col_int(Buf *b, const char *label, int v);
+void buf_col_str(Buf *b, const char *label, const char *s);
+void buf_row_end(Buf *b);
+
+// Typed wire fields, for binary mode outside of rows.
+void buf_put_u8(Buf *b, unsigned v);
+void buf_put_u16(Buf *b, unsigned v);
+void buf_put_u32(Buf *b, unsigned v);
+void buf_put_str(Buf *b, const char *s, size_t len);
+
+// Hand whatever is buffered to the flush callback now.
+void buf_flush(Buf *b);
+
+#endif
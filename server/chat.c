@@ -0,0 +1,607 @@
+#include "chat.h"
+#include "reactor.h"
+#include "protocol.h"
+#include "common.h"
+#include "db.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TOPIC_BUCKETS 256
+
+// One message, immutable once built; the strings follow the struct.
+typedef struct {
+    int refs;               // rings holding it
+    int id;
+    const char *username;
+    const char *content;
+    const char *created_at;
+} ChatMsg;
+
+// The last CHAT_RING_SIZE messages of a project, oldest first. A ring is
+// never changed once installed: adding a message builds the next ring and
+// swaps the pointer, so readers work on a pinned snapshot without locks
+// while the writer moves on (RCU-style, reclaimed by reference count).
+typedef struct {
+    int refs;               // the topic's reference + readers
+    int floor;              // every message of the project with id > floor is here
+    int n;
+    ChatMsg *msgs[];
+} ChatRing;
+
+struct Topic;
+
+// A LIST_CHAT parked until a message past after_id arrives or its deadline
+// passes. It sits in its topic's list and in the timer heap; whoever takes
+// it off the topic (publish, timer, disconnect) answers or drops it.
+typedef struct Waiter {
+    ClientInfo *ci;         // valid while on the topic's list
+    unsigned req_id;
+    int after_id;
+    long long deadline;     // CLOCK_MONOTONIC ms
+    int heap_idx;           // -1 once the timer has taken it
+    int done;               // off the topic's list; guarded by the topic lock
+    struct Topic *topic;
+    struct Waiter *next;
+} Waiter;
+
+// Subscribers and recent messages of one project. Topics are created only
+// by subscriptions and long-polls, which the caller has checked against the
+// project's members, and kept for the life of the server, so a pointer to
+// one stays valid.
+typedef struct Topic {
+    int project_id;
+    pthread_mutex_t lock;   // subscribers, ring replacement, order of writes
+    ClientInfo **subs;
+    int nsubs;
+    int cap;
+    Waiter *waiters;        // parked LIST_CHATs, under lock
+
+    pthread_mutex_t ring_lock;  // held only to pin or swap ring
+    ChatRing *ring;             // NULL until loaded from SQLite
+    struct Topic *next;
+} Topic;
+
+// Guards the bucket table and every ClientInfo.chat_project. Taken before
+// a topic lock, never while holding one. Order: chat_lock, topic lock,
+// timer_lock.
+static pthread_mutex_t chat_lock = PTHREAD_MUTEX_INITIALIZER;
+static Topic *buckets[TOPIC_BUCKETS];
+
+// Topic whose lock this thread holds while running a subscribe backlog.
+static __thread Topic *backlog_topic = NULL;
+
+// Caller holds chat_lock.
+static Topic *topic_find(int project_id, int create) {
+    Topic **pp = &buckets[(unsigned)project_id % TOPIC_BUCKETS];
+    for (Topic *t = *pp; t; t = t->next)
+        if (t->project_id == project_id) return t;
+    if (!create) return NULL;
+
+    Topic *t = calloc(1, sizeof(Topic));
+    if (!t) return NULL;
+    t->project_id = project_id;
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_mutex_init(&t->ring_lock, NULL);
+    t->next = *pp;
+    *pp = t;
+    return t;
+}
+
+static chat_reply_begin_fn reply_begin;
+static chat_reply_end_fn reply_end;
+
+static Topic *topic_get(int project_id, int create) {
+    pthread_mutex_lock(&chat_lock);
+    Topic *t = topic_find(project_id, create);
+    pthread_mutex_unlock(&chat_lock);
+    return t;
+}
+
+/* ---- recent-message ring ---- */
+
+static ChatMsg *msg_new(int id, const char *username, const char *content, const char *created_at) {
+    if (!username) username = "";
+    if (!content) content = "";
+    if (!created_at) created_at = "";
+    size_t lu = strlen(username) + 1, lc = strlen(content) + 1, la = strlen(created_at) + 1;
+
+    ChatMsg *m = malloc(sizeof(ChatMsg) + lu + lc + la);
+    if (!m) return NULL;
+    char *p = (char *)(m + 1);
+    m->refs = 1;
+    m->id = id;
+    m->username = memcpy(p, username, lu);
+    m->content = memcpy(p + lu, content, lc);
+    m->created_at = memcpy(p + lu + lc, created_at, la);
+    return m;
+}
+
+static void msg_put(ChatMsg *m) {
+    if (__atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL) == 0) free(m);
+}
+
+static ChatRing *ring_alloc(int n) {
+    ChatRing *r = calloc(1, sizeof(ChatRing) + n * sizeof(ChatMsg *));
+    if (r) r->refs = 1;
+    return r;
+}
+
+static void ring_put(ChatRing *r) {
+    if (!r || __atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    for (int i = 0; i < r->n; i++) msg_put(r->msgs[i]);
+    free(r);
+}
+
+// Pin the current ring (NULL if not loaded yet); release with ring_put().
+static ChatRing *ring_pin(Topic *t) {
+    pthread_mutex_lock(&t->ring_lock);
+    ChatRing *r = t->ring;
+    if (r) __atomic_add_fetch(&r->refs, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&t->ring_lock);
+    return r;
+}
+
+// Caller holds t->lock, which serialises all replacements.
+static void ring_swap_locked(Topic *t, ChatRing *r) {
+    pthread_mutex_lock(&t->ring_lock);
+    ChatRing *old = t->ring;
+    t->ring = r;
+    pthread_mutex_unlock(&t->ring_lock);
+    ring_put(old);
+}
+
+static void warm_row(void *ctx, int id, const char *username, const char *content, const char *created_at) {
+    ChatRing *r = ctx;
+    ChatMsg *m = msg_new(id, username, content, created_at);
+    if (m) r->msgs[r->n++] = m;     // newest first for now
+}
+
+// Load the ring from SQLite. Caller holds t->lock, so no message of the
+// project can be published meanwhile: anything committed before the query
+// is in its result, anything after will be added by chat_publish.
+static void ring_load_locked(Topic *t) {
+    if (t->ring) return;
+    ChatRing *r = ring_alloc(CHAT_RING_SIZE);
+    if (!r) return;
+    int rows = db_recent_chat(t->project_id, CHAT_RING_SIZE, warm_row, r);
+    if (rows < 0 || r->n != rows) {
+        ring_put(r);
+        return;
+    }
+    if (r->n < CHAT_RING_SIZE) {
+        // most projects have few messages; don't keep the unused slots
+        ChatRing *small = realloc(r, sizeof(ChatRing) + (r->n ? r->n : 1) * sizeof(ChatMsg *));
+        if (small) r = small;
+    }
+    for (int i = 0, j = r->n - 1; i < j; i++, j--) {
+        ChatMsg *m = r->msgs[i];
+        r->msgs[i] = r->msgs[j];
+        r->msgs[j] = m;
+    }
+    // a full ring may have older messages before it; a short one has all
+    r->floor = r->n == CHAT_RING_SIZE ? r->msgs[0]->id - 1 : 0;
+    ring_swap_locked(t, r);
+}
+
+// Caller holds t->lock.
+static void ring_add_locked(Topic *t, const ChatMessage *cm) {
+    ChatRing *old = t->ring;
+    if (!old) return;   // not loaded: the load will read it from SQLite
+    if (old->n > 0 && cm->id <= old->msgs[old->n - 1]->id) return;  // loaded already
+
+    int keep = old->n < CHAT_RING_SIZE ? old->n : CHAT_RING_SIZE - 1;
+    int drop = old->n - keep;
+    ChatRing *r = ring_alloc(keep + 1);
+    ChatMsg *m = msg_new(cm->id, cm->username, cm->content, cm->created_at);
+    if (!r || !m) {
+        // cannot extend it: better no ring than one with a hole
+        free(r);
+        if (m) msg_put(m);
+        ring_swap_locked(t, NULL);
+        return;
+    }
+    r->floor = drop ? old->msgs[drop - 1]->id : old->floor;
+    for (int i = 0; i < keep; i++) {
+        r->msgs[i] = old->msgs[drop + i];
+        __atomic_add_fetch(&r->msgs[i]->refs, 1, __ATOMIC_RELAXED);
+    }
+    r->msgs[keep] = m;
+    r->n = keep + 1;
+    ring_swap_locked(t, r);
+}
+
+static void put_row(Buf *out, int id, const char *username, const char *content, const char *created_at) {
+    buf_row(out, 4);
+    buf_col_int(out, NULL, id);
+    buf_col_str(out, NULL, username);
+    buf_col_str(out, NULL, content);
+    buf_col_str(out, NULL, created_at);
+    buf_row_end(out);
+}
+
+// Append the messages of r after after_id (>= r->floor) and count them.
+static int ring_rows(const ChatRing *r, int after_id, Buf *out) {
+    // ids ascend: find the first one past after_id
+    int lo = 0, hi = r->n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (r->msgs[mid]->id <= after_id) lo = mid + 1;
+        else hi = mid;
+    }
+    for (int i = lo; i < r->n; i++) {
+        const ChatMsg *m = r->msgs[i];
+        put_row(out, m->id, m->username, m->content, m->created_at);
+    }
+    return r->n - lo;
+}
+
+int chat_list(int project_id, int after_id, Buf *out) {
+    // inside a subscribe backlog this thread holds backlog_topic's lock, so
+    // it must not take chat_lock (see the lock order above)
+    Topic *t = backlog_topic;
+    if (t && t->project_id != project_id) return -1;
+    // never create one here: LIST_CHAT takes any project id from anyone
+    if (!t) t = topic_get(project_id, 0);
+    if (!t) return -1;
+
+    ChatRing *r = ring_pin(t);
+    if (!r) {
+        if (backlog_topic) return -1;   // the load already failed under this lock
+        pthread_mutex_lock(&t->lock);
+        ring_load_locked(t);
+        pthread_mutex_unlock(&t->lock);
+        r = ring_pin(t);
+        if (!r) return -1;
+    }
+    if (after_id < r->floor) {
+        ring_put(r);
+        return -1;
+    }
+    int rows = ring_rows(r, after_id, out);
+    ring_put(r);
+    return rows;
+}
+
+/* ---- long-poll ---- */
+
+// Deadline-ordered min-heap of parked requests, served by one timer thread.
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+static Waiter **heap;
+static int heap_n, heap_cap;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void heap_set(int i, Waiter *w) {
+    heap[i] = w;
+    w->heap_idx = i;
+}
+
+static void heap_sift(int i) {
+    Waiter *w = heap[i];
+    while (i > 0 && heap[(i - 1) / 2]->deadline > w->deadline) {
+        heap_set(i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= heap_n) break;
+        if (c + 1 < heap_n && heap[c + 1]->deadline < heap[c]->deadline) c++;
+        if (heap[c]->deadline >= w->deadline) break;
+        heap_set(i, heap[c]);
+        i = c;
+    }
+    heap_set(i, w);
+}
+
+// Caller holds timer_lock.
+static int heap_push(Waiter *w) {
+    if (heap_n == heap_cap) {
+        int cap = heap_cap ? heap_cap * 2 : 64;
+        Waiter **p = realloc(heap, cap * sizeof(Waiter *));
+        if (!p) return 0;
+        heap = p;
+        heap_cap = cap;
+    }
+    heap_set(heap_n++, w);
+    heap_sift(heap_n - 1);
+    return 1;
+}
+
+// Caller holds timer_lock.
+static void heap_remove(Waiter *w) {
+    int i = w->heap_idx;
+    w->heap_idx = -1;
+    if (--heap_n == i) return;
+    heap_set(i, heap[heap_n]);
+    heap_sift(i);
+}
+
+// Caller holds the topic lock and has unlinked w. Frees w unless the timer
+// has already taken it, in which case the timer frees it.
+static void waiter_done_locked(Waiter *w) {
+    w->done = 1;
+    __atomic_sub_fetch(&w->ci->chat_waits, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&timer_lock);
+    int owned = w->heap_idx >= 0;
+    if (owned) heap_remove(w);
+    pthread_mutex_unlock(&timer_lock);
+    if (owned) free(w);
+}
+
+// Caller holds the topic lock, so the connection cannot go away meanwhile
+// (handle_disconnect drops waiters under it). m is the message that woke
+// w, used if the ring has been lost; NULL on timeout.
+static void waiter_answer_locked(Topic *t, Waiter *w, const ChatMessage *m) {
+    Buf *b = reply_begin(w->ci, w->req_id);
+    if (m && t->ring) ring_rows(t->ring, w->after_id, b);
+    else if (m) put_row(b, m->id, m->username, m->content, m->created_at);
+    reply_end(b);
+}
+
+static void *timer_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&timer_lock);
+    for (;;) {
+        if (heap_n == 0) {
+            pthread_cond_wait(&timer_cond, &timer_lock);
+            continue;
+        }
+        Waiter *w = heap[0];
+        long long now = now_ms();
+        if (w->deadline > now) {
+            struct timespec ts = { w->deadline / 1000, (w->deadline % 1000) * 1000000 };
+            pthread_cond_timedwait(&timer_cond, &timer_lock, &ts);
+            continue;
+        }
+        heap_remove(w);
+        pthread_mutex_unlock(&timer_lock);
+
+        // topics are never freed; w is ours now whether or not it is done
+        Topic *t = w->topic;
+        pthread_mutex_lock(&t->lock);
+        if (!w->done) {
+            for (Waiter **pp = &t->waiters; *pp; pp = &(*pp)->next) {
+                if (*pp != w) continue;
+                *pp = w->next;
+                break;
+            }
+            waiter_answer_locked(t, w, NULL);
+            w->done = 1;
+            __atomic_sub_fetch(&w->ci->chat_waits, 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&t->lock);
+        free(w);
+
+        pthread_mutex_lock(&timer_lock);
+    }
+    return NULL;
+}
+
+static void timer_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, timer_main, NULL) == 0)
+        pthread_detach(tid);
+    else
+        perror("chat timer");
+}
+
+void chat_set_reply(chat_reply_begin_fn begin, chat_reply_end_fn end) {
+    reply_begin = begin;
+    reply_end = end;
+}
+
+int chat_wait(ClientInfo *ci, unsigned req_id, int project_id, int after_id, int timeout_ms) {
+    if (!reply_begin) return -1;
+    pthread_once(&timer_once, timer_start);
+    if (timeout_ms > CHAT_WAIT_MAX_MS) timeout_ms = CHAT_WAIT_MAX_MS;
+
+    // load the ring first, without chat_lock: it is a query
+    Topic *t = topic_get(project_id, 1);
+    if (!t) return -1;
+    pthread_mutex_lock(&t->lock);
+    ring_load_locked(t);
+    pthread_mutex_unlock(&t->lock);
+
+    pthread_mutex_lock(&chat_lock);
+    // same reasoning as chat_subscribe: disconnect drops waiters under chat_lock
+    t = conn_is_open(ci) ? topic_find(project_id, 0) : NULL;
+    if (!t) {
+        pthread_mutex_unlock(&chat_lock);
+        return -1;
+    }
+    pthread_mutex_lock(&t->lock);
+    const ChatRing *r = t->ring;
+    int ret = -1;
+    if (r && r->n > 0 && r->msgs[r->n - 1]->id > after_id) {
+        ret = 0;    // arrived after the caller looked
+    } else if (r) {
+        Waiter *w = calloc(1, sizeof(Waiter));
+        if (w) {
+            w->ci = ci;
+            w->req_id = req_id;
+            w->after_id = after_id;
+            w->deadline = now_ms() + timeout_ms;
+            w->topic = t;
+            pthread_mutex_lock(&timer_lock);
+            if (heap_push(w)) {
+                if (w->heap_idx == 0) pthread_cond_signal(&timer_cond);
+                w->next = t->waiters;
+                t->waiters = w;
+                __atomic_add_fetch(&ci->chat_waits, 1, __ATOMIC_RELAXED);
+                ret = 1;
+            }
+            pthread_mutex_unlock(&timer_lock);
+            if (ret != 1) free(w);
+        }
+    }
+    pthread_mutex_unlock(&chat_lock);
+    pthread_mutex_unlock(&t->lock);
+    return ret;
+}
+
+// Caller holds chat_lock. A connection rarely has waiters when it closes,
+// and walking every topic is cheap next to that.
+static void drop_waiters_locked(ClientInfo *ci) {
+    // pairs with the release when a waiter is answered: seeing 0 here means
+    // nothing will touch ci again
+    if (__atomic_load_n(&ci->chat_waits, __ATOMIC_ACQUIRE) == 0) return;
+    for (int i = 0; i < TOPIC_BUCKETS; i++) {
+        for (Topic *t = buckets[i]; t; t = t->next) {
+            pthread_mutex_lock(&t->lock);
+            Waiter **pp = &t->waiters;
+            while (*pp) {
+                Waiter *w = *pp;
+                if (w->ci != ci) {
+                    pp = &w->next;
+                    continue;
+                }
+                *pp = w->next;
+                waiter_done_locked(w);
+            }
+            pthread_mutex_unlock(&t->lock);
+        }
+    }
+}
+
+/* ---- subscriptions ---- */
+
+// Caller holds t->lock.
+static void topic_remove(Topic *t, ClientInfo *ci) {
+    for (int i = 0; i < t->nsubs; i++) {
+        if (t->subs[i] != ci) continue;
+        t->subs[i] = t->subs[--t->nsubs];
+        return;
+    }
+}
+
+// Caller holds t->lock.
+static int topic_add(Topic *t, ClientInfo *ci) {
+    if (t->nsubs == t->cap) {
+        int cap = t->cap ? t->cap * 2 : 8;
+        ClientInfo **p = realloc(t->subs, cap * sizeof(ClientInfo *));
+        if (!p) return 0;
+        t->subs = p;
+        t->cap = cap;
+    }
+    t->subs[t->nsubs++] = ci;
+    return 1;
+}
+
+// Caller holds chat_lock.
+static void unsubscribe_locked(ClientInfo *ci) {
+    if (!ci->chat_project) return;
+    Topic *t = topic_find(ci->chat_project, 0);
+    if (t) {
+        pthread_mutex_lock(&t->lock);
+        topic_remove(t, ci);
+        pthread_mutex_unlock(&t->lock);
+    }
+    ci->chat_project = 0;
+}
+
+int chat_subscribe(ClientInfo *ci, int project_id, chat_backlog_fn backlog, void *ctx) {
+    pthread_mutex_lock(&chat_lock);
+    // the reactor marks a connection closed before calling chat_unsubscribe,
+    // so checking here under chat_lock cannot leave a stale entry behind
+    if (!conn_is_open(ci)) {
+        pthread_mutex_unlock(&chat_lock);
+        return 0;
+    }
+    unsubscribe_locked(ci);
+
+    Topic *t = topic_find(project_id, 1);
+    if (!t) {
+        pthread_mutex_unlock(&chat_lock);
+        return 0;
+    }
+    pthread_mutex_lock(&t->lock);
+    int ok = topic_add(t, ci);
+    if (ok) ci->chat_project = project_id;
+    pthread_mutex_unlock(&chat_lock);
+
+    // loaded here, where t->lock is already held, so the backlog (which
+    // goes through chat_list) finds it ready
+    if (ok) ring_load_locked(t);
+
+    // publishers wait on t->lock, so the backlog reaches the client first
+    if (ok && backlog) {
+        backlog_topic = t;
+        backlog(ctx);
+        backlog_topic = NULL;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return ok;
+}
+
+void chat_unsubscribe(ClientInfo *ci) {
+    pthread_mutex_lock(&chat_lock);
+    unsubscribe_locked(ci);
+    drop_waiters_locked(ci);
+    pthread_mutex_unlock(&chat_lock);
+}
+
+void chat_publish(const ChatMessage *m) {
+    Topic *t = topic_get(m->project_id, 0);
+    if (!t) return;     // nobody has read this chat yet: nothing cached
+
+    pthread_mutex_lock(&t->lock);
+    ring_add_locked(t, m);
+    if (t->nsubs > 0) {
+        // one frame, built once and written whole to every subscriber
+        Buf b;
+        buf_init(&b);
+        b.binary = 1;
+        buf_reserve_head(&b, WIRE_HEADER);
+        buf_put_str(&b, PUSH_CHAT, strlen(PUSH_CHAT));
+        buf_put_u8(&b, WIRE_INT);
+        buf_put_u32(&b, (unsigned)m->project_id);
+        buf_row(&b, 4);
+        buf_col_int(&b, NULL, m->id);
+        buf_col_str(&b, NULL, m->username);
+        buf_col_str(&b, NULL, m->content);
+        buf_col_str(&b, NULL, m->created_at);
+        buf_row_end(&b);
+
+        if (b.data && b.len > WIRE_HEADER) {
+            unsigned n = (unsigned)(b.len - 4);
+            b.data[0] = (char)(n >> 24);
+            b.data[1] = (char)(n >> 16);
+            b.data[2] = (char)(n >> 8);
+            b.data[3] = (char)n;
+            // bytes 4..9: req_id 0 marks a push; code 0, no flags
+            for (int i = 0; i < t->nsubs; i++)
+                conn_write(t->subs[i], b.data, b.len);
+        }
+        buf_free(&b);
+    }
+
+    // wake long-polls waiting for this message
+    Waiter **pp = &t->waiters;
+    while (*pp) {
+        Waiter *w = *pp;
+        if (w->after_id >= m->id) {
+            pp = &w->next;
+            continue;
+        }
+        *pp = w->next;
+        waiter_answer_locked(t, w, m);
+        waiter_done_locked(w);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
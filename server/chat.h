@@ -0,0 +1,54 @@
+#ifndef CHAT_H
+#define CHAT_H
+
+#include "handler.h"
+#include "buf.h"
+
+// A chat message as committed, ready to be pushed.
+typedef struct {
+    int project_id;
+    int id;
+    const char *username;
+    const char *content;
+    const char *created_at;
+} ChatMessage;
+
+// Called with the project's fan-out lock held, after the connection has been
+// registered; used to send the backlog so that no push can overtake it. It
+// may read the project with chat_list but call nothing else in chat.c.
+typedef void (*chat_backlog_fn)(void *ctx);
+
+// Follow project_id on ci, replacing any earlier subscription of ci. Returns
+// 0 if the connection is already closing.
+int chat_subscribe(ClientInfo *ci, int project_id, chat_backlog_fn backlog, void *ctx);
+
+// Drop ci's subscription. Must be called before the connection is freed.
+void chat_unsubscribe(ClientInfo *ci);
+
+// Record a committed message in the project's recent-message ring and push
+// it to every connection following the project. Messages must arrive in
+// commit order (see db_set_chat_hook).
+void chat_publish(const ChatMessage *m);
+
+// Answer LIST_CHAT from memory: append the messages after after_id to out
+// as rows and return their count, or -1 if the project is not in memory or
+// after_id reaches back past what the ring holds (the caller then asks
+// SQLite). Never brings a project into memory.
+int chat_list(int project_id, int after_id, Buf *out);
+
+// How chat.c answers a parked LIST_CHAT from its own threads: begin a
+// response to ci tagged req_id, append rows to it, end it.
+typedef Buf *(*chat_reply_begin_fn)(ClientInfo *ci, unsigned req_id);
+typedef void (*chat_reply_end_fn)(Buf *b);
+void chat_set_reply(chat_reply_begin_fn begin, chat_reply_end_fn end);
+
+// Park a LIST_CHAT that found nothing after after_id. Returns 1 if parked:
+// it is answered, by the writer thread, as soon as a newer message is
+// published, or with no rows once timeout_ms (at most CHAT_WAIT_MAX_MS)
+// has passed. Returns 0 if a newer message arrived since the caller
+// looked, -1 if it cannot wait; either way the caller answers now. Keeps
+// the project in memory for good, so the caller must have checked that ci
+// may read it.
+int chat_wait(ClientInfo *ci, unsigned req_id, int project_id, int after_id, int timeout_ms);
+
+#endif
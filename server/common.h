@@ -3,6 +3,20 @@
 #define SERVER_PORT 9000
 #define MAX_CLIENT 100
 #define BUF_SIZE 2048
+#define RESPONSE_CHUNK (16 * 1024)
+#define WORKER_THREADS 8
+#define WORK_QUEUE_SIZE 1024
+#define MAX_REQUEST_SIZE (64 * 1024)
+#define PIPELINE_BATCH 32
+#define CHAT_RING_SIZE 128   // recent messages kept in memory per project
+#define CHAT_WAIT_MAX_MS 60000   // longest a LIST_CHAT may be parked
+#define LOG_RING_SLOTS 4096      // queued log lines; a power of two
+#define LOG_RECORD_SIZE 512      // longest log line, longer ones are cut
+#define LOG_ROTATE_SIZE (64 * 1024 * 1024)   // default size to rotate the log at
+#define LOG_ROTATE_KEEP 5        // default number of rotated logs kept
+#define STATS_MAX_COMMANDS 64    // commands with latency histograms
+#define STATS_DUMP_INTERVAL 60   // seconds between STATS lines in the log
+#define DB_SLOW_QUERY_MS 100     // default slow-query log threshold
 typedef enum { TASK_TODO=0, TASK_DOING=1, TASK_DONE=2 } TaskStatus;
 typedef struct { int code; char message[256]; } Response;
 #endif
@@ -1,16 +1,126 @@
 #include "db.h"
+#include "log.h"
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 sqlite3 *db = NULL;
 
+static int db_migrate(void);
+static int conn_pool_init(const char *path);
+static int writer_start(void);
+static void check_query_plans(void);
+
 int db_init(const char *path) {
     if (sqlite3_open(path, &db) != SQLITE_OK) {
         printf("Cannot open DB: %s\n", sqlite3_errmsg(db));
         return 0;
     }
 
+    if (!db_migrate()) return 0;
+    if (!conn_pool_init(path) || !writer_start()) return 0;
+    check_query_plans();
+    return 1;
+}
+
+/* =====================================
+        SCHEMA MIGRATIONS
+===================================== */
+
+// PRAGMA user_version holds the number of steps already applied. Each step
+// runs once, in its own transaction together with the version bump, so a
+// crash mid-upgrade leaves the file at the previous version. Append new
+// steps at the end; never edit or reorder the existing ones.
+typedef struct {
+    const char *name;
+    const char *sql;                // run as-is, or
+    int (*fn)(sqlite3 *h);          // for steps that must look at the schema
+} Migration;
+
+// Columns that older database.db files may be missing. ADD COLUMN cannot
+// take a CURRENT_TIMESTAMP default, so those come in as plain DATETIME.
+static const struct {
+    const char *table;
+    const char *column;
+    const char *decl;
+} added_columns[] = {
+    { "users",           "role",            "TEXT DEFAULT 'MEMBER'" },
+    { "users",           "status",          "TEXT DEFAULT 'ACTIVE'" },
+    { "users",           "created_at",      "DATETIME" },
+    { "projects",        "description",     "TEXT DEFAULT ''" },
+    { "projects",        "status",          "TEXT DEFAULT 'ACTIVE'" },
+    { "projects",        "created_at",      "DATETIME" },
+    { "tasks",           "status",          "TEXT DEFAULT 'NOT_STARTED'" },
+    { "tasks",           "progress",        "INTEGER DEFAULT 0" },
+    { "tasks",           "start_date",      "TEXT" },
+    { "tasks",           "end_date",        "TEXT" },
+    { "tasks",           "created_at",      "DATETIME" },
+    { "project_members", "role_in_project", "TEXT DEFAULT 'MEMBER'" },
+    { "project_members", "joined_at",       "DATETIME" },
+};
+
+// 1 = column exists (*pk gets its primary key position), 0 = missing, -1 = error
+static int column_info(sqlite3 *h, const char *table, const char *column, int *pk) {
+    char sql[128];
+    snprintf(sql, sizeof(sql), "PRAGMA table_info(%s)", table);
+
+    sqlite3_stmt *st;
+    if (sqlite3_prepare_v2(h, sql, -1, &st, NULL) != SQLITE_OK) return -1;
+
+    int found = 0;
+    while (!found && sqlite3_step(st) == SQLITE_ROW) {
+        if (strcmp((const char *)sqlite3_column_text(st, 1), column) == 0) {
+            found = 1;
+            if (pk) *pk = sqlite3_column_int(st, 5);
+        }
+    }
+    sqlite3_finalize(st);
+    return found;
+}
+
+static int migrate_add_columns(sqlite3 *h) {
+    for (size_t i = 0; i < sizeof(added_columns) / sizeof(added_columns[0]); i++) {
+        int rc = column_info(h, added_columns[i].table, added_columns[i].column, NULL);
+        if (rc < 0) return 0;
+        if (rc) continue;
+
+        char sql[256];
+        snprintf(sql, sizeof(sql), "ALTER TABLE %s ADD COLUMN %s %s",
+                 added_columns[i].table, added_columns[i].column, added_columns[i].decl);
+        if (sqlite3_exec(h, sql, NULL, NULL, NULL) != SQLITE_OK) return 0;
+    }
+    return 1;
+}
+
+// Old files created project_members without PRIMARY KEY(project_id, user_id),
+// so duplicate memberships could pile up. Rebuild it, keeping the first row
+// of each pair.
+static int migrate_member_pk(sqlite3 *h) {
+    int pk = 0;
+    if (column_info(h, "project_members", "project_id", &pk) < 0) return 0;
+    if (pk > 0) return 1;
+
     const char *sql =
+        "CREATE TABLE project_members_new ("
+        "project_id INTEGER,"
+        "user_id INTEGER,"
+        "role_in_project TEXT DEFAULT 'MEMBER',"
+        "joined_at DATETIME DEFAULT CURRENT_TIMESTAMP,"
+        "PRIMARY KEY(project_id, user_id)"
+        ");"
+        "INSERT OR IGNORE INTO project_members_new(project_id, user_id, role_in_project, joined_at) "
+        "SELECT project_id, user_id, IFNULL(role_in_project, 'MEMBER'), IFNULL(joined_at, CURRENT_TIMESTAMP) "
+        "FROM project_members ORDER BY rowid;"
+        "DROP TABLE project_members;"
+        "ALTER TABLE project_members_new RENAME TO project_members;";
+    return sqlite3_exec(h, sql, NULL, NULL, NULL) == SQLITE_OK;
+}
+
+static const Migration migrations[] = {
+    { "base schema",
         "CREATE TABLE IF NOT EXISTS users ("
         "id INTEGER PRIMARY KEY AUTOINCREMENT,"
         "username TEXT UNIQUE,"
@@ -49,17 +159,10 @@ int db_init(const char *path) {
         "start_date TEXT,"
         "end_date TEXT,"
         "created_at DATETIME DEFAULT CURRENT_TIMESTAMP"
-        ");";
+        ");",
+        NULL },
 
-    char *err;
-    if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
-        printf("DB init error: %s\n", err);
-        sqlite3_free(err);
-        return 0;
-    }
-
-    // Additional tables for extended features
-    const char *sql2 =
+    { "comments, attachments, chat",
         "CREATE TABLE IF NOT EXISTS task_comments ("
         "id INTEGER PRIMARY KEY AUTOINCREMENT,"
         "task_id INTEGER,"
@@ -80,272 +183,921 @@ int db_init(const char *path) {
         "user_id INTEGER,"
         "content TEXT,"
         "created_at DATETIME DEFAULT CURRENT_TIMESTAMP"
-        ");";
+        ");",
+        NULL },
+
+    { "missing columns", NULL, migrate_add_columns },
+
+    { "project_members primary key", NULL, migrate_member_pk },
+
+    // Indexes for the list queries, see check_query_plans().
+    { "list indexes",
+        "CREATE INDEX IF NOT EXISTS idx_tasks_project ON tasks(project_id);"
+        "CREATE INDEX IF NOT EXISTS idx_comments_task ON task_comments(task_id, id);"
+        "CREATE INDEX IF NOT EXISTS idx_attachments_task ON task_attachments(task_id, id);"
+        "CREATE INDEX IF NOT EXISTS idx_chat_project ON project_chat(project_id, id);"
+        "CREATE INDEX IF NOT EXISTS idx_members_user ON project_members(user_id, project_id);",
+        NULL },
+};
+
+#define MIGRATION_COUNT ((int)(sizeof(migrations) / sizeof(migrations[0])))
+
+static int db_migrate(void) {
+    int version = 0;
+    sqlite3_stmt *st;
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &st, NULL) != SQLITE_OK) return 0;
+    if (sqlite3_step(st) == SQLITE_ROW) version = sqlite3_column_int(st, 0);
+    sqlite3_finalize(st);
+
+    if (version > MIGRATION_COUNT) {
+        printf("DB schema version %d is newer than this server (%d)\n", version, MIGRATION_COUNT);
+        return 0;
+    }
+
+    for (int v = version; v < MIGRATION_COUNT; v++) {
+        const Migration *m = &migrations[v];
+        char *err = NULL;
+        int ok = sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, &err) == SQLITE_OK;
+
+        if (ok && m->sql) ok = sqlite3_exec(db, m->sql, NULL, NULL, &err) == SQLITE_OK;
+        if (ok && m->fn) ok = m->fn(db);
+        if (ok) {
+            char bump[64];
+            snprintf(bump, sizeof(bump), "PRAGMA user_version = %d", v + 1);
+            ok = sqlite3_exec(db, bump, NULL, NULL, &err) == SQLITE_OK &&
+                 sqlite3_exec(db, "COMMIT", NULL, NULL, &err) == SQLITE_OK;
+        }
+
+        if (!ok) {
+            printf("DB migration %d (%s) failed: %s\n", v + 1, m->name,
+                   err ? err : sqlite3_errmsg(db));
+            sqlite3_free(err);
+            sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+            return 0;
+        }
+        printf("DB migrated to version %d (%s)\n", v + 1, m->name);
+    }
+    return 1;
+}
+
+/* =====================================
+        PREPARED STATEMENT CACHE
+===================================== */
 
-    if (sqlite3_exec(db, sql2, NULL, NULL, &err) != SQLITE_OK) {
+// Every statement db.c runs. Each thread prepares a statement the first
+// time it needs it and afterwards only resets it.
+typedef enum {
+    STMT_REGISTER_USER,
+    STMT_AUTH_USER,
+    STMT_GET_USER_ID,
+    STMT_CREATE_PROJECT,
+    STMT_ADD_MEMBER,
+    STMT_LIST_PROJECTS,
+    STMT_IS_OWNER,
+    STMT_IS_MEMBER,
+    STMT_TASK_PROJECT,
+    STMT_TASK_ASSIGNEE,
+    STMT_CREATE_TASK_FULL,
+    STMT_CREATE_TASK,
+    STMT_LIST_TASKS,
+    STMT_UPDATE_STATUS,
+    STMT_UPDATE_PROGRESS,
+    STMT_SET_DATES,
+    STMT_TASK_DETAIL,
+    STMT_LIST_GANTT,
+    STMT_ADD_COMMENT,
+    STMT_LIST_COMMENTS,
+    STMT_ADD_ATTACHMENT,
+    STMT_LIST_ATTACHMENTS,
+    STMT_ADD_CHAT,
+    STMT_LIST_CHAT,
+    STMT_RECENT_CHAT,
+    STMT_ASSIGN_TASK,
+    STMT_BEGIN,
+    STMT_COMMIT,
+    STMT_ROLLBACK,
+    STMT_SAVEPOINT,
+    STMT_ROLLBACK_TO,
+    STMT_RELEASE,
+    STMT_COUNT
+} StmtId;
+
+static const char *stmt_sql[STMT_COUNT] = {
+    [STMT_REGISTER_USER] =
+        "INSERT INTO users(username,password) VALUES(?,?)",
+    [STMT_AUTH_USER] =
+        "SELECT id FROM users WHERE username=? AND password=?",
+    [STMT_GET_USER_ID] =
+        "SELECT id FROM users WHERE username=?",
+    [STMT_CREATE_PROJECT] =
+        "INSERT INTO projects(name, owner_id) VALUES (?, ?)",
+    [STMT_ADD_MEMBER] =
+        "INSERT INTO project_members(project_id, user_id) VALUES (?, ?)",
+    [STMT_LIST_PROJECTS] =
+        "SELECT projects.id, projects.name "
+        "FROM projects "
+        "JOIN project_members ON project_members.project_id = projects.id "
+        "WHERE project_members.user_id = ?",
+    [STMT_IS_OWNER] =
+        "SELECT 1 FROM projects WHERE id=? AND owner_id=?",
+    [STMT_IS_MEMBER] =
+        "SELECT 1 FROM project_members WHERE project_id=? AND user_id=?",
+    [STMT_TASK_PROJECT] =
+        "SELECT project_id FROM tasks WHERE id=?",
+    [STMT_TASK_ASSIGNEE] =
+        "SELECT assignee_id FROM tasks WHERE id=?",
+    [STMT_CREATE_TASK_FULL] =
+        "INSERT INTO tasks(project_id, title, description, assignee_id, start_date, end_date) "
+        "VALUES (?, ?, ?, ?, ?, ?)",
+    [STMT_CREATE_TASK] =
+        "INSERT INTO tasks(project_id, title, description) VALUES (?, ?, ?)",
+    [STMT_LIST_TASKS] =
+        "SELECT t.id, t.title, IFNULL(u.username, 'None') AS assignee, "
+        "IFNULL(t.status,'NOT_STARTED') AS status, IFNULL(t.progress,0) AS progress, IFNULL(t.start_date,''), IFNULL(t.end_date,'') "
+        "FROM tasks t "
+        "LEFT JOIN users u ON t.assignee_id = u.id "
+        "WHERE t.project_id = ?;",
+    [STMT_UPDATE_STATUS] =
+        "UPDATE tasks SET status = ? WHERE id = ?",
+    [STMT_UPDATE_PROGRESS] =
+        "UPDATE tasks SET progress = ?, status = ? WHERE id = ?",
+    [STMT_SET_DATES] =
+        "UPDATE tasks SET start_date = ?, end_date = ? WHERE id = ?",
+    [STMT_TASK_DETAIL] =
+        "SELECT t.id, t.project_id, t.title, t.description, IFNULL(u.username,'None'), "
+        "IFNULL(t.status,'NOT_STARTED'), IFNULL(t.progress,0), IFNULL(t.start_date,''), IFNULL(t.end_date,'') "
+        "FROM tasks t LEFT JOIN users u ON t.assignee_id = u.id WHERE t.id = ?;",
+    [STMT_LIST_GANTT] =
+        "SELECT t.id, t.title, IFNULL(t.status,'NOT_STARTED'), IFNULL(t.progress,0), IFNULL(t.start_date,''), IFNULL(t.end_date,''), IFNULL(u.username,'None') "
+        "FROM tasks t LEFT JOIN users u ON t.assignee_id = u.id WHERE t.project_id = ?;",
+    [STMT_ADD_COMMENT] =
+        "INSERT INTO task_comments(task_id,user_id,content) VALUES(?,?,?)",
+    [STMT_LIST_COMMENTS] =
+        "SELECT c.id, IFNULL(u.username,'?'), c.content, c.created_at "
+        "FROM task_comments c LEFT JOIN users u ON c.user_id = u.id "
+        "WHERE c.task_id = ? ORDER BY c.id ASC;",
+    [STMT_ADD_ATTACHMENT] =
+        "INSERT INTO task_attachments(task_id,filename,filepath) VALUES(?,?,?)",
+    [STMT_LIST_ATTACHMENTS] =
+        "SELECT a.id, a.filename, a.filepath, a.created_at FROM task_attachments a "
+        "WHERE a.task_id = ? ORDER BY a.id ASC;",
+    [STMT_ADD_CHAT] =
+        "INSERT INTO project_chat(project_id,user_id,content) VALUES(?,?,?) "
+        "RETURNING id, created_at, IFNULL((SELECT username FROM users WHERE id = user_id),'?')",
+    [STMT_LIST_CHAT] =
+        "SELECT c.id, IFNULL(u.username,'?'), c.content, c.created_at "
+        "FROM project_chat c LEFT JOIN users u ON c.user_id = u.id "
+        "WHERE c.project_id = ? AND c.id > ? ORDER BY c.id ASC;",
+    [STMT_RECENT_CHAT] =
+        "SELECT c.id, IFNULL(u.username,'?'), c.content, c.created_at "
+        "FROM project_chat c LEFT JOIN users u ON c.user_id = u.id "
+        "WHERE c.project_id = ? ORDER BY c.id DESC LIMIT ?;",
+    [STMT_ASSIGN_TASK] =
+        "UPDATE tasks SET assignee_id = ? WHERE id = ?",
+    [STMT_BEGIN] = "BEGIN IMMEDIATE",
+    [STMT_COMMIT] = "COMMIT",
+    [STMT_ROLLBACK] = "ROLLBACK",
+    [STMT_SAVEPOINT] = "SAVEPOINT op",
+    [STMT_ROLLBACK_TO] = "ROLLBACK TO op",
+    [STMT_RELEASE] = "RELEASE op",
+};
+
+// Names for the STATS output and the slow-query log.
+static const char *stmt_name[STMT_COUNT] = {
+    [STMT_REGISTER_USER] = "REGISTER_USER",
+    [STMT_AUTH_USER] = "AUTH_USER",
+    [STMT_GET_USER_ID] = "GET_USER_ID",
+    [STMT_CREATE_PROJECT] = "CREATE_PROJECT",
+    [STMT_ADD_MEMBER] = "ADD_MEMBER",
+    [STMT_LIST_PROJECTS] = "LIST_PROJECTS",
+    [STMT_IS_OWNER] = "IS_OWNER",
+    [STMT_IS_MEMBER] = "IS_MEMBER",
+    [STMT_TASK_PROJECT] = "TASK_PROJECT",
+    [STMT_TASK_ASSIGNEE] = "TASK_ASSIGNEE",
+    [STMT_CREATE_TASK_FULL] = "CREATE_TASK_FULL",
+    [STMT_CREATE_TASK] = "CREATE_TASK",
+    [STMT_LIST_TASKS] = "LIST_TASKS",
+    [STMT_UPDATE_STATUS] = "UPDATE_STATUS",
+    [STMT_UPDATE_PROGRESS] = "UPDATE_PROGRESS",
+    [STMT_SET_DATES] = "SET_DATES",
+    [STMT_TASK_DETAIL] = "TASK_DETAIL",
+    [STMT_LIST_GANTT] = "LIST_GANTT",
+    [STMT_ADD_COMMENT] = "ADD_COMMENT",
+    [STMT_LIST_COMMENTS] = "LIST_COMMENTS",
+    [STMT_ADD_ATTACHMENT] = "ADD_ATTACHMENT",
+    [STMT_LIST_ATTACHMENTS] = "LIST_ATTACHMENTS",
+    [STMT_ADD_CHAT] = "ADD_CHAT",
+    [STMT_LIST_CHAT] = "LIST_CHAT",
+    [STMT_RECENT_CHAT] = "RECENT_CHAT",
+    [STMT_ASSIGN_TASK] = "ASSIGN_TASK",
+    [STMT_BEGIN] = "BEGIN",
+    [STMT_COMMIT] = "COMMIT",
+    [STMT_ROLLBACK] = "ROLLBACK",
+    [STMT_SAVEPOINT] = "SAVEPOINT",
+    [STMT_ROLLBACK_TO] = "ROLLBACK_TO",
+    [STMT_RELEASE] = "RELEASE",
+};
+
+// Startup self-check: the hot read queries must be index lookups. A full
+// SCAN or a temp b-tree sort here means an index went missing or a query
+// stopped matching it, so say so loudly.
+static void check_query_plans(void) {
+    static const StmtId hot[] = {
+        STMT_LIST_PROJECTS, STMT_IS_MEMBER, STMT_LIST_TASKS, STMT_LIST_GANTT,
+        STMT_LIST_COMMENTS, STMT_LIST_ATTACHMENTS, STMT_LIST_CHAT, STMT_RECENT_CHAT,
+    };
+
+    for (size_t i = 0; i < sizeof(hot) / sizeof(hot[0]); i++) {
+        char sql[1024];
+        snprintf(sql, sizeof(sql), "EXPLAIN QUERY PLAN %s", stmt_sql[hot[i]]);
+
+        sqlite3_stmt *st;
+        if (sqlite3_prepare_v2(db, sql, -1, &st, NULL) != SQLITE_OK) continue;
+        while (sqlite3_step(st) == SQLITE_ROW) {
+            const char *detail = (const char *)sqlite3_column_text(st, 3);
+            if (detail && (strncmp(detail, "SCAN", 4) == 0 || strstr(detail, "TEMP B-TREE")))
+                printf("[WARN] query plan: %s\n  for: %s\n", detail, stmt_sql[hot[i]]);
+        }
+        sqlite3_finalize(st);
+    }
+}
+
+/* =====================================
+        CONNECTION POOL
+===================================== */
+
+#define STMT_SLOT_BITS 7
+#define STMT_SLOTS (1 << STMT_SLOT_BITS)    // comfortably above STMT_COUNT
+
+// Which cached statement a pointer is, filled in when it is prepared, so the
+// profile hook finds it without searching.
+typedef struct {
+    const sqlite3_stmt *st;
+    int id;
+} StmtSlot;
+
+// Each thread gets its own connection (WAL lets readers run next to the
+// single writer) with its own prepared statements. Connections are handed
+// back to the pool when their thread exits.
+typedef struct DbConn {
+    sqlite3 *h;
+    sqlite3_stmt *stmts[STMT_COUNT];
+    StmtSlot slots[STMT_SLOTS];
+    unsigned long rows[STMT_COUNT];     // rows of the current run, see stmt_step
+    unsigned long started[STMT_COUNT];  // start of the current run, ns
+    int in_use;
+    struct DbConn *next;
+} DbConn;
+
+#define DB_BUSY_TIMEOUT_MS 5000
+#define DB_CACHE_KB 8192            // page cache per connection
+
+static char *db_path = NULL;
+static pthread_key_t conn_key;
+static __thread DbConn *tl_conn = NULL;
+
+static pthread_mutex_t conns_lock = PTHREAD_MUTEX_INITIALIZER;
+static DbConn *conns = NULL;
+
+static unsigned long long stmt_hits = 0;
+static unsigned long long stmt_misses = 0;
+
+static void configure_conn(sqlite3 *h) {
+    char sql[160];
+    snprintf(sql, sizeof(sql),
+             "PRAGMA synchronous=NORMAL;"
+             "PRAGMA temp_store=MEMORY;"
+             "PRAGMA cache_size=-%d;", DB_CACHE_KB);
+    sqlite3_exec(h, sql, NULL, NULL, NULL);
+    sqlite3_busy_timeout(h, DB_BUSY_TIMEOUT_MS);
+}
+
+static void conn_thread_exit(void *arg);
+static int profile_cb(unsigned type, void *ctx, void *p, void *x);
+
+// WAL is a property of the database file, so setting it once on the main
+// handle covers every pooled connection opened afterwards.
+static int conn_pool_init(const char *path) {
+    char *err = NULL;
+    if (sqlite3_exec(db, "PRAGMA journal_mode=WAL;", NULL, NULL, &err) != SQLITE_OK) {
         printf("DB init error: %s\n", err);
         sqlite3_free(err);
         return 0;
     }
+    configure_conn(db);
 
-    // Backward compatible: if an old DB existed without new columns, try ALTER and ignore errors.
-    const char *alter_sql[] = {
-        // users
-        "ALTER TABLE users ADD COLUMN role TEXT DEFAULT 'MEMBER'",
-        "ALTER TABLE users ADD COLUMN status TEXT DEFAULT 'ACTIVE'",
-        "ALTER TABLE users ADD COLUMN created_at DATETIME DEFAULT CURRENT_TIMESTAMP",
-
-        // projects
-        "ALTER TABLE projects ADD COLUMN description TEXT DEFAULT ''",
-        "ALTER TABLE projects ADD COLUMN status TEXT DEFAULT 'ACTIVE'",
-        "ALTER TABLE projects ADD COLUMN created_at DATETIME DEFAULT CURRENT_TIMESTAMP",
-
-        // tasks
-        "ALTER TABLE tasks ADD COLUMN status TEXT DEFAULT 'NOT_STARTED'",
-        "ALTER TABLE tasks ADD COLUMN progress INTEGER DEFAULT 0",
-        "ALTER TABLE tasks ADD COLUMN start_date TEXT",
-        "ALTER TABLE tasks ADD COLUMN end_date TEXT",
-        "ALTER TABLE tasks ADD COLUMN created_at DATETIME DEFAULT CURRENT_TIMESTAMP",
-
-        // project_members (old DB may have no PK; we cannot ALTER to add PK here)
-        "ALTER TABLE project_members ADD COLUMN role_in_project TEXT DEFAULT 'MEMBER'",
-        "ALTER TABLE project_members ADD COLUMN joined_at DATETIME DEFAULT CURRENT_TIMESTAMP",
-
-        NULL
-    };
-    for (int i = 0; alter_sql[i]; i++) {
-        sqlite3_exec(db, alter_sql[i], NULL, NULL, NULL);
+    db_path = strdup(path);
+    if (!db_path) return 0;
+    if (pthread_key_create(&conn_key, conn_thread_exit) != 0) return 0;
+    return 1;
+}
+
+static void conn_thread_exit(void *arg) {
+    DbConn *c = (DbConn *)arg;
+    pthread_mutex_lock(&conns_lock);
+    c->in_use = 0;
+    pthread_mutex_unlock(&conns_lock);
+}
+
+static DbConn *thread_conn(void) {
+    if (tl_conn) return tl_conn;
+
+    pthread_mutex_lock(&conns_lock);
+    DbConn *c = conns;
+    while (c && c->in_use) c = c->next;
+    if (c) c->in_use = 1;
+    pthread_mutex_unlock(&conns_lock);
+
+    if (!c) {
+        c = calloc(1, sizeof(DbConn));
+        if (!c) return NULL;
+        // one thread per connection, so SQLite's own mutexes are not needed
+        if (sqlite3_open_v2(db_path, &c->h, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX,
+                            NULL) != SQLITE_OK) {
+            printf("Cannot open DB: %s\n", sqlite3_errmsg(c->h));
+            sqlite3_close(c->h);
+            free(c);
+            return NULL;
+        }
+        configure_conn(c->h);
+        sqlite3_trace_v2(c->h, SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE, profile_cb, c);
+        c->in_use = 1;
+
+        pthread_mutex_lock(&conns_lock);
+        c->next = conns;
+        conns = c;
+        pthread_mutex_unlock(&conns_lock);
     }
 
+    pthread_setspecific(conn_key, c);
+    tl_conn = c;
+    return c;
+}
+
+static unsigned stmt_slot(const sqlite3_stmt *st) {
+    // statements are heap blocks: the low bits carry nothing
+    return (unsigned)(((uintptr_t)st >> 4) * 2654435761u) >> (32 - STMT_SLOT_BITS);
+}
+
+// Which cached statement st is; STMT_COUNT for anything else (migrations,
+// query plan checks).
+static int stmt_id(const DbConn *c, const sqlite3_stmt *st) {
+    for (unsigned h = stmt_slot(st); c->slots[h].st; h = (h + 1) & (STMT_SLOTS - 1))
+        if (c->slots[h].st == st) return c->slots[h].id;
+    return STMT_COUNT;
+}
+
+// Ready-to-bind statement for this thread, or NULL if it cannot be prepared.
+// Step it with stmt_step() and hand it back with stmt_done() once the rows
+// have been read.
+static sqlite3_stmt *stmt_get(StmtId id) {
+    DbConn *c = thread_conn();
+    if (!c) return NULL;
+
+    if (c->stmts[id]) {
+        __atomic_fetch_add(&stmt_hits, 1, __ATOMIC_RELAXED);
+        return c->stmts[id];
+    }
+
+    __atomic_fetch_add(&stmt_misses, 1, __ATOMIC_RELAXED);
+    if (sqlite3_prepare_v3(c->h, stmt_sql[id], -1, SQLITE_PREPARE_PERSISTENT,
+                           &c->stmts[id], NULL) != SQLITE_OK) {
+        printf("DB prepare error: %s\n", sqlite3_errmsg(c->h));
+        c->stmts[id] = NULL;
+        return NULL;
+    }
+    unsigned h = stmt_slot(c->stmts[id]);
+    while (c->slots[h].st) h = (h + 1) & (STMT_SLOTS - 1);
+    c->slots[h].st = c->stmts[id];
+    c->slots[h].id = id;
+    return c->stmts[id];
+}
+
+// sqlite3_step for a statement from stmt_get, counting its result rows for
+// the profile.
+static int stmt_step(sqlite3_stmt *st) {
+    int rc = sqlite3_step(st);
+    if (rc == SQLITE_ROW) tl_conn->rows[stmt_id(tl_conn, st)]++;
+    return rc;
+}
+
+// Reset right away so the statement does not keep a read transaction open.
+static void stmt_done(sqlite3_stmt *st) {
+    sqlite3_reset(st);
+    sqlite3_clear_bindings(st);
+}
+
+static sqlite3 *stmt_conn(void) {
+    return tl_conn->h;
+}
+
+/* =====================================
+        STATEMENT PROFILE
+===================================== */
+
+// Totals per cached statement across all connections, fed by SQLite's
+// trace hook as each run finishes (reset or done); rows are counted by
+// stmt_step.
+typedef struct {
+    unsigned long calls;
+    unsigned long ns;
+    unsigned long max_ns;
+    unsigned long rows;         // result rows
+    unsigned long vm_steps;     // SQLITE_STMTSTATUS_VM_STEP
+    unsigned long scan_steps;   // SQLITE_STMTSTATUS_FULLSCAN_STEP
+    unsigned long sorts;        // SQLITE_STMTSTATUS_SORT
+    unsigned long slow;
+} StmtProfile;
+
+static StmtProfile profiles[STMT_COUNT];
+static unsigned long slow_query_ns = DB_SLOW_QUERY_MS * 1000000UL;
+
+static void add_max(unsigned long *p, unsigned long v) {
+    unsigned long m = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while (v > m && !__atomic_compare_exchange_n(p, &m, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void log_slow(int id, sqlite3_stmt *st, unsigned long ns, unsigned long rows, int vm) {
+    // bound values of these are passwords
+    int secret = id == STMT_REGISTER_USER || id == STMT_AUTH_USER;
+    char *sql = secret ? NULL : sqlite3_expanded_sql(st);
+    char msg[LOG_RECORD_SIZE];
+    snprintf(msg, sizeof(msg), "%s %.1fms rows=%lu vm=%d: %s", stmt_name[id], ns / 1e6, rows, vm,
+             sql ? sql : sqlite3_sql(st));
+    sqlite3_free(sql);
+    log_message("SLOW", msg);
+}
+
+static unsigned long mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+// Runs on the connection's own thread, so c needs no locking. The run is
+// timed here rather than with the PROFILE event's own figure, which the
+// default VFS only measures to the millisecond.
+static int profile_cb(unsigned type, void *ctx, void *p, void *x) {
+    DbConn *c = ctx;
+    sqlite3_stmt *st = p;
+    (void)x;
+    int id = stmt_id(c, st);
+    if (id == STMT_COUNT) return 0;
+
+    if (type == SQLITE_TRACE_STMT) {
+        if (!c->started[id]) c->started[id] = mono_ns();    // not again for triggers
+        return 0;
+    }
+    unsigned long ns = c->started[id] ? mono_ns() - c->started[id] : 0;
+    unsigned long rows = c->rows[id];
+    c->started[id] = 0;
+    int vm = sqlite3_stmt_status(st, SQLITE_STMTSTATUS_VM_STEP, 1);
+    int scan = sqlite3_stmt_status(st, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+    int sorts = sqlite3_stmt_status(st, SQLITE_STMTSTATUS_SORT, 1);
+    c->rows[id] = 0;
+
+    StmtProfile *sp = &profiles[id];
+    __atomic_add_fetch(&sp->calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sp->ns, ns, __ATOMIC_RELAXED);
+    add_max(&sp->max_ns, ns);
+    __atomic_add_fetch(&sp->rows, rows, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sp->vm_steps, (unsigned long)vm, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sp->scan_steps, (unsigned long)scan, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sp->sorts, (unsigned long)sorts, __ATOMIC_RELAXED);
+
+    unsigned long limit = __atomic_load_n(&slow_query_ns, __ATOMIC_RELAXED);
+    if (limit && ns >= limit) {
+        __atomic_add_fetch(&sp->slow, 1, __ATOMIC_RELAXED);
+        log_slow(id, st, ns, rows, vm);
+    }
+    return 0;
+}
+
+void db_set_slow_query_ms(int ms) {
+    __atomic_store_n(&slow_query_ns, ms > 0 ? (unsigned long)ms * 1000000UL : 0, __ATOMIC_RELAXED);
+}
+
+int db_profile_stats(Buf *out) {
+    int n = 0;
+    for (int i = 0; i < STMT_COUNT; i++) {
+        const StmtProfile *sp = &profiles[i];
+        unsigned long calls = __atomic_load_n(&sp->calls, __ATOMIC_RELAXED);
+        if (calls == 0) continue;
+        buf_row(out, 9);
+        buf_col_str(out, NULL, stmt_name[i]);
+        buf_col_int(out, "calls=", (int)calls);
+        buf_col_int(out, "avg_us=", (int)(__atomic_load_n(&sp->ns, __ATOMIC_RELAXED) / calls / 1000));
+        buf_col_int(out, "max_us=", (int)(__atomic_load_n(&sp->max_ns, __ATOMIC_RELAXED) / 1000));
+        buf_col_int(out, "rows=", (int)__atomic_load_n(&sp->rows, __ATOMIC_RELAXED));
+        buf_col_int(out, "vm=", (int)__atomic_load_n(&sp->vm_steps, __ATOMIC_RELAXED));
+        buf_col_int(out, "scan=", (int)__atomic_load_n(&sp->scan_steps, __ATOMIC_RELAXED));
+        buf_col_int(out, "sort=", (int)__atomic_load_n(&sp->sorts, __ATOMIC_RELAXED));
+        buf_col_int(out, "slow=", (int)__atomic_load_n(&sp->slow, __ATOMIC_RELAXED));
+        buf_row_end(out);
+        n++;
+    }
+    return n;
+}
+
+/* =====================================
+        WRITER QUEUE (GROUP COMMIT)
+===================================== */
+
+// Every mutation runs on one writer thread. Whatever piles up while the
+// previous batch commits (or during a short linger) goes into a single
+// transaction, one savepoint per operation, so a burst of chat messages
+// costs one commit instead of one each. Callers block until their batch
+// has committed. The linger only pays off under concurrent writes, so a
+// lone op, or one after a batch of one, is committed at once.
+#define DB_WRITE_BATCH 256          // ops per transaction, at most
+#define DB_WRITE_LINGER_US 2000     // wait this long for company before committing
+
+typedef struct WriteOp {
+    int (*fn)(struct WriteOp *op);  // runs on the writer, returns the db_* result
+    void (*committed)(struct WriteOp *op);  // optional: after a successful commit
+    int i[3];
+    const char *s[5];
+    void *out;                      // result slot of the op (an id, or a ChatPosted)
+    int rc;
+    int done;
+    struct WriteOp *next;
+} WriteOp;
+
+static pthread_mutex_t w_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t w_wake;                              // writer: work or stop; set up in writer_start
+static pthread_cond_t w_done = PTHREAD_COND_INITIALIZER;   // callers: a batch finished
+static WriteOp *w_head = NULL;
+static WriteOp *w_tail = NULL;
+static int w_count = 0;
+static int w_stop = 0;
+static int w_running = 0;
+static pthread_t w_thread;
+static __thread int in_writer = 0;
+
+static unsigned long long w_batches = 0;
+static unsigned long long w_ops = 0;
+
+static int stmt_exec(StmtId id) {
+    sqlite3_stmt *st = stmt_get(id);
+    if (!st) return 0;
+    int rc = stmt_step(st);
+    stmt_done(st);
+    return rc == SQLITE_DONE;
+}
+
+static void run_batch(WriteOp *batch) {
+    // if BEGIN fails each op still runs, just in its own autocommit transaction
+    int txn = stmt_exec(STMT_BEGIN);
+
+    for (WriteOp *op = batch; op; op = op->next) {
+        if (txn) stmt_exec(STMT_SAVEPOINT);
+        op->rc = op->fn(op);
+        if (txn) {
+            // a failed op must not leave half its rows behind
+            if (op->rc == 0) stmt_exec(STMT_ROLLBACK_TO);
+            stmt_exec(STMT_RELEASE);
+        }
+    }
+
+    if (txn && !stmt_exec(STMT_COMMIT)) {
+        printf("DB commit error: %s\n", sqlite3_errmsg(stmt_conn()));
+        stmt_exec(STMT_ROLLBACK);
+        for (WriteOp *op = batch; op; op = op->next) op->rc = 0;
+    }
+
+    // in commit order, before any caller wakes up
+    for (WriteOp *op = batch; op; op = op->next)
+        if (op->rc && op->committed) op->committed(op);
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    in_writer = 1;
+    int last_n = 1;     // size of the previous batch
+
+    pthread_mutex_lock(&w_lock);
+    while (1) {
+        while (!w_head && !w_stop)
+            pthread_cond_wait(&w_wake, &w_lock);
+        if (!w_head) break;
+
+        if (w_count > 1 && last_n > 1 && w_count < DB_WRITE_BATCH && !w_stop) {
+            struct timespec until;
+            clock_gettime(CLOCK_MONOTONIC, &until);
+            until.tv_nsec += DB_WRITE_LINGER_US * 1000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            while (w_count < DB_WRITE_BATCH && !w_stop &&
+                   pthread_cond_timedwait(&w_wake, &w_lock, &until) == 0)
+                ;
+        }
+
+        // take up to DB_WRITE_BATCH ops off the front
+        WriteOp *batch = w_head, *last = w_head;
+        int n = 1;
+        while (last->next && n < DB_WRITE_BATCH) {
+            last = last->next;
+            n++;
+        }
+        w_head = last->next;
+        if (!w_head) w_tail = NULL;
+        last->next = NULL;
+        w_count -= n;
+        pthread_mutex_unlock(&w_lock);
+
+        run_batch(batch);
+
+        pthread_mutex_lock(&w_lock);
+        for (WriteOp *op = batch; op; op = op->next) op->done = 1;
+        w_batches++;
+        w_ops += n;
+        last_n = n;
+        pthread_cond_broadcast(&w_done);
+    }
+    pthread_mutex_unlock(&w_lock);
+    return NULL;
+}
+
+static int writer_start(void) {
+    // the linger is a relative wait: immune to wall-clock steps
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w_wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&w_thread, NULL, writer_main, NULL) != 0) {
+        perror("pthread_create");
+        return 0;
+    }
+    w_running = 1;
     return 1;
 }
 
+// Drains whatever is still queued, then stops the writer.
+static void writer_stop(void) {
+    if (!w_running) return;
+    pthread_mutex_lock(&w_lock);
+    w_stop = 1;
+    pthread_cond_signal(&w_wake);
+    pthread_mutex_unlock(&w_lock);
+    pthread_join(w_thread, NULL);
+    w_running = 0;
+}
+
+// Hand op to the writer and wait until its transaction has committed.
+static int db_write(WriteOp *op) {
+    if (!w_running || in_writer) {
+        op->rc = op->fn(op);
+        if (op->rc && op->committed) op->committed(op);
+        return op->rc;
+    }
+
+    op->next = NULL;
+    op->done = 0;
+
+    pthread_mutex_lock(&w_lock);
+    if (w_tail) w_tail->next = op;
+    else w_head = op;
+    w_tail = op;
+    w_count++;
+    pthread_cond_signal(&w_wake);
+
+    while (!op->done)
+        pthread_cond_wait(&w_done, &w_lock);
+    pthread_mutex_unlock(&w_lock);
+    return op->rc;
+}
+
+void db_write_stats(unsigned long long *batches, unsigned long long *ops) {
+    pthread_mutex_lock(&w_lock);
+    if (batches) *batches = w_batches;
+    if (ops) *ops = w_ops;
+    pthread_mutex_unlock(&w_lock);
+}
+
+void db_stmt_cache_stats(unsigned long long *hits, unsigned long long *misses) {
+    if (hits) *hits = __atomic_load_n(&stmt_hits, __ATOMIC_RELAXED);
+    if (misses) *misses = __atomic_load_n(&stmt_misses, __ATOMIC_RELAXED);
+}
+
 void db_close() {
+    writer_stop();
+
+    pthread_mutex_lock(&conns_lock);
+    while (conns) {
+        DbConn *c = conns;
+        conns = c->next;
+        for (int i = 0; i < STMT_COUNT; i++)
+            if (c->stmts[i]) sqlite3_finalize(c->stmts[i]);
+        sqlite3_close(c->h);
+        free(c);
+    }
+    pthread_mutex_unlock(&conns_lock);
+    tl_conn = NULL;
+
     if (db) sqlite3_close(db);
+    db = NULL;
+    free(db_path);
+    db_path = NULL;
 }
 
 /* =====================================
             USER FUNCTIONS
 ===================================== */
 
-int db_register_user(const char *username, const char *password) {
-    sqlite3_stmt *st;
+static int register_user_op(WriteOp *op) {
+    const char *username = op->s[0];
+    const char *password = op->s[1];
 
-    sqlite3_prepare_v2(db,
-        "INSERT INTO users(username,password) VALUES(?,?)",
-        -1, &st, NULL);
+    sqlite3_stmt *st = stmt_get(STMT_REGISTER_USER);
+    if (!st) return 0;
 
     sqlite3_bind_text(st, 1, username, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(st, 2, password, -1, SQLITE_TRANSIENT);
 
-    int rc = sqlite3_step(st);
-    sqlite3_finalize(st);
+    int rc = stmt_step(st);
+    stmt_done(st);
 
     return rc == SQLITE_DONE;
 }
 
-int db_auth_user(const char *username, const char *password, int *user_id) {
-    sqlite3_stmt *st;
+int db_register_user(const char *username, const char *password) {
+    WriteOp op = { .fn = register_user_op, .s = { username, password } };
+    return db_write(&op);
+}
 
-    sqlite3_prepare_v2(db,
-        "SELECT id FROM users WHERE username=? AND password=?",
-        -1, &st, NULL);
+int db_auth_user(const char *username, const char *password, int *user_id) {
+    sqlite3_stmt *st = stmt_get(STMT_AUTH_USER);
+    if (!st) return 0;
 
     sqlite3_bind_text(st, 1, username, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(st, 2, password, -1, SQLITE_TRANSIENT);
 
-    int rc = sqlite3_step(st);
-    if (rc == SQLITE_ROW) {
-        *user_id = sqlite3_column_int(st, 0);
-        sqlite3_finalize(st);
-        return 1;
-    }
+    int rc = stmt_step(st);
+    if (rc == SQLITE_ROW) *user_id = sqlite3_column_int(st, 0);
+    stmt_done(st);
 
-    sqlite3_finalize(st);
-    return 0;
+    return rc == SQLITE_ROW;
 }
 
 int db_get_user_id(const char *username, int *user_id) {
-    sqlite3_stmt *st;
-
-    sqlite3_prepare_v2(db,
-        "SELECT id FROM users WHERE username=?",
-        -1, &st, NULL);
+    sqlite3_stmt *st = stmt_get(STMT_GET_USER_ID);
+    if (!st) return 0;
 
     sqlite3_bind_text(st, 1, username, -1, SQLITE_TRANSIENT);
 
-    int rc = sqlite3_step(st);
-    if (rc == SQLITE_ROW) {
-        *user_id = sqlite3_column_int(st, 0);
-        sqlite3_finalize(st);
-        return 1;
-    }
+    int rc = stmt_step(st);
+    if (rc == SQLITE_ROW) *user_id = sqlite3_column_int(st, 0);
+    stmt_done(st);
 
-    sqlite3_finalize(st);
-    return 0;
+    return rc == SQLITE_ROW;
 }
 
 /* =====================================
             PROJECT FUNCTIONS
 ===================================== */
 
-int db_create_project(const char *name, int owner_id, int *project_id) {
-    sqlite3_stmt *st;
+static int create_project_op(WriteOp *op) {
+    const char *name = op->s[0];
+    int owner_id = op->i[0];
+    int *project_id = op->out;
 
-    sqlite3_prepare_v2(db,
-        "INSERT INTO projects(name, owner_id) VALUES (?, ?)",
-        -1, &st, NULL);
+    sqlite3_stmt *st = stmt_get(STMT_CREATE_PROJECT);
+    if (!st) return 0;
 
     sqlite3_bind_text(st, 1, name, -1, SQLITE_TRANSIENT);
     sqlite3_bind_int(st, 2, owner_id);
 
-    if (sqlite3_step(st) != SQLITE_DONE) {
-        sqlite3_finalize(st);
+    if (stmt_step(st) != SQLITE_DONE) {
+        stmt_done(st);
         return 0;
     }
 
-    *project_id = sqlite3_last_insert_rowid(db);
-    sqlite3_finalize(st);
+    *project_id = sqlite3_last_insert_rowid(stmt_conn());
+    stmt_done(st);
 
     // Make the owner a member too
-    sqlite3_prepare_v2(db,
-        "INSERT INTO project_members(project_id, user_id) VALUES (?, ?)",
-        -1, &st, NULL);
+    st = stmt_get(STMT_ADD_MEMBER);
+    if (!st) return 1;
 
     sqlite3_bind_int(st, 1, *project_id);
     sqlite3_bind_int(st, 2, owner_id);
 
-    sqlite3_step(st);
-    sqlite3_finalize(st);
+    stmt_step(st);
+    stmt_done(st);
 
     return 1;
 }
 
-int db_list_projects_for_user(int user_id, char *out, int out_size) {
-
-    sqlite3_stmt *st;
+int db_create_project(const char *name, int owner_id, int *project_id) {
+    WriteOp op = { .fn = create_project_op, .i = { owner_id }, .s = { name }, .out = project_id };
+    return db_write(&op);
+}
 
-    sqlite3_prepare_v2(db,
-        "SELECT projects.id, projects.name "
-        "FROM projects "
-        "JOIN project_members ON project_members.project_id = projects.id "
-        "WHERE project_members.user_id = ?",
-        -1, &st, NULL);
+int db_list_projects_for_user(int user_id, Buf *out) {
+    sqlite3_stmt *st = stmt_get(STMT_LIST_PROJECTS);
+    if (!st) return -1;
 
     sqlite3_bind_int(st, 1, user_id);
 
-    char temp[2048] = "";
-    while (sqlite3_step(st) == SQLITE_ROW) {
-        int id = sqlite3_column_int(st, 0);
-        const char *name = (const char *)sqlite3_column_text(st, 1);
-
-        char line[256];
-        snprintf(line, sizeof(line), "%d|%s\n", id, name);
-        strcat(temp, line);
+    int rows = 0;
+    while (stmt_step(st) == SQLITE_ROW) {
+        buf_row(out, 2);
+        buf_col_int(out, NULL, sqlite3_column_int(st, 0));
+        buf_col_str(out, NULL, (const char *)sqlite3_column_text(st, 1));
+        buf_row_end(out);
+        rows++;
     }
 
-    sqlite3_finalize(st);
-
-    strncpy(out, temp, out_size - 1);
-    return 1;
+    stmt_done(st);
+    return rows;
 }
 
-int db_invite_member(int project_id, int user_id) {
+static int invite_member_op(WriteOp *op) {
+    int project_id = op->i[0];
+    int user_id = op->i[1];
 
     // prevent duplicates (also enforced by PK, but we want a nicer message)
-    sqlite3_stmt *st;
-    sqlite3_prepare_v2(db,
-        "SELECT 1 FROM project_members WHERE project_id=? AND user_id=?",
-        -1, &st, NULL);
-    sqlite3_bind_int(st, 1, project_id);
-    sqlite3_bind_int(st, 2, user_id);
-    int rc = sqlite3_step(st);
-    sqlite3_finalize(st);
-    if (rc == SQLITE_ROW) return -1; // already member
+    if (db_is_project_member(project_id, user_id)) return -1; // already member
 
-    sqlite3_prepare_v2(db,
-        "INSERT INTO project_members(project_id, user_id) VALUES (?, ?)",
-        -1, &st, NULL);
+    sqlite3_stmt *st = stmt_get(STMT_ADD_MEMBER);
+    if (!st) return 0;
     sqlite3_bind_int(st, 1, project_id);
     sqlite3_bind_int(st, 2, user_id);
-    rc = sqlite3_step(st);
-    sqlite3_finalize(st);
+    int rc = stmt_step(st);
+    stmt_done(st);
 
     return rc == SQLITE_DONE ? 1 : 0;
 }
 
+int db_invite_member(int project_id, int user_id) {
+    WriteOp op = { .fn = invite_member_op, .i = { project_id, user_id } };
+    return db_write(&op);
+}
+
 /* =====================================
             PERMISSIONS / HELPERS
 ===================================== */
 
 int db_is_project_owner(int project_id, int user_id) {
-    sqlite3_stmt *st;
-    sqlite3_prepare_v2(db,
-        "SELECT 1 FROM projects WHERE id=? AND owner_id=?",
-        -1, &st, NULL);
+    sqlite3_stmt *st = stmt_get(STMT_IS_OWNER);
+    if (!st) return 0;
     sqlite3_bind_int(st, 1, project_id);
     sqlite3_bind_int(st, 2, user_id);
-    int rc = sqlite3_step(st);
-    sqlite3_finalize(st);
+    int rc = stmt_step(st);
+    stmt_done(st);
     return rc == SQLITE_ROW;
 }
 
 int db_is_project_member(int project_id, int user_id) {
-    sqlite3_stmt *st;
-    sqlite3_prepare_v2(db,
-        "SELECT 1 FROM project_members WHERE project_id=? AND user_id=?",
-        -1, &st, NULL);
+    sqlite3_stmt *st = stmt_get(STMT_IS_MEMBER);
+    if (!st) return 0;
     sqlite3_bind_int(st, 1, project_id);
     sqlite3_bind_int(st, 2, user_id);
-    int rc = sqlite3_step(st);
-    sqlite3_finalize(st);
+    int rc = stmt_step(st);
+    stmt_done(st);
     return rc == SQLITE_ROW;
 }
 
 int db_get_task_project_id(int task_id, int *project_id) {
-    sqlite3_stmt *st;
-    sqlite3_prepare_v2(db,
-        "SELECT project_id FROM tasks WHERE id=?",
-        -1, &st, NULL);
+    sqlite3_stmt *st = stmt_get(STMT_TASK_PROJECT);
+    if (!st) return 0;
     sqlite3_bind_int(st, 1, task_id);
-    int rc = sqlite3_step(st);
-    if (rc == SQLITE_ROW) {
-        *project_id = sqlite3_column_int(st, 0);
-        sqlite3_finalize(st);
-        return 1;
-    }
-    sqlite3_finalize(st);
-    return 0;
+    int rc = stmt_step(st);
+    if (rc == SQLITE_ROW) *project_id = sqlite3_column_int(st, 0);
+    stmt_done(st);
+    return rc == SQLITE_ROW;
 }
 
 int db_get_task_assignee_id(int task_id, int *assignee_id) {
-    sqlite3_stmt *st;
-    sqlite3_prepare_v2(db,
-        "SELECT assignee_id FROM tasks WHERE id=?",
-        -1, &st, NULL);
+    sqlite3_stmt *st = stmt_get(STMT_TASK_ASSIGNEE);
+    if (!st) return 0;
     sqlite3_bind_int(st, 1, task_id);
-    int rc = sqlite3_step(st);
-    if (rc == SQLITE_ROW) {
-        *assignee_id = sqlite3_column_int(st, 0);
-        sqlite3_finalize(st);
-        return 1;
-    }
-    sqlite3_finalize(st);
-    return 0;
+    int rc = stmt_step(st);
+    if (rc == SQLITE_ROW) *assignee_id = sqlite3_column_int(st, 0);
+    stmt_done(st);
+    return rc == SQLITE_ROW;
 }
 
 /* =====================================
             TASK FUNCTIONS
 ===================================== */
 
-int db_create_task_full(int project_id, const char *title, const char *desc,
-                        int assignee_id, const char *start_date, const char *end_date,
-                        int *task_id) {
-    sqlite3_stmt *st;
-    sqlite3_prepare_v2(db,
-        "INSERT INTO tasks(project_id, title, description, assignee_id, start_date, end_date) "
-        "VALUES (?, ?, ?, ?, ?, ?)",
-        -1, &st, NULL);
+static int create_task_full_op(WriteOp *op) {
+    int project_id = op->i[0];
+    const char *title = op->s[0];
+    const char *desc = op->s[1];
+    int assignee_id = op->i[1];
+    const char *start_date = op->s[2];
+    const char *end_date = op->s[3];
+    int *task_id = op->out;
+
+    sqlite3_stmt *st = stmt_get(STMT_CREATE_TASK_FULL);
+    if (!st) return 0;
     sqlite3_bind_int(st, 1, project_id);
     sqlite3_bind_text(st, 2, title, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(st, 3, desc ? desc : "", -1, SQLITE_TRANSIENT);
@@ -353,60 +1105,60 @@ int db_create_task_full(int project_id, const char *title, const char *desc,
     sqlite3_bind_text(st, 5, start_date, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(st, 6, end_date, -1, SQLITE_TRANSIENT);
 
-    if (sqlite3_step(st) != SQLITE_DONE) {
-        sqlite3_finalize(st);
+    if (stmt_step(st) != SQLITE_DONE) {
+        stmt_done(st);
         return 0;
     }
-    *task_id = sqlite3_last_insert_rowid(db);
-    sqlite3_finalize(st);
+    *task_id = sqlite3_last_insert_rowid(stmt_conn());
+    stmt_done(st);
     return 1;
 }
 
-/* =====================================
-            TASK FUNCTIONS
-===================================== */
-
-int db_create_task(int project_id, const char *title, const char *desc, int *task_id) {
+int db_create_task_full(int project_id, const char *title, const char *desc,
+                        int assignee_id, const char *start_date, const char *end_date,
+                        int *task_id) {
+    WriteOp op = { .fn = create_task_full_op, .i = { project_id, assignee_id }, .s = { title, desc, start_date, end_date }, .out = task_id };
+    return db_write(&op);
+}
 
-    sqlite3_stmt *st;
+static int create_task_op(WriteOp *op) {
+    int project_id = op->i[0];
+    const char *title = op->s[0];
+    const char *desc = op->s[1];
+    int *task_id = op->out;
 
-    sqlite3_prepare_v2(db,
-        "INSERT INTO tasks(project_id, title, description) VALUES (?, ?, ?)",
-        -1, &st, NULL);
+    sqlite3_stmt *st = stmt_get(STMT_CREATE_TASK);
+    if (!st) return 0;
 
     sqlite3_bind_int(st, 1, project_id);
     sqlite3_bind_text(st, 2, title, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(st, 3, desc, -1, SQLITE_TRANSIENT);
 
-    if (sqlite3_step(st) != SQLITE_DONE) {
-        sqlite3_finalize(st);
+    if (stmt_step(st) != SQLITE_DONE) {
+        stmt_done(st);
         return 0;
     }
 
-    *task_id = sqlite3_last_insert_rowid(db);
-    sqlite3_finalize(st);
+    *task_id = sqlite3_last_insert_rowid(stmt_conn());
+    stmt_done(st);
 
     return 1;
 }
 
-int db_list_tasks_in_project(int project_id, char *out, int out_size) {
-    sqlite3_stmt *stmt;
-    const char *sql =
-        "SELECT t.id, t.title, IFNULL(u.username, 'None') AS assignee, "
-        "IFNULL(t.status,'NOT_STARTED') AS status, IFNULL(t.progress,0) AS progress, IFNULL(t.start_date,''), IFNULL(t.end_date,'') "
-        "FROM tasks t "
-        "LEFT JOIN users u ON t.assignee_id = u.id "
-        "WHERE t.project_id = ?;";
+int db_create_task(int project_id, const char *title, const char *desc, int *task_id) {
+    WriteOp op = { .fn = create_task_op, .i = { project_id }, .s = { title, desc }, .out = task_id };
+    return db_write(&op);
+}
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        return 0;
+int db_list_tasks_in_project(int project_id, Buf *out) {
+    sqlite3_stmt *stmt = stmt_get(STMT_LIST_TASKS);
+    if (!stmt)
+        return -1;
 
     sqlite3_bind_int(stmt, 1, project_id);
 
-    char buf[512];
-    out[0] = '\0';
-
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
+    int rows = 0;
+    while (stmt_step(stmt) == SQLITE_ROW) {
         int id = sqlite3_column_int(stmt, 0);
         const unsigned char *title = sqlite3_column_text(stmt, 1);
         const unsigned char *assignee = sqlite3_column_text(stmt, 2);
@@ -415,231 +1167,306 @@ int db_list_tasks_in_project(int project_id, char *out, int out_size) {
         const unsigned char *start_date = sqlite3_column_text(stmt, 5);
         const unsigned char *end_date = sqlite3_column_text(stmt, 6);
 
-        snprintf(buf, sizeof(buf),
-                 "%d|%s|Assignee:%s|Status:%s|Progress:%d|Start:%s|End:%s\n",
-                 id,
-                 title ? (char *)title : "(null)",
-                 assignee ? (char *)assignee : "None",
-                 status ? (char *)status : "NOT_STARTED",
-                 progress,
-                 start_date ? (char *)start_date : "",
-                 end_date ? (char *)end_date : "");
-
-        strncat(out, buf, out_size - strlen(out) - 1);
+        buf_row(out, 7);
+        buf_col_int(out, NULL, id);
+        buf_col_str(out, NULL, title ? (char *)title : "(null)");
+        buf_col_str(out, "Assignee:", assignee ? (char *)assignee : "None");
+        buf_col_str(out, "Status:", status ? (char *)status : "NOT_STARTED");
+        buf_col_int(out, "Progress:", progress);
+        buf_col_str(out, "Start:", start_date ? (char *)start_date : "");
+        buf_col_str(out, "End:", end_date ? (char *)end_date : "");
+        buf_row_end(out);
+        rows++;
     }
 
-    sqlite3_finalize(stmt);
-    return 1;
+    stmt_done(stmt);
+    return rows;
 }
 
 /* =====================================
         EXTENDED FEATURES
 ===================================== */
 
-int db_update_task_status(int task_id, const char *status) {
-    sqlite3_stmt *stmt;
-    const char *sql = "UPDATE tasks SET status = ? WHERE id = ?";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return 0;
+static int update_status_op(WriteOp *op) {
+    int task_id = op->i[0];
+    const char *status = op->s[0];
+
+    sqlite3_stmt *stmt = stmt_get(STMT_UPDATE_STATUS);
+    if (!stmt) return 0;
     sqlite3_bind_text(stmt, 1, status, -1, SQLITE_TRANSIENT);
     sqlite3_bind_int(stmt, 2, task_id);
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    int rc = stmt_step(stmt);
+    stmt_done(stmt);
     return rc == SQLITE_DONE;
 }
 
-int db_update_task_progress(int task_id, int progress) {
+int db_update_task_status(int task_id, const char *status) {
+    WriteOp op = { .fn = update_status_op, .i = { task_id }, .s = { status } };
+    return db_write(&op);
+}
+
+static int update_progress_op(WriteOp *op) {
+    int task_id = op->i[0];
+    int progress = op->i[1];
+
     // Keep backward compatibility with existing "status" column.
     // We derive status from progress so UI can keep using the old status combo if needed.
     const char *status = "NOT_STARTED";
     if (progress >= 100) status = "DONE";
     else if (progress > 0) status = "IN_PROGRESS";
 
-    sqlite3_stmt *stmt;
-    const char *sql = "UPDATE tasks SET progress = ?, status = ? WHERE id = ?";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return 0;
+    sqlite3_stmt *stmt = stmt_get(STMT_UPDATE_PROGRESS);
+    if (!stmt) return 0;
     sqlite3_bind_int(stmt, 1, progress);
-    sqlite3_bind_text(stmt, 2, status, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, status, -1, SQLITE_STATIC);
     sqlite3_bind_int(stmt, 3, task_id);
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    int rc = stmt_step(stmt);
+    stmt_done(stmt);
     return rc == SQLITE_DONE;
 }
 
-int db_set_task_dates(int task_id, const char *start_date, const char *end_date) {
-    sqlite3_stmt *stmt;
-    const char *sql = "UPDATE tasks SET start_date = ?, end_date = ? WHERE id = ?";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return 0;
+int db_update_task_progress(int task_id, int progress) {
+    WriteOp op = { .fn = update_progress_op, .i = { task_id, progress } };
+    return db_write(&op);
+}
+
+static int set_dates_op(WriteOp *op) {
+    int task_id = op->i[0];
+    const char *start_date = op->s[0];
+    const char *end_date = op->s[1];
+
+    sqlite3_stmt *stmt = stmt_get(STMT_SET_DATES);
+    if (!stmt) return 0;
     sqlite3_bind_text(stmt, 1, start_date, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 2, end_date, -1, SQLITE_TRANSIENT);
     sqlite3_bind_int(stmt, 3, task_id);
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    int rc = stmt_step(stmt);
+    stmt_done(stmt);
     return rc == SQLITE_DONE;
 }
 
-int db_get_task_detail(int task_id, char *out, int out_size) {
-    sqlite3_stmt *stmt;
-    const char *sql =
-        "SELECT t.id, t.project_id, t.title, t.description, IFNULL(u.username,'None'), "
-        "IFNULL(t.status,'NOT_STARTED'), IFNULL(t.progress,0), IFNULL(t.start_date,''), IFNULL(t.end_date,'') "
-        "FROM tasks t LEFT JOIN users u ON t.assignee_id = u.id WHERE t.id = ?;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return 0;
+int db_set_task_dates(int task_id, const char *start_date, const char *end_date) {
+    WriteOp op = { .fn = set_dates_op, .i = { task_id }, .s = { start_date, end_date } };
+    return db_write(&op);
+}
+
+int db_get_task_detail(int task_id, Buf *out) {
+    sqlite3_stmt *stmt = stmt_get(STMT_TASK_DETAIL);
+    if (!stmt) return -1;
     sqlite3_bind_int(stmt, 1, task_id);
-    if (sqlite3_step(stmt) != SQLITE_ROW) { sqlite3_finalize(stmt); return 0; }
-    snprintf(out, out_size, "%d|%d|%s|%s|Assignee:%s|Status:%s|Progress:%d|Start:%s|End:%s\n",
-        sqlite3_column_int(stmt,0),
-        sqlite3_column_int(stmt,1),
-        (const char*)sqlite3_column_text(stmt,2),
-        (const char*)sqlite3_column_text(stmt,3),
-        (const char*)sqlite3_column_text(stmt,4),
-        (const char*)sqlite3_column_text(stmt,5),
-        sqlite3_column_int(stmt,6),
-        (const char*)sqlite3_column_text(stmt,7),
-        (const char*)sqlite3_column_text(stmt,8));
-    sqlite3_finalize(stmt);
+    if (stmt_step(stmt) != SQLITE_ROW) { stmt_done(stmt); return 0; }
+    buf_row(out, 9);
+    buf_col_int(out, NULL, sqlite3_column_int(stmt,0));
+    buf_col_int(out, NULL, sqlite3_column_int(stmt,1));
+    buf_col_str(out, NULL, (const char*)sqlite3_column_text(stmt,2));
+    buf_col_str(out, NULL, (const char*)sqlite3_column_text(stmt,3));
+    buf_col_str(out, "Assignee:", (const char*)sqlite3_column_text(stmt,4));
+    buf_col_str(out, "Status:", (const char*)sqlite3_column_text(stmt,5));
+    buf_col_int(out, "Progress:", sqlite3_column_int(stmt,6));
+    buf_col_str(out, "Start:", (const char*)sqlite3_column_text(stmt,7));
+    buf_col_str(out, "End:", (const char*)sqlite3_column_text(stmt,8));
+    buf_row_end(out);
+    stmt_done(stmt);
     return 1;
 }
 
-int db_list_tasks_gantt(int project_id, char *out, int out_size) {
+int db_list_tasks_gantt(int project_id, Buf *out) {
     // Same as list_tasks but optimized for Gantt rendering.
-    sqlite3_stmt *stmt;
-    const char *sql =
-        "SELECT t.id, t.title, IFNULL(t.status,'NOT_STARTED'), IFNULL(t.progress,0), IFNULL(t.start_date,''), IFNULL(t.end_date,''), IFNULL(u.username,'None') "
-        "FROM tasks t LEFT JOIN users u ON t.assignee_id = u.id WHERE t.project_id = ?;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return 0;
+    sqlite3_stmt *stmt = stmt_get(STMT_LIST_GANTT);
+    if (!stmt) return -1;
     sqlite3_bind_int(stmt, 1, project_id);
-    out[0] = '\0';
-    char buf[512];
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        snprintf(buf, sizeof(buf), "%d|%s|Status:%s|Progress:%d|Start:%s|End:%s|Assignee:%s\n",
-            sqlite3_column_int(stmt,0),
-            (const char*)sqlite3_column_text(stmt,1),
-            (const char*)sqlite3_column_text(stmt,2),
-            sqlite3_column_int(stmt,3),
-            (const char*)sqlite3_column_text(stmt,4),
-            (const char*)sqlite3_column_text(stmt,5),
-            (const char*)sqlite3_column_text(stmt,6));
-        strncat(out, buf, out_size - strlen(out) - 1);
+    int rows = 0;
+    while (stmt_step(stmt) == SQLITE_ROW) {
+        buf_row(out, 7);
+        buf_col_int(out, NULL, sqlite3_column_int(stmt,0));
+        buf_col_str(out, NULL, (const char*)sqlite3_column_text(stmt,1));
+        buf_col_str(out, "Status:", (const char*)sqlite3_column_text(stmt,2));
+        buf_col_int(out, "Progress:", sqlite3_column_int(stmt,3));
+        buf_col_str(out, "Start:", (const char*)sqlite3_column_text(stmt,4));
+        buf_col_str(out, "End:", (const char*)sqlite3_column_text(stmt,5));
+        buf_col_str(out, "Assignee:", (const char*)sqlite3_column_text(stmt,6));
+        buf_row_end(out);
+        rows++;
     }
-    sqlite3_finalize(stmt);
-    return 1;
+    stmt_done(stmt);
+    return rows;
 }
 
-int db_add_comment(int task_id, int user_id, const char *content) {
-    sqlite3_stmt *stmt;
-    const char *sql = "INSERT INTO task_comments(task_id,user_id,content) VALUES(?,?,?)";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return 0;
+static int add_comment_op(WriteOp *op) {
+    int task_id = op->i[0];
+    int user_id = op->i[1];
+    const char *content = op->s[0];
+
+    sqlite3_stmt *stmt = stmt_get(STMT_ADD_COMMENT);
+    if (!stmt) return 0;
     sqlite3_bind_int(stmt, 1, task_id);
     sqlite3_bind_int(stmt, 2, user_id);
     sqlite3_bind_text(stmt, 3, content, -1, SQLITE_TRANSIENT);
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    int rc = stmt_step(stmt);
+    stmt_done(stmt);
     return rc == SQLITE_DONE;
 }
 
-int db_list_comments(int task_id, char *out, int out_size) {
-    sqlite3_stmt *stmt;
-    const char *sql =
-        "SELECT c.id, IFNULL(u.username,'?'), c.content, c.created_at "
-        "FROM task_comments c LEFT JOIN users u ON c.user_id = u.id "
-        "WHERE c.task_id = ? ORDER BY c.id ASC;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return 0;
+int db_add_comment(int task_id, int user_id, const char *content) {
+    WriteOp op = { .fn = add_comment_op, .i = { task_id, user_id }, .s = { content } };
+    return db_write(&op);
+}
+
+int db_list_comments(int task_id, Buf *out) {
+    sqlite3_stmt *stmt = stmt_get(STMT_LIST_COMMENTS);
+    if (!stmt) return -1;
     sqlite3_bind_int(stmt, 1, task_id);
-    out[0] = '\0';
-    char buf[768];
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        snprintf(buf, sizeof(buf), "%d|%s|%s|%s\n",
-            sqlite3_column_int(stmt,0),
-            (const char*)sqlite3_column_text(stmt,1),
-            (const char*)sqlite3_column_text(stmt,2),
-            (const char*)sqlite3_column_text(stmt,3));
-        strncat(out, buf, out_size - strlen(out) - 1);
+    int rows = 0;
+    while (stmt_step(stmt) == SQLITE_ROW) {
+        buf_row(out, 4);
+        buf_col_int(out, NULL, sqlite3_column_int(stmt,0));
+        buf_col_str(out, NULL, (const char*)sqlite3_column_text(stmt,1));
+        buf_col_str(out, NULL, (const char*)sqlite3_column_text(stmt,2));
+        buf_col_str(out, NULL, (const char*)sqlite3_column_text(stmt,3));
+        buf_row_end(out);
+        rows++;
     }
-    sqlite3_finalize(stmt);
-    return 1;
+    stmt_done(stmt);
+    return rows;
 }
 
-int db_add_attachment(int task_id, const char *filename, const char *filepath) {
-    sqlite3_stmt *stmt;
-    const char *sql = "INSERT INTO task_attachments(task_id,filename,filepath) VALUES(?,?,?)";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return 0;
+static int add_attachment_op(WriteOp *op) {
+    int task_id = op->i[0];
+    const char *filename = op->s[0];
+    const char *filepath = op->s[1];
+
+    sqlite3_stmt *stmt = stmt_get(STMT_ADD_ATTACHMENT);
+    if (!stmt) return 0;
     sqlite3_bind_int(stmt, 1, task_id);
     sqlite3_bind_text(stmt, 2, filename, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 3, filepath, -1, SQLITE_TRANSIENT);
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    int rc = stmt_step(stmt);
+    stmt_done(stmt);
     return rc == SQLITE_DONE;
 }
 
-int db_list_attachments(int task_id, char *out, int out_size) {
-    sqlite3_stmt *stmt;
-    const char *sql =
-        "SELECT a.id, a.filename, a.filepath, a.created_at FROM task_attachments a "
-        "WHERE a.task_id = ? ORDER BY a.id ASC;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return 0;
+int db_add_attachment(int task_id, const char *filename, const char *filepath) {
+    WriteOp op = { .fn = add_attachment_op, .i = { task_id }, .s = { filename, filepath } };
+    return db_write(&op);
+}
+
+int db_list_attachments(int task_id, Buf *out) {
+    sqlite3_stmt *stmt = stmt_get(STMT_LIST_ATTACHMENTS);
+    if (!stmt) return -1;
     sqlite3_bind_int(stmt, 1, task_id);
-    out[0] = '\0';
-    char buf[768];
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        snprintf(buf, sizeof(buf), "%d|%s|%s|%s\n",
-            sqlite3_column_int(stmt,0),
-            (const char*)sqlite3_column_text(stmt,1),
-            (const char*)sqlite3_column_text(stmt,2),
-            (const char*)sqlite3_column_text(stmt,3));
-        strncat(out, buf, out_size - strlen(out) - 1);
+    int rows = 0;
+    while (stmt_step(stmt) == SQLITE_ROW) {
+        buf_row(out, 4);
+        buf_col_int(out, NULL, sqlite3_column_int(stmt,0));
+        buf_col_str(out, NULL, (const char*)sqlite3_column_text(stmt,1));
+        buf_col_str(out, NULL, (const char*)sqlite3_column_text(stmt,2));
+        buf_col_str(out, NULL, (const char*)sqlite3_column_text(stmt,3));
+        buf_row_end(out);
+        rows++;
     }
-    sqlite3_finalize(stmt);
-    return 1;
+    stmt_done(stmt);
+    return rows;
 }
 
-int db_add_chat(int project_id, int user_id, const char *content) {
-    sqlite3_stmt *stmt;
-    const char *sql = "INSERT INTO project_chat(project_id,user_id,content) VALUES(?,?,?)";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return 0;
+static int add_chat_op(WriteOp *op) {
+    int project_id = op->i[0];
+    int user_id = op->i[1];
+    const char *content = op->s[0];
+    ChatPosted *posted = op->out;
+
+    sqlite3_stmt *stmt = stmt_get(STMT_ADD_CHAT);
+    if (!stmt) return 0;
     sqlite3_bind_int(stmt, 1, project_id);
     sqlite3_bind_int(stmt, 2, user_id);
     sqlite3_bind_text(stmt, 3, content, -1, SQLITE_TRANSIENT);
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+
+    // the row comes back from RETURNING; stepping on to DONE finishes the insert
+    int rc = stmt_step(stmt);
+    if (rc == SQLITE_ROW && posted) {
+        const char *at = (const char*)sqlite3_column_text(stmt, 1);
+        const char *name = (const char*)sqlite3_column_text(stmt, 2);
+        posted->id = sqlite3_column_int(stmt, 0);
+        snprintf(posted->created_at, sizeof(posted->created_at), "%s", at ? at : "");
+        snprintf(posted->username, sizeof(posted->username), "%s", name ? name : "?");
+    }
+    if (rc == SQLITE_ROW) rc = stmt_step(stmt);
+    stmt_done(stmt);
     return rc == SQLITE_DONE;
 }
 
-int db_list_chat(int project_id, int after_id, char *out, int out_size) {
-    sqlite3_stmt *stmt;
-    const char *sql =
-        "SELECT c.id, IFNULL(u.username,'?'), c.content, c.created_at "
-        "FROM project_chat c LEFT JOIN users u ON c.user_id = u.id "
-        "WHERE c.project_id = ? AND c.id > ? ORDER BY c.id ASC;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return 0;
+static db_chat_hook chat_hook = NULL;
+
+void db_set_chat_hook(db_chat_hook fn) {
+    chat_hook = fn;
+}
+
+static void add_chat_committed(WriteOp *op) {
+    if (chat_hook) chat_hook(op->i[0], op->out, op->s[0]);
+}
+
+int db_add_chat(int project_id, int user_id, const char *content, ChatPosted *posted) {
+    ChatPosted local;
+    WriteOp op = { .fn = add_chat_op, .committed = add_chat_committed,
+                   .i = { project_id, user_id }, .s = { content },
+                   .out = posted ? posted : &local };
+    return db_write(&op);
+}
+
+int db_recent_chat(int project_id, int limit, db_chat_row_fn fn, void *ctx) {
+    sqlite3_stmt *stmt = stmt_get(STMT_RECENT_CHAT);
+    if (!stmt) return -1;
+    sqlite3_bind_int(stmt, 1, project_id);
+    sqlite3_bind_int(stmt, 2, limit);
+    int rows = 0;
+    while (stmt_step(stmt) == SQLITE_ROW) {
+        fn(ctx, sqlite3_column_int(stmt,0),
+           (const char*)sqlite3_column_text(stmt,1),
+           (const char*)sqlite3_column_text(stmt,2),
+           (const char*)sqlite3_column_text(stmt,3));
+        rows++;
+    }
+    stmt_done(stmt);
+    return rows;
+}
+
+int db_list_chat(int project_id, int after_id, Buf *out) {
+    sqlite3_stmt *stmt = stmt_get(STMT_LIST_CHAT);
+    if (!stmt) return -1;
     sqlite3_bind_int(stmt, 1, project_id);
     sqlite3_bind_int(stmt, 2, after_id);
-    out[0] = '\0';
-    char buf[768];
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        snprintf(buf, sizeof(buf), "%d|%s|%s|%s\n",
-            sqlite3_column_int(stmt,0),
-            (const char*)sqlite3_column_text(stmt,1),
-            (const char*)sqlite3_column_text(stmt,2),
-            (const char*)sqlite3_column_text(stmt,3));
-        strncat(out, buf, out_size - strlen(out) - 1);
+    int rows = 0;
+    while (stmt_step(stmt) == SQLITE_ROW) {
+        buf_row(out, 4);
+        buf_col_int(out, NULL, sqlite3_column_int(stmt,0));
+        buf_col_str(out, NULL, (const char*)sqlite3_column_text(stmt,1));
+        buf_col_str(out, NULL, (const char*)sqlite3_column_text(stmt,2));
+        buf_col_str(out, NULL, (const char*)sqlite3_column_text(stmt,3));
+        buf_row_end(out);
+        rows++;
     }
-    sqlite3_finalize(stmt);
-    return 1;
+    stmt_done(stmt);
+    return rows;
 }
 
 
-int db_assign_task(int task_id, int user_id) {
-    sqlite3_stmt *stmt;
-    const char *sql = "UPDATE tasks SET assignee_id = ? WHERE id = ?";
-    
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+static int assign_task_op(WriteOp *op) {
+    int task_id = op->i[0];
+    int user_id = op->i[1];
+
+    sqlite3_stmt *stmt = stmt_get(STMT_ASSIGN_TASK);
+    if (!stmt)
         return 0;
 
     sqlite3_bind_int(stmt, 1, user_id);
     sqlite3_bind_int(stmt, 2, task_id);
 
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    int rc = stmt_step(stmt);
+    stmt_done(stmt);
 
     return rc == SQLITE_DONE;
 }
+
+int db_assign_task(int task_id, int user_id) {
+    WriteOp op = { .fn = assign_task_op, .i = { task_id, user_id } };
+    return db_write(&op);
+}
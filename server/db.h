@@ -3,18 +3,37 @@
 
 #include <sqlite3.h>
 #include "common.h"
+#include "buf.h"
 
 extern sqlite3 *db;
 
 int db_init(const char *path);
 void db_close();
 
+// Prepared statement cache counters (per-thread caches, process-wide totals).
+void db_stmt_cache_stats(unsigned long long *hits, unsigned long long *misses);
+
+// Group commit counters: committed write batches and the ops they carried.
+void db_write_stats(unsigned long long *batches, unsigned long long *ops);
+
+// Every cached statement is profiled through sqlite3_trace_v2. A run that
+// takes ms or longer is logged with its bound values (passwords left out);
+// 0 turns the slow-query log off. Default DB_SLOW_QUERY_MS.
+void db_set_slow_query_ms(int ms);
+
+// Append one row per statement run so far: name, calls, average and max
+// time (microseconds), result rows, VM steps, full-scan steps, sorts and
+// slow runs, all summed over every connection. Returns the row count.
+int db_profile_stats(Buf *out);
+
 int db_register_user(const char *username, const char *password);
 int db_auth_user(const char *username, const char *password, int *user_id);
 int db_get_user_id(const char *username, int *user_id);
 
 int db_create_project(const char *name, int owner_id, int *project_id);
-int db_list_projects_for_user(int user_id, char *out, int out_size);
+// List functions append one line per row to out and return the row count,
+// or -1 if the query could not run.
+int db_list_projects_for_user(int user_id, Buf *out);
 // return: 1=ok, -1=already member, 0=fail
 int db_invite_member(int project_id, int user_id);
 
@@ -30,23 +49,42 @@ int db_create_task_full(int project_id, const char *title, const char *desc,
                         int *task_id);
 
 int db_create_task(int project_id, const char *title, const char *desc, int *task_id);
-int db_list_tasks_in_project(int project_id, char *out, int out_size);
+int db_list_tasks_in_project(int project_id, Buf *out);
 int db_assign_task(int task_id, int user_id);
 
 // Extended features
 int db_update_task_status(int task_id, const char *status);
 int db_update_task_progress(int task_id, int progress);
 int db_set_task_dates(int task_id, const char *start_date, const char *end_date);
-int db_get_task_detail(int task_id, char *out, int out_size);
-int db_list_tasks_gantt(int project_id, char *out, int out_size);
+int db_get_task_detail(int task_id, Buf *out);
+int db_list_tasks_gantt(int project_id, Buf *out);
 
 int db_add_comment(int task_id, int user_id, const char *content);
-int db_list_comments(int task_id, char *out, int out_size);
+int db_list_comments(int task_id, Buf *out);
 
 int db_add_attachment(int task_id, const char *filename, const char *filepath);
-int db_list_attachments(int task_id, char *out, int out_size);
+int db_list_attachments(int task_id, Buf *out);
+
+// What db_add_chat stored, for pushing to chat subscribers.
+typedef struct {
+    int id;
+    char username[64];
+    char created_at[32];
+} ChatPosted;
+
+// posted may be NULL.
+int db_add_chat(int project_id, int user_id, const char *content, ChatPosted *posted);
+int db_list_chat(int project_id, int after_id, Buf *out);
+
+// Called on the writer thread for every chat message right after its
+// transaction commits, in commit (and so id) order.
+typedef void (*db_chat_hook)(int project_id, const ChatPosted *posted, const char *content);
+void db_set_chat_hook(db_chat_hook fn);
 
-int db_add_chat(int project_id, int user_id, const char *content);
-int db_list_chat(int project_id, int after_id, char *out, int out_size);
+// The latest limit messages of a project, newest first. Returns the row
+// count, or -1 if the query could not run.
+typedef void (*db_chat_row_fn)(void *ctx, int id, const char *username,
+                               const char *content, const char *created_at);
+int db_recent_chat(int project_id, int limit, db_chat_row_fn fn, void *ctx);
 
 #endif
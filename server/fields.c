@@ -0,0 +1,77 @@
+#include "fields.h"
+#include "protocol.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int split_fields(char *line, size_t len, Field *out, int max) {
+    if (max <= 0) return 0;
+
+    int n = 0;
+    char *p = line;
+    char *end = line + len;
+    while (1) {
+        char *sep = (n + 1 < max) ? memchr(p, '|', (size_t)(end - p)) : NULL;
+        out[n].p = p;
+        out[n].len = (size_t)((sep ? sep : end) - p);
+        n++;
+        if (!sep) break;
+        *sep = '\0';
+        p = sep + 1;
+    }
+    *end = '\0';
+    return n;
+}
+
+int fields_ok(const Field *f, int nf, int n) {
+    if (nf < n) return 0;
+    for (int i = 1; i < n; i++)
+        if (f[i].len == 0) return 0;
+    return 1;
+}
+
+static unsigned get_u32(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return (unsigned)u[0] << 24 | (unsigned)u[1] << 16 | (unsigned)u[2] << 8 | u[3];
+}
+
+int split_frame(const char *p, size_t len, Buf *store, Field *out, int max) {
+    size_t offs[MAX_FIELDS];
+    size_t pos = 0;
+    int n = 0;
+
+    buf_reset(store);
+    while (pos < len) {
+        if (n == max || n == MAX_FIELDS) return -1;
+
+        unsigned type = (unsigned char)p[pos++];
+        offs[n] = store->len;
+        if (type == WIRE_STR) {
+            if (len - pos < 4) return -1;
+            size_t sl = get_u32(p + pos);
+            pos += 4;
+            if (sl > len - pos) return -1;
+            buf_append(store, p + pos, sl);
+            out[n].len = sl;
+            pos += sl;
+        } else if (type == WIRE_INT) {
+            if (len - pos < 4) return -1;
+            char num[16];
+            int nl = snprintf(num, sizeof(num), "%d", (int)get_u32(p + pos));
+            buf_append(store, num, (size_t)nl);
+            out[n].len = (size_t)nl;
+            pos += 4;
+        } else if (type == WIRE_NULL) {
+            out[n].len = 0;
+        } else {
+            return -1;  // rows are response-only
+        }
+        buf_append(store, "", 1);
+        n++;
+    }
+
+    // store may have moved while growing; point into it only now
+    for (int i = 0; i < n; i++)
+        out[i].p = store->data + offs[i];
+    return n;
+}
@@ -0,0 +1,30 @@
+#ifndef FIELDS_H
+#define FIELDS_H
+
+#include <stddef.h>
+#include "buf.h"
+
+#define MAX_FIELDS 16
+
+// One '|'-separated field of a request. p points into the request buffer
+// and is NUL-terminated in place, so it can also be used as a C string.
+typedef struct {
+    char *p;
+    size_t len;
+} Field;
+
+// Split line[0..len) on '|' in place (line[len] must be writable). Reentrant and allocation-free; empty
+// fields are kept. At most max fields are produced, the last one taking the
+// rest of the line. Returns the number of fields.
+int split_fields(char *line, size_t len, Field *out, int max);
+
+// Decode the typed fields of a binary request frame (the bytes after its
+// header). Values are copied into store as NUL-terminated strings, integers
+// in decimal, so handlers see the same Fields as for a text request. Returns
+// the number of fields, or -1 if the frame is malformed or has more than max.
+int split_frame(const char *p, size_t len, Buf *store, Field *out, int max);
+
+// 1 if fields [1, n) are all present and non-empty (field 0 is the command).
+int fields_ok(const Field *f, int nf, int n);
+
+#endif
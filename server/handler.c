@@ -1,21 +1,124 @@
 #include "handler.h"
+#include "reactor.h"
+#include "fields.h"
 #include "protocol.h"
 #include "db.h"
 #include "log.h"
 #include "common.h"
+#include "buf.h"
+#include "chat.h"
+#include "stats.h"
 
-#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>
 #include <stdlib.h>
-#include <sys/socket.h>
+#include <time.h>
+
+/* ==========================
+          RESPONSES
+========================== */
+
+// Per-worker response buffer, reused across requests. Once it passes
+// RESPONSE_CHUNK bytes it is pushed to the connection, so long lists stream
+// out without being held in memory whole. In binary mode every push is one
+// frame; the header space is reserved at the front of the buffer.
+static __thread Buf resp;
+
+typedef struct {
+    ClientInfo *ci;
+    unsigned req_id;    // echoed back; 0 if the text request had none
+    int code;
+    int last;           // next flush ends the response
+    int log_level;      // of the request being answered (log.h)
+    int failed;         // a non-zero code was sent
+    unsigned long send_ns;  // spent in conn_write
+} RespCtx;
+
+static __thread RespCtx resp_ctx;
+
+static void put_u32(char *p, unsigned v) {
+    p[0] = (char)(v >> 24);
+    p[1] = (char)(v >> 16);
+    p[2] = (char)(v >> 8);
+    p[3] = (char)v;
+}
+
+static unsigned long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+static void resp_flush(void *ctx, char *data, size_t len) {
+    RespCtx *rc = (RespCtx *)ctx;
+    unsigned long t0 = now_ns();
+    if (rc->ci->binary) {
+        put_u32(data, (unsigned)(len - 4));
+        put_u32(data + 4, rc->req_id);
+        data[8] = (char)rc->code;
+        data[9] = rc->last ? 0 : WIRE_MORE;
+    }
+    conn_write(rc->ci, data, len);
+    rc->send_ns += now_ns() - t0;
+}
+
+// Start a response; append the payload to the returned buffer (text, or
+// rows via buf_row) and finish it with response_end().
+static Buf *response_begin(ClientInfo *ci, int code) {
+    buf_reset(&resp);
+    resp_ctx.ci = ci;
+    resp_ctx.code = code;
+    resp_ctx.last = 0;
+    if (code) resp_ctx.failed = 1;
+    buf_stream(&resp, resp_flush, &resp_ctx, RESPONSE_CHUNK);
+    if (ci->binary) {
+        resp.binary = 1;
+        buf_reserve_head(&resp, WIRE_HEADER);
+    } else if (resp_ctx.req_id) {
+        buf_printf(&resp, "#%u|%d|", resp_ctx.req_id, code);
+    } else {
+        buf_printf(&resp, "%d|", code);
+    }
+    return &resp;
+}
 
-static void send_response(int sockfd, int code, const char *msg) {
-    char buf[BUF_SIZE];
-    snprintf(buf, sizeof(buf), "%d|%s\n", code, msg);
-    send(sockfd, buf, strlen(buf), 0);
-    log_message("SEND", buf);
+// DEBUG notes the status and size; TRACE shows a text payload, if it is
+// still all in the buffer.
+static void log_response(Buf *b) {
+    if (resp_ctx.log_level < LOG_DEBUG) return;
+    if (resp_ctx.log_level >= LOG_TRACE && !b->binary && b->flushed == 0) {
+        log_payload("SEND", b->data, b->len);
+        return;
+    }
+    char note[64];
+    snprintf(note, sizeof(note), "%d|(%zu bytes%s)", resp_ctx.code, b->flushed + b->len - b->head,
+             b->flushed > 0 ? " streamed" : b->binary ? " binary" : "");
+    log_message("SEND", note);
+}
+
+static void response_end(Buf *b) {
+    if (!b->binary) buf_append(b, "\n", 1);
+    log_response(b);
+
+    // the final frame goes out even when empty: it carries the status
+    resp_ctx.last = 1;
+    resp_flush(&resp_ctx, b->data, b->len);
+    b->len = b->head;
+}
+
+// Plain message: the whole payload in text mode, a single string field in
+// binary mode.
+static void send_response(ClientInfo *ci, int code, const char *msg) {
+    Buf *b = response_begin(ci, code);
+    if (b->binary) buf_put_str(b, msg, strlen(msg));
+    else buf_puts(b, msg);
+    response_end(b);
+}
+
+// Text clients get a placeholder line for an empty list; binary clients
+// just get no rows.
+static void empty_list(Buf *b, const char *msg) {
+    if (!b->binary) buf_puts(b, msg);
 }
 
 // Hàm cắt kí tự \r, \n, space ở cuối chuỗi
@@ -27,475 +130,640 @@ static void trim_trailing(char *s) {
     }
 }
 
-void *client_handler(void *arg) {
-    ClientInfo *ci = (ClientInfo *)arg;
-    char buffer[BUF_SIZE];
-
-    while (1) {
-        memset(buffer, 0, sizeof(buffer));
-        int n = recv(ci->sockfd, buffer, sizeof(buffer) - 1, 0);
-        if (n <= 0) break;
-
-        buffer[n] = '\0';
-        log_message("RECV", buffer);
+/* ==========================
+      REQUEST CONTEXT
+========================== */
+
+// What a command handler gets: the caller, the parsed fields (arity already
+// checked) and the ids resolved by the permission check.
+typedef struct {
+    ClientInfo *ci;
+    Field *f;
+    int nf;
+    int project_id;     // PERM_PROJECT_* : fields[1]; PERM_TASK_* : the task's project
+    int task_id;        // PERM_TASK_* : fields[1]
+} Request;
+
+enum {
+    PERM_NONE = 0,
+    PERM_LOGIN,             // the caller has logged in
+    PERM_PROJECT_MEMBER,    // fields[1] is a project the caller belongs to
+    PERM_PROJECT_OWNER,     // fields[1] is a project the caller owns
+    PERM_TASK_OWNER,        // fields[1] is a task in a project the caller owns
+    PERM_TASK_EDITOR        // fields[1] is a task the caller owns (project) or is assigned to
+};
+
+typedef void (*cmd_fn)(Request *r);
+
+typedef struct {
+    const char *name;
+    cmd_fn fn;
+    int arity;              // fields including the command name
+    int perm;
+    const char *deny_msg;
+} Command;
+
+/* ==========================
+           REGISTER
+========================== */
+static void cmd_register(Request *r) {
+    if (db_register_user(r->f[1].p, r->f[2].p))
+        send_response(r->ci, 0, "Register OK");
+    else
+        send_response(r->ci, 1, "Register failed");
+}
 
-        // tách command
-        char *cmd = strtok(buffer, "|");
-        if (!cmd) continue;
+/* ==========================
+            LOGIN
+========================== */
+static void cmd_login(Request *r) {
+    int uid;
+    if (db_auth_user(r->f[1].p, r->f[2].p, &uid)) {
+        r->ci->user_id = uid;
+        send_response(r->ci, 0, "Login OK");
+    } else {
+        send_response(r->ci, 1, "Login failed");
+    }
+}
 
-        trim_trailing(cmd);   // RẤT QUAN TRỌNG: bỏ \n, \r, space ở cuối
+/* ==========================
+         LIST PROJECTS
+========================== */
+static void cmd_list_project(Request *r) {
+    Buf *b = response_begin(r->ci, 0);
+    if (db_list_projects_for_user(r->ci->user_id, b) <= 0)
+        empty_list(b, "No projects");
+    response_end(b);
+}
 
-        // DEBUG: xem chính xác server đang nhận command gì
-        printf("[DEBUG] CMD = '%s'\n", cmd);
+/* ==========================
+         CREATE PROJECT
+========================== */
+static void cmd_create_project(Request *r) {
+    int project_id;
+    if (db_create_project(r->f[1].p, r->ci->user_id, &project_id))
+        send_response(r->ci, 0, "Project created");
+    else
+        send_response(r->ci, 1, "Create project failed");
+}
 
-        /* ==========================
-               REGISTER
-        ========================== */
-        if (strcmp(cmd, CMD_REGISTER) == 0) {
-            char *username = strtok(NULL, "|");
-            char *password = strtok(NULL, "|\n");
+/* ==========================
+         INVITE MEMBER
+========================== */
+static void cmd_invite_member(Request *r) {
+    int uid;
+    if (!db_get_user_id(r->f[2].p, &uid)) {
+        send_response(r->ci, 1, "User not found");
+        return;
+    }
 
-            if (!username || !password) {
-                send_response(ci->sockfd, 1, "Invalid REGISTER format");
-                continue;
-            }
+    int rc = db_invite_member(r->project_id, uid);
+    if (rc == 1)
+        send_response(r->ci, 0, "Member invited");
+    else if (rc == -1)
+        send_response(r->ci, 1, "Member already added");
+    else
+        send_response(r->ci, 1, "Invite failed");
+}
 
-            if (db_register_user(username, password))
-                send_response(ci->sockfd, 0, "Register OK");
-            else
-                send_response(ci->sockfd, 1, "Register failed");
-        }
+/* ==========================
+          CREATE TASK
+========================== */
+// CREATE_TASK|project_id|title|description|assignee_username|start_date|end_date
+static void cmd_create_task(Request *r) {
+    int assignee_id;
+    if (!db_get_user_id(r->f[4].p, &assignee_id)) {
+        send_response(r->ci, 1, "Assignee not found");
+        return;
+    }
+    if (!db_is_project_member(r->project_id, assignee_id)) {
+        send_response(r->ci, 1, "Assignee is not a member of this project");
+        return;
+    }
 
-        /* ==========================
-                LOGIN
-        ========================== */
-        else if (strcmp(cmd, CMD_LOGIN) == 0) {
-            char *username = strtok(NULL, "|");
-            char *password = strtok(NULL, "|\n");
-            int uid;
-
-            if (!username || !password) {
-                send_response(ci->sockfd, 1, "Invalid LOGIN format");
-                continue;
-            }
+    int task_id;
+    if (db_create_task_full(r->project_id, r->f[2].p, r->f[3].p, assignee_id,
+                            r->f[5].p, r->f[6].p, &task_id))
+        send_response(r->ci, 0, "Task created");
+    else
+        send_response(r->ci, 1, "Create task failed");
+}
 
-            if (db_auth_user(username, password, &uid)) {
-                ci->user_id = uid;
-                send_response(ci->sockfd, 0, "Login OK");
-            } else {
-                send_response(ci->sockfd, 1, "Login failed");
-            }
-        }
+/* ==========================
+     LIST TASKS IN PROJECT
+========================== */
+static void cmd_list_task(Request *r) {
+    Buf *b = response_begin(r->ci, 0);
+    if (db_list_tasks_in_project(r->project_id, b) <= 0)
+        empty_list(b, "No tasks");
+    response_end(b);
+}
 
-        /* ==========================
-             LIST PROJECTS
-        ========================== */
-        else if (strcmp(cmd, CMD_LIST_PROJECT) == 0) {
+/* ==========================
+          ASSIGN TASK
+========================== */
+static void cmd_assign_task(Request *r) {
+    // Lấy user_id từ username
+    int uid;
+    if (!db_get_user_id(r->f[2].p, &uid)) {
+        send_response(r->ci, 1, "User not found");
+        return;
+    }
 
-            char list[2048] = {0};
-            db_list_projects_for_user(ci->user_id, list, sizeof(list));
+    if (!db_is_project_member(r->project_id, uid)) {
+        send_response(r->ci, 1, "Assignee is not a member of this project");
+        return;
+    }
 
-            if (strlen(list) == 0)
-                send_response(ci->sockfd, 0, "No projects");
-            else
-                send_response(ci->sockfd, 0, list);
-        }
+    if (db_assign_task(r->task_id, uid))
+        send_response(r->ci, 0, "Task assigned");
+    else
+        send_response(r->ci, 1, "Assign failed");
+}
 
-        /* ==========================
-             CREATE PROJECT
-        ========================== */
-        else if (strcmp(cmd, CMD_CREATE_PROJECT) == 0) {
+/* ==========================
+      UPDATE TASK STATUS
+========================== */
+static void cmd_update_task_status(Request *r) {
+    if (db_update_task_status(r->task_id, r->f[2].p))
+        send_response(r->ci, 0, "Task status updated");
+    else
+        send_response(r->ci, 1, "Update status failed");
+}
 
-            char *project_name = strtok(NULL, "|\n");
-            int project_id;
+/* ==========================
+     UPDATE TASK PROGRESS
+========================== */
+static void cmd_update_task_progress(Request *r) {
+    int progress = atoi(r->f[2].p);
+    if (progress < 0 || progress > 100) {
+        send_response(r->ci, 1, "Progress must be 0..100");
+        return;
+    }
 
-            if (!project_name) {
-                send_response(ci->sockfd, 1, "Invalid CREATE_PROJECT format");
-                continue;
-            }
+    if (db_update_task_progress(r->task_id, progress))
+        send_response(r->ci, 0, "Task progress updated");
+    else
+        send_response(r->ci, 1, "Update progress failed");
+}
 
-            if (db_create_project(project_name, ci->user_id, &project_id))
-                send_response(ci->sockfd, 0, "Project created");
-            else
-                send_response(ci->sockfd, 1, "Create project failed");
-        }
+/* ==========================
+        SET TASK DATES
+========================== */
+static void cmd_set_task_dates(Request *r) {
+    if (db_set_task_dates(r->task_id, r->f[2].p, r->f[3].p))
+        send_response(r->ci, 0, "Task dates updated");
+    else
+        send_response(r->ci, 1, "Update dates failed");
+}
 
-        /* ==========================
-             INVITE MEMBER
-        ========================== */
-        else if (strcmp(cmd, CMD_INVITE_MEMBER) == 0) {
+/* ==========================
+       LIST TASK DETAIL
+========================== */
+static void cmd_list_task_detail(Request *r) {
+    Buf *b = response_begin(r->ci, 0);
+    if (db_get_task_detail(atoi(r->f[1].p), b) <= 0)
+        empty_list(b, "No detail");
+    response_end(b);
+}
 
-            char *pid_str = strtok(NULL, "|");
-            char *username = strtok(NULL, "|\n");
+/* ==========================
+      LIST TASKS FOR GANTT
+========================== */
+static void cmd_list_task_gantt(Request *r) {
+    Buf *b = response_begin(r->ci, 0);
+    if (db_list_tasks_gantt(atoi(r->f[1].p), b) <= 0)
+        empty_list(b, "No tasks");
+    response_end(b);
+}
 
-            if (!pid_str || !username) {
-                send_response(ci->sockfd, 1, "Invalid INVITE_MEMBER format");
-                continue;
-            }
+/* ==========================
+           COMMENTS
+========================== */
+static void cmd_add_comment(Request *r) {
+    if (db_add_comment(atoi(r->f[1].p), r->ci->user_id, r->f[2].p))
+        send_response(r->ci, 0, "Comment added");
+    else
+        send_response(r->ci, 1, "Add comment failed");
+}
 
-            int pid = atoi(pid_str);
+static void cmd_list_comments(Request *r) {
+    Buf *b = response_begin(r->ci, 0);
+    if (db_list_comments(atoi(r->f[1].p), b) <= 0)
+        empty_list(b, "No comments");
+    response_end(b);
+}
 
-            // permission: only project owner/manager can invite
-            if (!db_is_project_owner(pid, ci->user_id)) {
-                send_response(ci->sockfd, 1, "Only project owner can invite members");
-                continue;
-            }
+/* ==========================
+          ATTACHMENTS
+========================== */
+static void cmd_add_attachment(Request *r) {
+    if (db_add_attachment(atoi(r->f[1].p), r->f[2].p, r->f[3].p))
+        send_response(r->ci, 0, "Attachment added");
+    else
+        send_response(r->ci, 1, "Add attachment failed");
+}
 
-            int uid;
-            if (!db_get_user_id(username, &uid)) {
-                send_response(ci->sockfd, 1, "User not found");
-                continue;
-            }
+static void cmd_list_attachments(Request *r) {
+    Buf *b = response_begin(r->ci, 0);
+    if (db_list_attachments(atoi(r->f[1].p), b) <= 0)
+        empty_list(b, "No attachments");
+    response_end(b);
+}
 
-            int r = db_invite_member(pid, uid);
-            if (r == 1)
-                send_response(ci->sockfd, 0, "Member invited");
-            else if (r == -1)
-                send_response(ci->sockfd, 1, "Member already added");
-            else
-                send_response(ci->sockfd, 1, "Invite failed");
-        }
+/* ==========================
+             CHAT
+========================== */
+static void cmd_send_chat(Request *r) {
+    // fan-out to subscribers happens in chat_committed, on commit
+    if (db_add_chat(atoi(r->f[1].p), r->ci->user_id, r->f[2].p, NULL))
+        send_response(r->ci, 0, "Chat sent");
+    else
+        send_response(r->ci, 1, "Send chat failed");
+}
 
-        /* ==========================
-              CREATE TASK
-        ========================== */
-        else if (strcmp(cmd, CMD_CREATE_TASK) == 0) {
-
-            // new format (mandatory): CREATE_TASK|project_id|title|description|assignee_username|start_date|end_date
-            char *pid_str = strtok(NULL, "|");
-            char *title   = strtok(NULL, "|");
-            char *desc    = strtok(NULL, "|");
-            char *assignee_username = strtok(NULL, "|");
-            char *start_date = strtok(NULL, "|");
-            char *end_date   = strtok(NULL, "|\n");
-
-            if (!pid_str || !title || !desc || !assignee_username || !start_date || !end_date) {
-                send_response(ci->sockfd, 1, "Invalid CREATE_TASK format");
-                continue;
-            }
+// Writer thread, right after the message's transaction committed.
+static void chat_committed(int project_id, const ChatPosted *posted, const char *content) {
+    ChatMessage m = { project_id, posted->id, posted->username, content, posted->created_at };
+    chat_publish(&m);
+}
 
-            int pid = atoi(pid_str);
-            // permission: only project owner/manager can create tasks
-            if (!db_is_project_owner(pid, ci->user_id)) {
-                send_response(ci->sockfd, 1, "Only project owner can create tasks");
-                continue;
-            }
+// Recent messages come from memory; only older history costs a query.
+static int list_chat_rows(int project_id, int after_id, Buf *b) {
+    int rows = chat_list(project_id, after_id, b);
+    return rows >= 0 ? rows : db_list_chat(project_id, after_id, b);
+}
 
-            int assignee_id;
-            if (!db_get_user_id(assignee_username, &assignee_id)) {
-                send_response(ci->sockfd, 1, "Assignee not found");
-                continue;
-            }
-            if (!db_is_project_member(pid, assignee_id)) {
-                send_response(ci->sockfd, 1, "Assignee is not a member of this project");
-                continue;
-            }
+// With a timeout, an empty answer is parked in chat.c instead, and the
+// worker moves on; see chat_wait.
+static void cmd_list_chat(Request *r) {
+    int project_id = atoi(r->f[1].p);
+    int after_id = atoi(r->f[2].p);
+    int timeout_ms = r->nf > 3 ? atoi(r->f[3].p) : 0;
+    if (timeout_ms > 0 && !r->ci->binary) {
+        // a parked answer is written from another thread: in text it could
+        // overtake untagged responses or land inside a streamed one
+        send_response(r->ci, 1, "LIST_CHAT with a timeout needs HELLO|BIN");
+        return;
+    }
+    if (timeout_ms > 0 && !db_is_project_member(project_id, r->ci->user_id)) {
+        // parking keeps the project in memory: members only, like SUBSCRIBE_CHAT
+        send_response(r->ci, 1, "Not a member of this project");
+        return;
+    }
 
-            int task_id;
-            if (db_create_task_full(pid, title, desc, assignee_id, start_date, end_date, &task_id))
-                send_response(ci->sockfd, 0, "Task created");
-            else
-                send_response(ci->sockfd, 1, "Create task failed");
+    Buf *b = response_begin(r->ci, 0);
+    if (list_chat_rows(project_id, after_id, b) == 0 && timeout_ms > 0) {
+        int parked = chat_wait(r->ci, resp_ctx.req_id, project_id, after_id, timeout_ms);
+        if (parked > 0) {
+            buf_reset(b);   // nothing was sent: no rows
+            return;
         }
+        if (parked == 0) list_chat_rows(project_id, after_id, b);
+    }
+    response_end(b);
+}
 
-        /* ==========================
-             LIST TASKS IN PROJECT
-        ========================== */
-        else if (strcmp(cmd, CMD_LIST_TASK) == 0) {
-
-            char *pid_str = strtok(NULL, "|\n");
-            if (!pid_str) {
-                send_response(ci->sockfd, 1, "Invalid LIST_TASK format");
-                continue;
-            }
-
-            int pid = atoi(pid_str);
-            if (!db_is_project_member(pid, ci->user_id)) {
-                send_response(ci->sockfd, 1, "Not a member of this project");
-                continue;
-            }
+// chat.c answers parked LIST_CHATs on the writer and timer threads, which
+// have their own resp buffer.
+static Buf *chat_reply_begin(ClientInfo *ci, unsigned req_id) {
+    resp_ctx.req_id = req_id;
+    resp_ctx.log_level = log_request_level(CMD_LIST_CHAT, strlen(CMD_LIST_CHAT));
+    return response_begin(ci, 0);
+}
 
-            char list[4096] = {0};
-            db_list_tasks_in_project(pid, list, sizeof(list));
+// Runs under the project's fan-out lock: the backlog is written before any
+// push for a message committed meanwhile.
+static void subscribe_backlog(void *ctx) {
+    Request *r = ctx;
+    Buf *b = response_begin(r->ci, 0);
+    list_chat_rows(r->project_id, atoi(r->f[2].p), b);
+    response_end(b);
+}
 
-            if (strlen(list) == 0)
-                send_response(ci->sockfd, 0, "No tasks");
-            else
-                send_response(ci->sockfd, 0, list);
-        }
+static void cmd_subscribe_chat(Request *r) {
+    if (!r->ci->binary) {
+        // pushes could land inside a streamed text response
+        send_response(r->ci, 1, "SUBSCRIBE_CHAT needs HELLO|BIN");
+        return;
+    }
+    if (!chat_subscribe(r->ci, r->project_id, subscribe_backlog, r))
+        send_response(r->ci, 1, "Subscribe failed");
+}
 
-        /* ==========================
-                ASSIGN TASK
-        ========================== */
-        else if (strcmp(cmd, CMD_ASSIGN_TASK) == 0) {
+/* ==========================
+            STATS
+========================== */
+static void cmd_stats(Request *r) {
+    Buf *b = response_begin(r->ci, 0);
+    stats_write(b);
+    response_end(b);
+}
 
-            char *taskID_str = strtok(NULL, "|");
-            char *username   = strtok(NULL, "|\n");
+/* ==========================
+        PROTOCOL HELLO
+========================== */
+static void cmd_hello(Request *r) {
+    if (strcmp(r->f[1].p, "BIN") == 0) {
+        // answered in the old mode, so the client knows where framing starts
+        send_response(r->ci, 0, "BIN");
+        conn_set_binary(r->ci);
+    } else if (strcmp(r->f[1].p, "TEXT") == 0 && !r->ci->binary) {
+        send_response(r->ci, 0, "TEXT");
+    } else {
+        send_response(r->ci, 1, "Unsupported protocol");
+    }
+}
 
-            if (!taskID_str || !username) {
-                send_response(ci->sockfd, 1, "Invalid ASSIGN_TASK format");
-                continue;
-            }
+/* ==========================
+        DISPATCH TABLE
+========================== */
+// To add a command: write cmd_xxx() and add one row here.
+static const Command commands[] = {
+    { CMD_REGISTER,             cmd_register,             3, PERM_NONE, NULL },
+    { CMD_LOGIN,                cmd_login,                3, PERM_NONE, NULL },
+    { CMD_LIST_PROJECT,         cmd_list_project,         1, PERM_NONE, NULL },
+    { CMD_CREATE_PROJECT,       cmd_create_project,       2, PERM_NONE, NULL },
+    { CMD_INVITE_MEMBER,        cmd_invite_member,        3, PERM_PROJECT_OWNER,
+      "Only project owner can invite members" },
+    { CMD_CREATE_TASK,          cmd_create_task,          7, PERM_PROJECT_OWNER,
+      "Only project owner can create tasks" },
+    { CMD_LIST_TASK,            cmd_list_task,            2, PERM_PROJECT_MEMBER,
+      "Not a member of this project" },
+    { CMD_ASSIGN_TASK,          cmd_assign_task,          3, PERM_TASK_OWNER,
+      "Only project owner can assign tasks" },
+    { CMD_UPDATE_TASK_STATUS,   cmd_update_task_status,   3, PERM_TASK_EDITOR,
+      "Only assignee or project owner can update status" },
+    { CMD_UPDATE_TASK_PROGRESS, cmd_update_task_progress, 3, PERM_TASK_EDITOR,
+      "Only assignee or project owner can update progress" },
+    { CMD_SET_TASK_DATES,       cmd_set_task_dates,       4, PERM_TASK_OWNER,
+      "Only project owner can set task dates" },
+    { CMD_LIST_TASK_DETAIL,     cmd_list_task_detail,     2, PERM_NONE, NULL },
+    { CMD_LIST_TASK_GANTT,      cmd_list_task_gantt,      2, PERM_NONE, NULL },
+    { CMD_ADD_COMMENT,          cmd_add_comment,          3, PERM_NONE, NULL },
+    { CMD_LIST_COMMENTS,        cmd_list_comments,        2, PERM_NONE, NULL },
+    { CMD_ADD_ATTACHMENT,       cmd_add_attachment,       4, PERM_NONE, NULL },
+    { CMD_LIST_ATTACHMENTS,     cmd_list_attachments,     2, PERM_NONE, NULL },
+    { CMD_SEND_CHAT,            cmd_send_chat,            3, PERM_NONE, NULL },
+    { CMD_LIST_CHAT,            cmd_list_chat,            3, PERM_NONE, NULL },
+    { CMD_SUBSCRIBE_CHAT,       cmd_subscribe_chat,       3, PERM_PROJECT_MEMBER,
+      "Not a member of this project" },
+    { CMD_HELLO,                cmd_hello,                2, PERM_NONE, NULL },
+    { CMD_STATS,                cmd_stats,                1, PERM_LOGIN,
+      "Login required" },
+};
+
+#define NUM_COMMANDS ((int)(sizeof(commands) / sizeof(commands[0])))
+#define CMD_SLOT_BITS 6
+#define CMD_SLOTS (1 << CMD_SLOT_BITS)   // comfortably above NUM_COMMANDS
+
+// FNV-1a with the seed picked so that the current names land in distinct
+// slots: a lookup is one hash and one compare. Should a new name collide,
+// linear probing keeps the table correct and handler_init() says so.
+#define CMD_HASH_SEED 2166136266u
+
+static const Command *cmd_slots[CMD_SLOTS];
+
+static unsigned cmd_slot(const char *s, size_t len) {
+    unsigned h = CMD_HASH_SEED;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h >> (32 - CMD_SLOT_BITS);
+}
 
-            // permission: only project owner/manager can assign
-            int task_id = atoi(taskID_str);
-            int pid = 0;
-            if (!db_get_task_project_id(task_id, &pid) || !db_is_project_owner(pid, ci->user_id)) {
-                send_response(ci->sockfd, 1, "Only project owner can assign tasks");
-                continue;
-            }
+void handler_init(void) {
+    for (int i = 0; i < NUM_COMMANDS; i++) {
+        const char *name = commands[i].name;
+        unsigned h = cmd_slot(name, strlen(name));
+        if (cmd_slots[h])
+            fprintf(stderr, "handler: command hash collision for %s, consider a new CMD_HASH_SEED\n", name);
+        while (cmd_slots[h]) h = (h + 1) & (CMD_SLOTS - 1);
+        cmd_slots[h] = &commands[i];
+        stats_add_command(name);    // ids follow the table: i
+    }
+    stats_add_command("(unknown)");
 
-            // Lấy user_id từ username
-            int uid;
-            if (!db_get_user_id(username, &uid)) {
-                send_response(ci->sockfd, 1, "User not found");
-                continue;
-            }
+    db_set_chat_hook(chat_committed);
+    chat_set_reply(chat_reply_begin, response_end);
+}
 
-            if (!db_is_project_member(pid, uid)) {
-                send_response(ci->sockfd, 1, "Assignee is not a member of this project");
-                continue;
-            }
+static const Command *find_command(const char *name, size_t len) {
+    unsigned h = cmd_slot(name, len);
+    for (const Command *c; (c = cmd_slots[h]) != NULL; h = (h + 1) & (CMD_SLOTS - 1)) {
+        if (strncmp(c->name, name, len) == 0 && c->name[len] == '\0')
+            return c;
+    }
+    return NULL;
+}
 
-            // Assign đúng user_id lấy được từ username
-            if (db_assign_task(task_id, uid))
-                send_response(ci->sockfd, 0, "Task assigned");
-            else
-                send_response(ci->sockfd, 1, "Assign failed");
-        }
+// Enforce the command's declared permission; fills r->project_id / r->task_id.
+static int check_permission(const Command *c, Request *r) {
+    int uid = r->ci->user_id;
 
-        /* ==========================
-              UPDATE TASK STATUS
-        ========================== */
-        else if (strcmp(cmd, CMD_UPDATE_TASK_STATUS) == 0) {
-            char *taskID_str = strtok(NULL, "|");
-            char *status = strtok(NULL, "|\n");
+    switch (c->perm) {
+    case PERM_LOGIN:
+        return uid > 0;
 
-            if (!taskID_str || !status) {
-                send_response(ci->sockfd, 1, "Invalid UPDATE_TASK_STATUS format");
-                continue;
-            }
+    case PERM_PROJECT_MEMBER:
+        r->project_id = atoi(r->f[1].p);
+        return db_is_project_member(r->project_id, uid);
 
-            int tid = atoi(taskID_str);
-            int pid = 0;
-            int assignee_id = 0;
-            if (!db_get_task_project_id(tid, &pid)) {
-                send_response(ci->sockfd, 1, "Task not found");
-                continue;
-            }
+    case PERM_PROJECT_OWNER:
+        r->project_id = atoi(r->f[1].p);
+        return db_is_project_owner(r->project_id, uid);
 
-            // permission: assignee can update their task; project owner can update any task
-            int is_owner = db_is_project_owner(pid, ci->user_id);
-            int is_assignee = (db_get_task_assignee_id(tid, &assignee_id) && assignee_id == ci->user_id);
-            if (!is_owner && !is_assignee) {
-                send_response(ci->sockfd, 1, "Only assignee or project owner can update status");
-                continue;
-            }
+    case PERM_TASK_OWNER:
+        r->task_id = atoi(r->f[1].p);
+        return db_get_task_project_id(r->task_id, &r->project_id) &&
+               db_is_project_owner(r->project_id, uid);
 
-            if (db_update_task_status(tid, status))
-                send_response(ci->sockfd, 0, "Task status updated");
-            else
-                send_response(ci->sockfd, 1, "Update status failed");
+    case PERM_TASK_EDITOR: {
+        r->task_id = atoi(r->f[1].p);
+        if (!db_get_task_project_id(r->task_id, &r->project_id)) {
+            send_response(r->ci, 1, "Task not found");
+            return -1;
         }
+        // assignee can update their task; project owner can update any task
+        int assignee_id = 0;
+        return db_is_project_owner(r->project_id, uid) ||
+               (db_get_task_assignee_id(r->task_id, &assignee_id) && assignee_id == uid);
+    }
 
-        /* ==========================
-              UPDATE TASK PROGRESS
-        ========================== */
-        else if (strcmp(cmd, CMD_UPDATE_TASK_PROGRESS) == 0) {
-            char *taskID_str = strtok(NULL, "|");
-            char *progress_str = strtok(NULL, "|\n");
-
-            if (!taskID_str || !progress_str) {
-                send_response(ci->sockfd, 1, "Invalid UPDATE_TASK_PROGRESS format");
-                continue;
-            }
+    default:
+        return 1;
+    }
+}
 
-            int tid = atoi(taskID_str);
-            int progress = atoi(progress_str);
-            if (progress < 0 || progress > 100) {
-                send_response(ci->sockfd, 1, "Progress must be 0..100");
-                continue;
-            }
+// Field that must never reach the log (a password), or 0.
+static int secret_field(const Command *c) {
+    return c && (c->fn == cmd_register || c->fn == cmd_login) ? 2 : 0;
+}
 
-            int pid = 0;
-            int assignee_id = 0;
-            if (!db_get_task_project_id(tid, &pid)) {
-                send_response(ci->sockfd, 1, "Task not found");
-                continue;
-            }
+// Pick the level for this request and log it, tagged with the connection's
+// session: the command name at DEBUG, the whole request at TRACE (in text
+// form for binary requests too, with backslash and '|' inside fields
+// escaped by a backslash and CR, LF written as \r, \n, so each request
+// stays on one line and splits back into its fields; secrets masked,
+// capped). bench/replay reads these lines back.
+static void log_request(ClientInfo *ci, const Command *c, const Field *f, int nf) {
+    resp_ctx.log_level = log_request_level(f[0].p, f[0].len);
+    if (resp_ctx.log_level < LOG_DEBUG) return;
+
+    static __thread Buf line;
+    char tag[24];
+    buf_reset(&line);
+    buf_append(&line, tag, (size_t)snprintf(tag, sizeof(tag), "[s%u] ", ci->session));
+    if (resp_ctx.log_level < LOG_TRACE) {
+        buf_append(&line, f[0].p, f[0].len);
+        log_payload("RECV", line.data, line.len);
+        return;
+    }
 
-            // permission: assignee can update their task; project owner can update any task
-            int is_owner = db_is_project_owner(pid, ci->user_id);
-            int is_assignee = (db_get_task_assignee_id(tid, &assignee_id) && assignee_id == ci->user_id);
-            if (!is_owner && !is_assignee) {
-                send_response(ci->sockfd, 1, "Only assignee or project owner can update progress");
-                continue;
+    int secret = secret_field(c);
+    for (int i = 0; i < nf; i++) {
+        if (i) buf_append(&line, "|", 1);
+        if (secret && i == secret) {
+            buf_puts(&line, "***");
+            continue;
+        }
+        for (size_t j = 0; j < f[i].len; j++) {
+            char ch = f[i].p[j];
+            if (ch == '\n') {
+                buf_append(&line, "\\n", 2);
+            } else if (ch == '\r') {
+                buf_append(&line, "\\r", 2);
+            } else {
+                if (ch == '\\' || ch == '|') buf_append(&line, "\\", 1);
+                buf_append(&line, &ch, 1);
             }
-
-            if (db_update_task_progress(tid, progress))
-                send_response(ci->sockfd, 0, "Task progress updated");
-            else
-                send_response(ci->sockfd, 1, "Update progress failed");
         }
+    }
+    log_payload("RECV", line.data, line.len);
+}
 
-        /* ==========================
-              SET TASK DATES
-        ========================== */
-        else if (strcmp(cmd, CMD_SET_TASK_DATES) == 0) {
-            char *taskID_str = strtok(NULL, "|");
-            char *start_date = strtok(NULL, "|");
-            char *end_date = strtok(NULL, "|\n");
-
-            if (!taskID_str || !start_date || !end_date) {
-                send_response(ci->sockfd, 1, "Invalid SET_TASK_DATES format");
-                continue;
-            }
+// Per-request timings for stats_record; started when the request arrives.
+typedef struct {
+    unsigned long start, mark;
+    unsigned long us[STAT_PHASES];
+} Timing;
+
+static void timing_start(Timing *t) {
+    memset(t, 0, sizeof(*t));
+    t->start = t->mark = now_ns();
+    resp_ctx.failed = 0;
+    resp_ctx.send_ns = 0;
+}
 
-            int tid = atoi(taskID_str);
-            int pid = 0;
-            if (!db_get_task_project_id(tid, &pid) || !db_is_project_owner(pid, ci->user_id)) {
-                send_response(ci->sockfd, 1, "Only project owner can set task dates");
-                continue;
-            }
+// Charge the time since the last mark to phase.
+static void timing_mark(Timing *t, int phase) {
+    unsigned long now = now_ns();
+    t->us[phase] += (now - t->mark) / 1000;
+    t->mark = now;
+}
 
-            if (db_set_task_dates(tid, start_date, end_date))
-                send_response(ci->sockfd, 0, "Task dates updated");
-            else
-                send_response(ci->sockfd, 1, "Update dates failed");
-        }
+// Sending happens inside the handler; take it out of the DB phase.
+static void timing_done(Timing *t, const Command *c) {
+    unsigned long send_us = resp_ctx.send_ns / 1000;
+    t->us[STAT_SEND] = send_us;
+    t->us[STAT_DB] = t->us[STAT_DB] > send_us ? t->us[STAT_DB] - send_us : 0;
+    t->us[STAT_TOTAL] = (now_ns() - t->start) / 1000;
+    stats_record(c ? (int)(c - commands) : NUM_COMMANDS, t->us, resp_ctx.failed);
+}
 
-        /* ==========================
-              LIST TASK DETAIL
-        ========================== */
-        else if (strcmp(cmd, CMD_LIST_TASK_DETAIL) == 0) {
-            char *taskID_str = strtok(NULL, "|\n");
-            if (!taskID_str) {
-                send_response(ci->sockfd, 1, "Invalid LIST_TASK_DETAIL format");
-                continue;
-            }
-            char detail[2048] = {0};
-            if (db_get_task_detail(atoi(taskID_str), detail, sizeof(detail)) && strlen(detail) > 0)
-                send_response(ci->sockfd, 0, detail);
-            else
-                send_response(ci->sockfd, 0, "No detail");
-        }
+static void dispatch(ClientInfo *ci, Field *f, int nf, Timing *t) {
+    const Command *c = find_command(f[0].p, f[0].len);
+    log_request(ci, c, f, nf);
+    timing_mark(t, STAT_PARSE);
+    if (!c) {
+        send_response(ci, 1, "Unknown command");
+        timing_done(t, NULL);
+        return;
+    }
 
-        /* ==========================
-              LIST TASKS FOR GANTT
-        ========================== */
-        else if (strcmp(cmd, CMD_LIST_TASK_GANTT) == 0) {
-            char *pid_str = strtok(NULL, "|\n");
-            if (!pid_str) {
-                send_response(ci->sockfd, 1, "Invalid LIST_TASK_GANTT format");
-                continue;
-            }
-            char list[4096] = {0};
-            db_list_tasks_gantt(atoi(pid_str), list, sizeof(list));
-            if (strlen(list) == 0)
-                send_response(ci->sockfd, 0, "No tasks");
-            else
-                send_response(ci->sockfd, 0, list);
-        }
+    if (!fields_ok(f, nf, c->arity)) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "Invalid %s format", c->name);
+        send_response(ci, 1, msg);
+        timing_done(t, c);
+        return;
+    }
 
-        /* ==========================
-              COMMENTS
-        ========================== */
-        else if (strcmp(cmd, CMD_ADD_COMMENT) == 0) {
-            char *taskID_str = strtok(NULL, "|");
-            char *content = strtok(NULL, "|\n");
-            if (!taskID_str || !content) {
-                send_response(ci->sockfd, 1, "Invalid ADD_COMMENT format");
-                continue;
-            }
-            if (db_add_comment(atoi(taskID_str), ci->user_id, content))
-                send_response(ci->sockfd, 0, "Comment added");
-            else
-                send_response(ci->sockfd, 1, "Add comment failed");
-        }
-        else if (strcmp(cmd, CMD_LIST_COMMENTS) == 0) {
-            char *taskID_str = strtok(NULL, "|\n");
-            if (!taskID_str) {
-                send_response(ci->sockfd, 1, "Invalid LIST_COMMENTS format");
-                continue;
-            }
-            char list[4096] = {0};
-            db_list_comments(atoi(taskID_str), list, sizeof(list));
-            if (strlen(list) == 0)
-                send_response(ci->sockfd, 0, "No comments");
-            else
-                send_response(ci->sockfd, 0, list);
-        }
+    Request r = { ci, f, nf, 0, 0 };
+    int allowed = check_permission(c, &r);
+    timing_mark(t, STAT_PERM);
+    if (allowed <= 0) {
+        if (allowed == 0) send_response(ci, 1, c->deny_msg);
+        // else already answered
+        timing_done(t, c);
+        return;
+    }
 
-        /* ==========================
-              ATTACHMENTS
-        ========================== */
-        else if (strcmp(cmd, CMD_ADD_ATTACHMENT) == 0) {
-            char *taskID_str = strtok(NULL, "|");
-            char *filename = strtok(NULL, "|");
-            char *filepath = strtok(NULL, "|\n");
-            if (!taskID_str || !filename || !filepath) {
-                send_response(ci->sockfd, 1, "Invalid ADD_ATTACHMENT format");
-                continue;
-            }
-            if (db_add_attachment(atoi(taskID_str), filename, filepath))
-                send_response(ci->sockfd, 0, "Attachment added");
-            else
-                send_response(ci->sockfd, 1, "Add attachment failed");
-        }
-        else if (strcmp(cmd, CMD_LIST_ATTACHMENTS) == 0) {
-            char *taskID_str = strtok(NULL, "|\n");
-            if (!taskID_str) {
-                send_response(ci->sockfd, 1, "Invalid LIST_ATTACHMENTS format");
-                continue;
-            }
-            char list[4096] = {0};
-            db_list_attachments(atoi(taskID_str), list, sizeof(list));
-            if (strlen(list) == 0)
-                send_response(ci->sockfd, 0, "No attachments");
-            else
-                send_response(ci->sockfd, 0, list);
-        }
+    c->fn(&r);
+    timing_mark(t, STAT_DB);
+    timing_done(t, c);
+}
 
-        /* ==========================
-                 CHAT
-        ========================== */
-        else if (strcmp(cmd, CMD_SEND_CHAT) == 0) {
-            char *pid_str = strtok(NULL, "|");
-            char *content = strtok(NULL, "|\n");
-            if (!pid_str || !content) {
-                send_response(ci->sockfd, 1, "Invalid SEND_CHAT format");
-                continue;
-            }
-            if (db_add_chat(atoi(pid_str), ci->user_id, content))
-                send_response(ci->sockfd, 0, "Chat sent");
-            else
-                send_response(ci->sockfd, 1, "Send chat failed");
-        }
-        else if (strcmp(cmd, CMD_LIST_CHAT) == 0) {
-            char *pid_str = strtok(NULL, "|");
-            char *after_str = strtok(NULL, "|\n");
-            if (!pid_str || !after_str) {
-                send_response(ci->sockfd, 1, "Invalid LIST_CHAT format");
-                continue;
-            }
-            char list[4096] = {0};
-            db_list_chat(atoi(pid_str), atoi(after_str), list, sizeof(list));
-            if (strlen(list) == 0)
-                send_response(ci->sockfd, 0, "");
-            else
-                send_response(ci->sockfd, 0, list);
+void handle_command(ClientInfo *ci, char *line, size_t len) {
+    Timing t;
+    timing_start(&t);
+
+    // tách command: fields point into line, no copies
+    Field f[MAX_FIELDS] = {{0}};
+    int nf = split_fields(line, len, f, MAX_FIELDS);
+
+    // optional "#<id>|" prefix: take the id and shift the fields down
+    resp_ctx.req_id = 0;
+    if (nf > 1 && f[0].len > 1 && f[0].p[0] == '#') {
+        char *end;
+        unsigned long id = strtoul(f[0].p + 1, &end, 10);
+        if (end == f[0].p + f[0].len && id > 0 && id <= 0xffffffffUL) {
+            resp_ctx.req_id = (unsigned)id;
+            memmove(f, f + 1, (size_t)(nf - 1) * sizeof(Field));
+            nf--;
         }
+    }
 
+    trim_trailing(f[0].p);   // RẤT QUAN TRỌNG: bỏ \n, \r, space ở cuối
+    f[0].len = strlen(f[0].p);
+
+    dispatch(ci, f, nf, &t);
+}
 
-        /* ==========================
-              UNKNOWN COMMAND
-        ========================== */
-        else {
-            send_response(ci->sockfd, 1, "Unknown command");
+void handle_frame(ClientInfo *ci, char *frame, size_t len) {
+    static __thread Buf store;
+    Timing t;
+    timing_start(&t);
+
+    resp_ctx.req_id = len >= 4 ? (unsigned char)frame[0] << 24 | (unsigned char)frame[1] << 16 |
+                                 (unsigned char)frame[2] << 8 | (unsigned char)frame[3]
+                               : 0;
+
+    Field f[MAX_FIELDS] = {{0}};
+    int nf = len >= WIRE_HEADER - 4
+                 ? split_frame(frame + WIRE_HEADER - 4, len - (WIRE_HEADER - 4), &store, f, MAX_FIELDS)
+                 : -1;
+    if (nf <= 0 || f[0].len == 0) {
+        resp_ctx.log_level = log_request_level("", 0);
+        if (resp_ctx.log_level >= LOG_DEBUG) {
+            char note[48];
+            snprintf(note, sizeof(note), "[s%u] (malformed frame)", ci->session);
+            log_message("RECV", note);
         }
+        send_response(ci, 1, "Malformed frame");
+        timing_done(&t, NULL);
+        return;
     }
 
-    close(ci->sockfd);
-    free(ci);
-    return NULL;
+    dispatch(ci, f, nf, &t);
+}
+
+void handle_disconnect(ClientInfo *ci) {
+    chat_unsubscribe(ci);
+    if (log_request_level("", 0) >= LOG_DEBUG) {
+        char note[24];
+        snprintf(note, sizeof(note), "[s%u]", ci->session);
+        log_message("CLOSE", note);
+    }
 }
@@ -1,11 +1,32 @@
 #ifndef HANDLER_H
 #define HANDLER_H
 
+#include <stddef.h>
+
 typedef struct {
     int sockfd;
     int user_id;
+    int binary;         // negotiated with HELLO|BIN; see protocol.h
+    int chat_project;   // followed with SUBSCRIBE_CHAT, 0 if none (chat.c)
+    int chat_waits;     // LIST_CHATs parked in chat.c
+    unsigned session;   // names the connection in the log; never reused
 } ClientInfo;
 
-void *client_handler(void *arg);
+// Build the command lookup table and hook chat fan-out into the DB writer.
+// Call once, after db_init and before serving requests.
+void handler_init(void);
+
+// Execute one request line of len bytes (line terminator stripped, with
+// room for a NUL at line[len]). Called from worker threads; the line is
+// split in place.
+void handle_command(ClientInfo *ci, char *line, size_t len);
+
+// Execute one binary request frame: the len bytes after its length prefix.
+void handle_frame(ClientInfo *ci, char *frame, size_t len);
+
+// The peer has gone. Drops per-connection state held outside the
+// connection (chat subscriptions, parked LIST_CHATs); called once, before
+// it is freed.
+void handle_disconnect(ClientInfo *ci);
 
 #endif
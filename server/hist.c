@@ -0,0 +1,38 @@
+#include "hist.h"
+
+static int hist_index(unsigned long v) {
+    if (v > 0xffffffffUL) v = 0xffffffffUL;
+    if (v < 2 * HIST_SUB) return (int)v;
+    int e = 63 - __builtin_clzl(v);     // highest bit, >= HIST_SUB_BITS + 1
+    return (e - HIST_SUB_BITS) * HIST_SUB + (int)(v >> (e - HIST_SUB_BITS));
+}
+
+// Largest value that lands in bucket i.
+static unsigned long hist_value(int i) {
+    if (i < 2 * HIST_SUB) return (unsigned long)i;
+    int e = i / HIST_SUB + HIST_SUB_BITS - 1;
+    unsigned long top = (unsigned long)(i % HIST_SUB + HIST_SUB);
+    return ((top + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+void hist_add(Hist *h, unsigned long v) {
+    __atomic_add_fetch(&h->count[hist_index(v)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->n, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum, v, __ATOMIC_RELAXED);
+    unsigned long m = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (v > m && !__atomic_compare_exchange_n(&h->max, &m, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+unsigned long hist_quantile(const Hist *h, double q) {
+    unsigned long n = __atomic_load_n(&h->n, __ATOMIC_RELAXED);
+    if (n == 0) return 0;
+    unsigned long want = (unsigned long)(q * n + 0.5), seen = 0;
+    unsigned long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    if (want == 0) want = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += __atomic_load_n(&h->count[i], __ATOMIC_RELAXED);
+        if (seen >= want) return hist_value(i) < max ? hist_value(i) : max;
+    }
+    return max;
+}
@@ -0,0 +1,26 @@
+#ifndef HIST_H
+#define HIST_H
+
+// HDR-style histogram: exact below 2 * HIST_SUB, then HIST_SUB buckets per
+// power of two, so every value is kept to within 1/HIST_SUB (about 6%)
+// from a microsecond up to the 32-bit range (over an hour). Shared by
+// stats.c and the bench tools, so both report the same percentiles.
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    unsigned long count[HIST_BUCKETS];
+    unsigned long n;
+    unsigned long sum;
+    unsigned long max;
+} Hist;
+
+// Record v. Safe from any thread, lock-free.
+void hist_add(Hist *h, unsigned long v);
+
+// Value at quantile q (0..1]; read while others record, so only as exact
+// as a snapshot can be.
+unsigned long hist_quantile(const Hist *h, double q);
+
+#endif
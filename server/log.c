@@ -1,20 +1,506 @@
 #include "log.h"
+#include "common.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
-static FILE *log_file = NULL;
+#define LOG_BATCH (64 * 1024)
+#define LOG_MAX_RULES 32
+#define LOG_DEFAULT_PAYLOAD 256
 
-void log_init(const char *filepath) {
-    log_file = fopen(filepath, "a");
+// One preformatted line. seq says whose turn the slot is (a bounded MPSC
+// queue): pos when free for the producer holding ticket pos, pos + 1 once
+// that producer has filled it, pos + LOG_RING_SLOTS after it is written out.
+typedef struct {
+    unsigned long seq;
+    unsigned len;
+    char data[LOG_RECORD_SIZE];
+} LogSlot;
+
+extern char **environ;
+
+static FILE *log_file = NULL;      // flusher only, once started
+static char log_path[256];
+static size_t log_size;             // bytes in log_file
+static time_t log_opened;           // when log_file was started
+static volatile sig_atomic_t reopen_requested;
+static pid_t gzip_pid;              // last background gzip, 0 if none
+static LogSlot *ring = NULL;
+static unsigned long head;      // next ticket, taken by producers with CAS
+static unsigned long tail;      // next slot to write, flusher only
+static unsigned long written;
+static unsigned long dropped;
+
+static pthread_t flusher;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static int sleeping;            // flusher is (about to be) waiting on wake_cond
+static int stopping;
+
+// Per-command override of the default level.
+typedef struct {
+    char name[32];
+    int level;
+    unsigned sample;        // log one request in sample
+    unsigned long seen;     // requests so far, for sampling
+} LogRule;
+
+// Levels in force. A config is not changed once published: log_configure
+// builds a new one and swaps the pointer. Replaced configs are kept (a
+// reload is a rare, manual event) so readers never need a lock.
+typedef struct LogConfig {
+    int level;
+    unsigned sample;
+    unsigned long seen;
+    size_t payload;
+    size_t rotate_size;     // rotate past this many bytes, 0 = never
+    unsigned rotate_every;  // rotate after this many seconds, 0 = never
+    unsigned keep;          // rotated files kept: server.log.1 .. .keep
+    int gzip;               // compress rotated files in the background
+    int nrules;
+    LogRule rules[LOG_MAX_RULES];
+    struct LogConfig *prev;
+} LogConfig;
+
+static LogConfig default_config = {
+    .level = LOG_INFO, .sample = 1, .payload = LOG_DEFAULT_PAYLOAD,
+    .rotate_size = LOG_ROTATE_SIZE, .keep = LOG_ROTATE_KEEP,
+};
+static LogConfig *config = &default_config;
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;   // writers only
+
+static char config_path[256];
+static struct timespec config_mtime;
+static time_t config_checked;
+
+// "[dd-mm HH:MM:SS.mmm] ": the part up to the seconds is rebuilt once per
+// second per thread, only the milliseconds on every line.
+static __thread time_t stamp_sec = -1;
+static __thread char stamp[32];
+static __thread size_t stamp_len;
+
+static const char *log_stamp(size_t *len) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (now.tv_sec != stamp_sec) {
+        struct tm t;
+        localtime_r(&now.tv_sec, &t);
+        stamp_len = (size_t)snprintf(stamp, sizeof(stamp), "[%02d-%02d %02d:%02d:%02d.000] ",
+                                     t.tm_mday, t.tm_mon + 1, t.tm_hour, t.tm_min, t.tm_sec);
+        stamp_sec = now.tv_sec;
+    }
+    int ms = (int)(now.tv_nsec / 1000000);
+    stamp[stamp_len - 5] = (char)('0' + ms / 100);
+    stamp[stamp_len - 4] = (char)('0' + ms / 10 % 10);
+    stamp[stamp_len - 3] = (char)('0' + ms % 10);
+    *len = stamp_len;
+    return stamp;
+}
+
+// Queue "prefix: msg[0..mlen)suffix".
+static void log_record(const char *prefix, const char *msg, size_t mlen, const char *suffix) {
+    if (!ring) return;
+
+    unsigned long pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    LogSlot *s;
+    for (;;) {
+        s = &ring[pos & (LOG_RING_SLOTS - 1)];
+        long diff = (long)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            // the flusher is a whole ring behind
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+
+    size_t sl;
+    const char *st = log_stamp(&sl);
+    int n = snprintf(s->data + sl, LOG_RECORD_SIZE - sl, "%s: %.*s%s\n", prefix, (int)mlen, msg, suffix);
+    memcpy(s->data, st, sl);
+    size_t len = sl + (size_t)n;
+    if (len >= LOG_RECORD_SIZE) {
+        memcpy(s->data + LOG_RECORD_SIZE - 5, "...\n", 4);
+        len = LOG_RECORD_SIZE - 1;
+    }
+    s->len = (unsigned)len;
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+
+    if (__atomic_load_n(&sleeping, __ATOMIC_ACQUIRE))
+        pthread_cond_signal(&wake_cond);
 }
 
 void log_message(const char *prefix, const char *msg) {
-    if (!log_file) return;
+    log_record(prefix, msg, strlen(msg), "");
+}
+
+void log_payload(const char *prefix, const char *msg, size_t len) {
+    while (len > 0 && (msg[len - 1] == '\n' || msg[len - 1] == '\r')) len--;
+    size_t cap = __atomic_load_n(&config, __ATOMIC_ACQUIRE)->payload;
+    // leave room for the stamp, prefix and note, so log_record never cuts
+    // a payload on its own
+    size_t room = LOG_RECORD_SIZE - 64 - strlen(prefix);
+    if (cap > room) cap = room;
+    if (len <= cap) {
+        log_record(prefix, msg, len, "");
+        return;
+    }
+    // a cut record gets its own prefix: the text of a whole one can end in
+    // anything, the note included
+    char cut[32], note[48];
+    snprintf(cut, sizeof(cut), "%s cut", prefix);
+    snprintf(note, sizeof(note), "... (%zu bytes)", len);
+    log_record(cut, msg, cap, note);
+}
+
+/* ---- levels ---- */
+
+static int parse_level(const char *s, size_t len) {
+    static const char *names[] = { "error", "warn", "info", "debug", "trace" };
+    for (int i = 0; i <= LOG_TRACE; i++)
+        if (strlen(names[i]) == len && strncasecmp(s, names[i], len) == 0) return i;
+    return -1;
+}
+
+// "level" or "level/N" in s[0..len).
+static int parse_level_sample(const char *s, size_t len, int *level, unsigned *sample) {
+    const char *slash = memchr(s, '/', len);
+    *sample = 1;
+    if (slash) {
+        char *end;
+        unsigned long n = strtoul(slash + 1, &end, 10);
+        if (end != s + len || n == 0) return 0;
+        *sample = (unsigned)n;
+        len = (size_t)(slash - s);
+    }
+    *level = parse_level(s, len);
+    return *level >= 0;
+}
+
+int log_configure(const char *spec) {
+    LogConfig *c = malloc(sizeof(LogConfig));
+    if (!c) return 0;
+    *c = default_config;
+
+    const char *p = spec;
+    for (;;) {
+        while (*p == ',' || isspace((unsigned char)*p)) p++;
+        if (*p == '#') {            // comment to end of line, for config files
+            while (*p && *p != '\n') p++;
+            continue;
+        }
+        if (!*p) break;
+        const char *tok = p;
+        while (*p && *p != ',' && !isspace((unsigned char)*p)) p++;
+        size_t len = (size_t)(p - tok);
+
+        const char *eq = memchr(tok, '=', len);
+        size_t nlen = eq ? (size_t)(eq - tok) : 0;
+        unsigned long num = 0;
+        int ok, is_num = 0;
+        if (eq) {
+            char *end;
+            num = strtoul(eq + 1, &end, 10);
+            is_num = end == p && end != eq + 1;
+        }
+#define KEY(k) (nlen == sizeof(k) - 1 && strncmp(tok, k, nlen) == 0)
+        if (!eq) {
+            ok = parse_level_sample(tok, len, &c->level, &c->sample);
+        } else if (KEY("payload")) {
+            ok = is_num;
+            c->payload = num;
+        } else if (KEY("rotate_size")) {
+            ok = is_num;
+            c->rotate_size = num;
+        } else if (KEY("rotate_every")) {
+            ok = is_num;
+            c->rotate_every = (unsigned)num;
+        } else if (KEY("keep")) {
+            ok = is_num && num > 0;
+            c->keep = (unsigned)num;
+        } else if (KEY("gzip")) {
+            ok = is_num && num <= 1;
+            c->gzip = (int)num;
+        } else {
+            LogRule *r = &c->rules[c->nrules];
+            ok = c->nrules < LOG_MAX_RULES && nlen > 0 && nlen < sizeof(r->name) &&
+                 parse_level_sample(eq + 1, (size_t)(p - eq - 1), &r->level, &r->sample);
+            if (ok) {
+                memcpy(r->name, tok, nlen);
+                r->name[nlen] = '\0';
+                c->nrules++;
+            }
+        }
+#undef KEY
+        if (!ok) {
+            fprintf(stderr, "log: bad setting '%.*s'\n", (int)len, tok);
+            free(c);
+            return 0;
+        }
+    }
+
+    pthread_mutex_lock(&config_lock);
+    c->prev = config;
+    __atomic_store_n(&config, c, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&config_lock);
+    return 1;
+}
+
+int log_request_level(const char *cmd, size_t len) {
+    LogConfig *c = __atomic_load_n(&config, __ATOMIC_ACQUIRE);
+    int level = c->level;
+    unsigned sample = c->sample;
+    unsigned long *seen = &c->seen;
+    for (int i = 0; i < c->nrules; i++) {
+        LogRule *r = &c->rules[i];
+        if (strncmp(r->name, cmd, len) == 0 && r->name[len] == '\0') {
+            level = r->level;
+            sample = r->sample;
+            seen = &r->seen;
+            break;
+        }
+    }
+    if (level < LOG_DEBUG || sample <= 1) return level;
+    if (__atomic_fetch_add(seen, 1, __ATOMIC_RELAXED) % sample != 0) return LOG_INFO;
+    return level;
+}
+
+void log_config_file(const char *path) {
+    snprintf(config_path, sizeof(config_path), "%s", path);
+}
+
+// Flusher only: reload config_path if it changed since the last look.
+static void check_config_file(void) {
     time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    fprintf(log_file, "[%02d-%02d %02d:%02d:%02d] %s: %s\n",
-            t->tm_mday, t->tm_mon + 1,
-            t->tm_hour, t->tm_min, t->tm_sec,
-            prefix, msg);
+    if (!config_path[0] || now == config_checked) return;
+    config_checked = now;
+
+    struct stat st;
+    if (stat(config_path, &st) != 0 ||
+        (st.st_mtim.tv_sec == config_mtime.tv_sec && st.st_mtim.tv_nsec == config_mtime.tv_nsec))
+        return;
+    config_mtime = st.st_mtim;
+
+    FILE *f = fopen(config_path, "r");
+    if (!f) return;
+    char spec[4096];
+    size_t n = fread(spec, 1, sizeof(spec) - 1, f);
+    fclose(f);
+    spec[n] = '\0';
+    log_message("LOG", log_configure(spec) ? "levels reloaded" : "bad level config, kept the old one");
+}
+
+/* ---- files ---- */
+
+static void log_write(const char *data, size_t len) {
+    fwrite(data, 1, len, log_file);
+    log_size += len;
+}
+
+// Open log_path for appending in place of the current file. On failure the
+// old file, if any, stays in use.
+static int log_open(void) {
+    FILE *f = fopen(log_path, "a");
+    if (!f) return 0;
+    if (log_file) fclose(log_file);
+    log_file = f;
+    fseek(f, 0, SEEK_END);
+    long pos = ftell(f);
+    log_size = pos > 0 ? (size_t)pos : 0;
+    log_opened = time(NULL);
+    return 1;
+}
+
+// "<log_path>.<n>", plus ".gz" if gz.
+static void rotated_name(char *out, size_t size, unsigned n, int gz) {
+    snprintf(out, size, "%s.%u%s", log_path, n, gz ? ".gz" : "");
+}
+
+// Shift server.log.k to .k+1 (dropping .keep), move the live file to .1 and
+// start a new one. Runs on the flusher, so writers only ever queue.
+static void log_rotate(const LogConfig *c) {
+    char from[300], to[300];
+
+    // a gzip still compressing .1 would race the rename below
+    if (gzip_pid > 0) {
+        waitpid(gzip_pid, NULL, 0);
+        gzip_pid = 0;
+    }
     fflush(log_file);
+    for (int gz = 0; gz <= 1; gz++) {
+        rotated_name(from, sizeof(from), c->keep, gz);
+        unlink(from);
+        for (unsigned n = c->keep; n > 1; n--) {
+            rotated_name(from, sizeof(from), n - 1, gz);
+            rotated_name(to, sizeof(to), n, gz);
+            if (rename(from, to) != 0 && errno != ENOENT) perror(to);
+        }
+    }
+    rotated_name(to, sizeof(to), 1, 0);
+    if (rename(log_path, to) != 0) {
+        perror(to);
+        log_opened = time(NULL);    // try again next interval, not every pass
+        return;
+    }
+    if (!log_open()) {
+        // keep writing to the renamed file rather than lose lines
+        perror(log_path);
+        return;
+    }
+    if (c->gzip) {
+        char *argv[] = { "gzip", "-f", to, NULL };
+        if (posix_spawnp(&gzip_pid, "gzip", NULL, NULL, argv, environ) != 0) gzip_pid = 0;
+    }
+}
+
+// Flusher only, between batches: rotate or reopen if it is time.
+static void check_rotation(void) {
+    if (gzip_pid > 0 && waitpid(gzip_pid, NULL, WNOHANG) != 0) gzip_pid = 0;
+
+    if (reopen_requested) {
+        // someone else moved the file away (logrotate); follow the path
+        reopen_requested = 0;
+        if (log_open()) log_message("LOG", "reopened on SIGHUP");
+        return;
+    }
+    const LogConfig *c = __atomic_load_n(&config, __ATOMIC_ACQUIRE);
+    if ((c->rotate_size && log_size >= c->rotate_size) ||
+        (c->rotate_every && log_size > 0 && time(NULL) - log_opened >= (time_t)c->rotate_every))
+        log_rotate(c);
+}
+
+void log_reopen(void) {
+    reopen_requested = 1;
+}
+
+/* ---- flusher ---- */
+
+// Move every ready record into batch, writing it out whenever it fills up.
+// Returns how many records were taken.
+static int drain(char *batch, size_t *blen) {
+    int taken = 0;
+    for (;;) {
+        LogSlot *s = &ring[tail & (LOG_RING_SLOTS - 1)];
+        if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != tail + 1) break;
+        if (*blen + s->len > LOG_BATCH) {
+            log_write(batch, *blen);
+            *blen = 0;
+        }
+        memcpy(batch + *blen, s->data, s->len);
+        *blen += s->len;
+        __atomic_store_n(&s->seq, tail + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+        tail++;
+        taken++;
+    }
+    return taken;
+}
+
+static void *flusher_main(void *arg) {
+    (void)arg;
+    char *batch = malloc(LOG_BATCH);
+    unsigned long reported = 0;
+    if (!batch) return NULL;
+
+    for (;;) {
+        check_config_file();
+        check_rotation();
+
+        size_t blen = 0;
+        int taken = drain(batch, &blen);
+
+        unsigned long d = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+        if (d != reported && blen + 128 <= LOG_BATCH) {
+            size_t sl;
+            const char *st = log_stamp(&sl);
+            memcpy(batch + blen, st, sl);
+            blen += sl;
+            blen += (size_t)snprintf(batch + blen, LOG_BATCH - blen,
+                                     "LOG: %lu records dropped, ring full\n", d - reported);
+            reported = d;
+        }
+        if (blen > 0) {
+            log_write(batch, blen);
+            fflush(log_file);
+            __atomic_add_fetch(&written, (unsigned long)taken, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        pthread_mutex_lock(&wake_lock);
+        if (stopping) {
+            pthread_mutex_unlock(&wake_lock);
+            break;
+        }
+        __atomic_store_n(&sleeping, 1, __ATOMIC_SEQ_CST);
+        // a producer that missed the flag is picked up at the next tick
+        LogSlot *s = &ring[tail & (LOG_RING_SLOTS - 1)];
+        if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 100 * 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&wake_cond, &wake_lock, &ts);
+        }
+        __atomic_store_n(&sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&wake_lock);
+    }
+    free(batch);
+    return NULL;
+}
+
+void log_init(const char *filepath) {
+    snprintf(log_path, sizeof(log_path), "%s", filepath);
+    if (!log_open()) {
+        perror(filepath);
+        return;
+    }
+    LogSlot *r = malloc(LOG_RING_SLOTS * sizeof(LogSlot));
+    if (!r) {
+        fclose(log_file);
+        log_file = NULL;
+        return;
+    }
+    for (unsigned long i = 0; i < LOG_RING_SLOTS; i++) r[i].seq = i;
+    ring = r;
+    if (pthread_create(&flusher, NULL, flusher_main, NULL) != 0) {
+        perror("log flusher");
+        ring = NULL;
+        free(r);
+        fclose(log_file);
+        log_file = NULL;
+    }
+}
+
+void log_close(void) {
+    if (!ring) return;
+    pthread_mutex_lock(&wake_lock);
+    stopping = 1;
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_lock);
+    pthread_join(flusher, NULL);
+    if (gzip_pid > 0) waitpid(gzip_pid, NULL, 0);
+    fclose(log_file);
+    log_file = NULL;
+}
+
+void log_stats(unsigned long *w, unsigned long *d) {
+    *w = __atomic_load_n(&written, __ATOMIC_RELAXED);
+    *d = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
 }
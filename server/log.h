@@ -1,7 +1,54 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <stddef.h>
+
+// Levels, least verbose first. INFO logs no per-request lines; DEBUG logs
+// one line per request and response; TRACE adds their payloads.
+enum { LOG_ERROR, LOG_WARN, LOG_INFO, LOG_DEBUG, LOG_TRACE };
+
+// Open the log and start its flusher thread. Records are queued in a fixed
+// ring of LOG_RING_SLOTS and written in batches off the request path.
 void log_init(const char *filepath);
+
+// Queue one line; safe from any thread and never blocks. Messages longer
+// than a record are cut, and records that find the ring full are dropped
+// (counted, and noted in the log once there is room again).
 void log_message(const char *prefix, const char *msg);
 
+// Like log_message, but msg is len bytes of payload: cut to the configured
+// cap (or to what fits a record), with its full size noted and the prefix
+// marked, e.g. "RECV cut: ...... (5000 bytes)".
+void log_payload(const char *prefix, const char *msg, size_t len);
+
+// Apply a level spec: comma/space separated "level[/N]" for the default,
+// "CMD=level[/N]" for one command and "payload=BYTES" for the cap; /N
+// logs one request in N. E.g. "info,LIST_TASK=trace/10,payload=512".
+// Rotation is set the same way: "rotate_size=BYTES", "rotate_every=SECS"
+// (0 turns either off), "keep=N" rotated files and "gzip=1" to compress
+// them. Unset parts keep their defaults (info, no overrides, 256, rotate at
+// LOG_ROTATE_SIZE keeping LOG_ROTATE_KEEP). Returns 0 and changes nothing
+// if the spec is invalid.
+int log_configure(const char *spec);
+
+// Re-read a spec from path whenever the file changes (checked by the
+// flusher once a second), so levels can be changed without a restart.
+// Call before log_init; the flusher applies the file as soon as it starts,
+// over anything log_configure set before.
+void log_config_file(const char *path);
+
+// Level to log one request of command cmd (len bytes) at, after its
+// sampling rate; below LOG_DEBUG means no per-request lines.
+int log_request_level(const char *cmd, size_t len);
+
+// Reopen the log file by name, e.g. after an outside tool moved it. Only
+// sets a flag for the flusher, so it is safe in a signal handler.
+void log_reopen(void);
+
+// Write out everything queued and stop the flusher.
+void log_close(void);
+
+// Records written and dropped so far.
+void log_stats(unsigned long *written, unsigned long *dropped);
+
 #endif
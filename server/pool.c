@@ -0,0 +1,140 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    pool_fn fn;
+    void *arg;
+    unsigned long long enqueued_ns;
+} Job;
+
+static pthread_mutex_t q_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t q_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t q_not_full = PTHREAD_COND_INITIALIZER;
+static Job *q_jobs = NULL;       // ring buffer
+static int q_cap = 0;
+static int q_head = 0;
+static int q_count = 0;
+static int q_stop = 0;
+
+static PoolStats stats;
+
+static pthread_t *workers = NULL;
+static int worker_count = 0;
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&q_lock);
+        while (q_count == 0 && !q_stop)
+            pthread_cond_wait(&q_not_empty, &q_lock);
+        if (q_count == 0) {
+            pthread_mutex_unlock(&q_lock);
+            break;
+        }
+        Job job = q_jobs[q_head];
+        q_head = (q_head + 1) % q_cap;
+        q_count--;
+
+        unsigned long long waited = now_ns() - job.enqueued_ns;
+        stats.wait_ns_total += waited;
+        if (waited > stats.wait_ns_max) stats.wait_ns_max = waited;
+        pthread_cond_signal(&q_not_full);
+        pthread_mutex_unlock(&q_lock);
+
+        job.fn(job.arg);
+
+        pthread_mutex_lock(&q_lock);
+        stats.completed++;
+        pthread_mutex_unlock(&q_lock);
+    }
+    return NULL;
+}
+
+int pool_init(int nthreads, int queue_size) {
+    if (nthreads <= 0) nthreads = 1;
+    if (queue_size <= 0) queue_size = 1;
+
+    q_jobs = calloc(queue_size, sizeof(Job));
+    workers = calloc(nthreads, sizeof(pthread_t));
+    if (!q_jobs || !workers) return 0;
+    q_cap = queue_size;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.capacity = queue_size;
+
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&workers[i], NULL, worker_main, NULL) != 0) {
+            perror("pthread_create");
+            break;
+        }
+        worker_count++;
+    }
+    stats.threads = worker_count;
+    return worker_count > 0;
+}
+
+// Caller holds q_lock and has checked there is room.
+static void enqueue_locked(pool_fn fn, void *arg) {
+    Job *job = &q_jobs[(q_head + q_count) % q_cap];
+    job->fn = fn;
+    job->arg = arg;
+    job->enqueued_ns = now_ns();
+    q_count++;
+
+    stats.submitted++;
+    if (q_count > stats.max_depth) stats.max_depth = q_count;
+    pthread_cond_signal(&q_not_empty);
+}
+
+void pool_submit(pool_fn fn, void *arg) {
+    pthread_mutex_lock(&q_lock);
+    if (q_count == q_cap) {
+        stats.full_waits++;
+        while (q_count == q_cap && !q_stop)
+            pthread_cond_wait(&q_not_full, &q_lock);
+    }
+    if (!q_stop) enqueue_locked(fn, arg);
+    pthread_mutex_unlock(&q_lock);
+}
+
+int pool_try_submit(pool_fn fn, void *arg) {
+    pthread_mutex_lock(&q_lock);
+    int ok = q_count < q_cap && !q_stop;
+    if (ok) enqueue_locked(fn, arg);
+    pthread_mutex_unlock(&q_lock);
+    return ok;
+}
+
+void pool_get_stats(PoolStats *out) {
+    pthread_mutex_lock(&q_lock);
+    *out = stats;
+    out->depth = q_count;
+    pthread_mutex_unlock(&q_lock);
+}
+
+void pool_shutdown(void) {
+    pthread_mutex_lock(&q_lock);
+    q_stop = 1;
+    pthread_cond_broadcast(&q_not_empty);
+    pthread_cond_broadcast(&q_not_full);
+    pthread_mutex_unlock(&q_lock);
+
+    for (int i = 0; i < worker_count; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+    free(q_jobs);
+    workers = NULL;
+    q_jobs = NULL;
+    worker_count = 0;
+}
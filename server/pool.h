@@ -0,0 +1,32 @@
+#ifndef POOL_H
+#define POOL_H
+
+typedef void (*pool_fn)(void *arg);
+
+typedef struct {
+    int threads;
+    int capacity;
+    int depth;                       // jobs waiting right now
+    int max_depth;
+    unsigned long long submitted;
+    unsigned long long completed;
+    unsigned long long full_waits;   // submits that blocked on a full queue
+    unsigned long long wait_ns_total;
+    unsigned long long wait_ns_max;  // queue wait, submit -> start
+} PoolStats;
+
+// Fixed-size worker pool fed by a bounded FIFO queue.
+int pool_init(int nthreads, int queue_size);
+
+// Blocks while the queue is full, so overload turns into queueing
+// (and TCP backpressure) instead of unbounded growth.
+void pool_submit(pool_fn fn, void *arg);
+
+// Non-blocking variant for callers that must not wait (e.g. the workers
+// themselves). Returns 0 if the queue is full.
+int pool_try_submit(pool_fn fn, void *arg);
+
+void pool_get_stats(PoolStats *out);
+void pool_shutdown(void);
+
+#endif
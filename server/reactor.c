@@ -0,0 +1,438 @@
+#define _GNU_SOURCE
+#include "reactor.h"
+#include "handler.h"
+#include "stats.h"
+#include "pool.h"
+#include "common.h"
+#include "protocol.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define MAX_EVENTS 256
+#define OUT_CORK_LIMIT (64 * 1024)  // flush a corked batch early past this size
+
+enum { LINE_NONE = 0, LINE_OK, LINE_FRAME, LINE_TOO_LONG, LINE_BAD_FRAME };
+
+typedef struct {
+    ClientInfo ci;          // must stay first: handler code only sees this part
+    pthread_mutex_t lock;
+
+    char *in;               // bytes received but not yet handed to a worker
+    size_t in_start;
+    size_t in_len;
+    size_t in_cap;          // grows up to MAX_REQUEST_SIZE
+    int discarding;         // dropping the tail of an oversized request
+
+    char *out;              // bytes the socket could not take yet
+    size_t out_start;
+    size_t out_len;
+    size_t out_cap;
+
+    int scheduled;          // queued on / running in the worker pool
+    int corked;             // worker is running a pipelined batch; send once at the end
+    int closing;            // peer gone, no more reads
+    int stalled;            // input buffer full, reads paused until a worker drains it
+    int refs;               // event loop + scheduled worker
+} Conn;
+
+static int epfd = -1;
+
+// Reactor thread only.
+static Conn *conn_new(int fd) {
+    static unsigned next_session;
+    Conn *c = calloc(1, sizeof(Conn));
+    if (!c) return NULL;
+    c->ci.sockfd = fd;
+    c->ci.session = ++next_session;
+    c->ci.user_id = -1;
+    c->refs = 1;
+    pthread_mutex_init(&c->lock, NULL);
+    return c;
+}
+
+static void conn_release(Conn *c) {
+    pthread_mutex_lock(&c->lock);
+    int left = --c->refs;
+    pthread_mutex_unlock(&c->lock);
+    if (left > 0) return;
+
+    close(c->ci.sockfd);
+    pthread_mutex_destroy(&c->lock);
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+// Push pending output to the socket. Caller holds c->lock.
+static void conn_flush_locked(Conn *c) {
+    while (c->out_len > 0) {
+        ssize_t n = send(c->ci.sockfd, c->out + c->out_start, c->out_len, MSG_NOSIGNAL);
+        if (n > 0) {
+            c->out_start += n;
+            c->out_len -= n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;  // EPOLLOUT will bring us back
+        } else {
+            c->out_len = 0;  // peer is gone; the read side will notice
+        }
+    }
+    c->out_start = 0;
+}
+
+void conn_write(ClientInfo *ci, const char *data, size_t len) {
+    Conn *c = (Conn *)ci;
+
+    pthread_mutex_lock(&c->lock);
+    if (c->out_len == 0 && !c->corked) {
+        while (len > 0) {
+            ssize_t n = send(c->ci.sockfd, data, len, MSG_NOSIGNAL);
+            if (n > 0) {
+                data += n;
+                len -= n;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                len = 0;
+            }
+        }
+    }
+
+    if (len > 0) {
+        if (c->out_start > 0) {
+            memmove(c->out, c->out + c->out_start, c->out_len);
+            c->out_start = 0;
+        }
+        if (c->out_len + len > c->out_cap) {
+            size_t cap = c->out_cap ? c->out_cap : BUF_SIZE;
+            while (cap < c->out_len + len) cap *= 2;
+            char *p = realloc(c->out, cap);
+            if (!p) {
+                pthread_mutex_unlock(&c->lock);
+                return;
+            }
+            c->out = p;
+            c->out_cap = cap;
+        }
+        memcpy(c->out + c->out_len, data, len);
+        c->out_len += len;
+        if (c->corked && c->out_len >= OUT_CORK_LIMIT)
+            conn_flush_locked(c);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Drop the rest of an oversized request, up to and including its newline.
+static void skip_discarded_locked(Conn *c) {
+    if (!c->discarding || c->in_len == 0) return;
+
+    char *start = c->in + c->in_start;
+    char *nl = memchr(start, '\n', c->in_len);
+    size_t n = nl ? (size_t)(nl - start) + 1 : c->in_len;
+    c->in_start += n;
+    c->in_len -= n;
+    if (nl) c->discarding = 0;
+    if (c->in_len == 0) c->in_start = 0;
+}
+
+static size_t frame_len(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return (size_t)u[0] << 24 | (size_t)u[1] << 16 | (size_t)u[2] << 8 | u[3];
+}
+
+static int has_line_locked(Conn *c) {
+    if (c->ci.binary) {
+        if (c->in_len < 4) return 0;
+        size_t n = frame_len(c->in + c->in_start);
+        // a frame that can never fit is reported too, so it can be rejected
+        return n + 4 > MAX_REQUEST_SIZE || n < WIRE_HEADER - 4 || c->in_len >= n + 4;
+    }
+
+    skip_discarded_locked(c);
+    if (c->in_len == 0) return 0;
+    if (memchr(c->in + c->in_start, '\n', c->in_len)) return 1;
+    // an unterminated request that can no longer grow, or the last one before EOF
+    return c->in_len >= MAX_REQUEST_SIZE || c->closing;
+}
+
+// Copy len bytes at start into a per-thread scratch buffer (NUL-terminated).
+static char *scratch_copy(const char *start, size_t len) {
+    static __thread char *scratch = NULL;
+    static __thread size_t scratch_cap = 0;
+
+    if (len + 1 > scratch_cap) {
+        size_t cap = scratch_cap ? scratch_cap : BUF_SIZE;
+        while (cap < len + 1) cap *= 2;
+        char *p = realloc(scratch, cap);
+        if (!p) return NULL;
+        scratch = p;
+        scratch_cap = cap;
+    }
+    memcpy(scratch, start, len);
+    scratch[len] = '\0';
+    return scratch;
+}
+
+// Take the next request off the input buffer: a line without its "\n" /
+// "\r\n" (LINE_OK), or in binary mode a frame without its length prefix
+// (LINE_FRAME). *line points into a per-thread scratch buffer that stays
+// valid until the next call. Caller holds c->lock.
+static int take_line_locked(Conn *c, char **line, size_t *line_len) {
+    if (c->ci.binary) {
+        if (!has_line_locked(c)) return LINE_NONE;
+
+        size_t n = frame_len(c->in + c->in_start);
+        if (n + 4 > MAX_REQUEST_SIZE || n < WIRE_HEADER - 4) {
+            // no way to resynchronise on a bad length: drop the rest
+            c->in_start = c->in_len = 0;
+            return LINE_BAD_FRAME;
+        }
+        char *frame = scratch_copy(c->in + c->in_start + 4, n);
+        c->in_start += n + 4;
+        c->in_len -= n + 4;
+        if (c->in_len == 0) c->in_start = 0;
+        if (!frame) return LINE_BAD_FRAME;
+        *line = frame;
+        *line_len = n;
+        return LINE_FRAME;
+    }
+
+    while (1) {
+        if (!has_line_locked(c)) return LINE_NONE;
+
+        char *start = c->in + c->in_start;
+        char *nl = memchr(start, '\n', c->in_len);
+        if (!nl && !c->closing) {
+            // MAX_REQUEST_SIZE bytes and still no newline: reject it as a unit
+            c->in_start = c->in_len = 0;
+            c->discarding = 1;
+            return LINE_TOO_LONG;
+        }
+
+        size_t used = nl ? (size_t)(nl - start) + 1 : c->in_len;
+        size_t len = nl ? (size_t)(nl - start) : c->in_len;
+        if (len > 0 && start[len - 1] == '\r') len--;
+
+        c->in_start += used;
+        c->in_len -= used;
+        if (c->in_len == 0) c->in_start = 0;
+        if (len == 0) continue;  // blank line, nothing to answer
+
+        *line = scratch_copy(start, len);
+        if (!*line) return LINE_TOO_LONG;
+        *line_len = len;
+        return LINE_OK;
+    }
+}
+
+void conn_set_binary(ClientInfo *ci) {
+    Conn *c = (Conn *)ci;
+    pthread_mutex_lock(&c->lock);
+    c->ci.binary = 1;
+    pthread_mutex_unlock(&c->lock);
+}
+
+int conn_is_open(ClientInfo *ci) {
+    Conn *c = (Conn *)ci;
+    pthread_mutex_lock(&c->lock);
+    int open = !c->closing;
+    pthread_mutex_unlock(&c->lock);
+    return open;
+}
+
+static void conn_arm(Conn *c, int op) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    epoll_ctl(epfd, op, c->ci.sockfd, &ev);
+}
+
+// Worker side: run the buffered requests of one connection, in order.
+// Responses of a pipelined batch are corked and leave in a single send().
+static void conn_process(void *arg) {
+    Conn *c = (Conn *)arg;
+
+    while (1) {
+        int done = 0;
+
+        pthread_mutex_lock(&c->lock);
+        c->corked = 1;
+        pthread_mutex_unlock(&c->lock);
+
+        for (int handled = 0; handled < PIPELINE_BATCH; handled++) {
+            char *line = NULL;
+            size_t len = 0;
+
+            pthread_mutex_lock(&c->lock);
+            int kind = take_line_locked(c, &line, &len);
+            int resume = kind != LINE_NONE && c->stalled && !c->closing;
+            if (resume) c->stalled = 0;
+            pthread_mutex_unlock(&c->lock);
+
+            if (kind == LINE_NONE) {
+                done = 1;
+                break;
+            }
+
+            // edge-triggered: re-arming makes epoll report the unread data again
+            if (resume) conn_arm(c, EPOLL_CTL_MOD);
+
+            if (kind == LINE_TOO_LONG) {
+                conn_write(&c->ci, "1|Request too long\n", 19);
+            } else if (kind == LINE_BAD_FRAME) {
+                // framing is lost; stop reading and let EOF tear the connection down
+                shutdown(c->ci.sockfd, SHUT_RD);
+            } else if (kind == LINE_FRAME) {
+                handle_frame(&c->ci, line, len);
+            } else {
+                handle_command(&c->ci, line, len);
+            }
+        }
+
+        pthread_mutex_lock(&c->lock);
+        c->corked = 0;
+        conn_flush_locked(c);
+        if (!done && !has_line_locked(c)) done = 1;
+        if (done) c->scheduled = 0;
+        pthread_mutex_unlock(&c->lock);
+
+        if (done) break;
+
+        // Batch limit reached with requests left: requeue so one chatty client
+        // cannot pin a worker. If the queue is full, just keep going here.
+        if (pool_try_submit(conn_process, c)) return;
+    }
+
+    conn_release(c);
+}
+
+// Event loop side: drain the socket, then schedule the connection if it has
+// work and no worker already owns it.
+static void conn_on_readable(Conn *c) {
+    int eof = 0;
+
+    pthread_mutex_lock(&c->lock);
+    while (1) {
+        // skipping a discarded line can leave live bytes past in_start;
+        // recv below appends at in_len, so they must sit at offset 0
+        skip_discarded_locked(c);
+        if (c->in_start > 0 && c->in_len > 0)
+            memmove(c->in, c->in + c->in_start, c->in_len);
+        c->in_start = 0;
+        if (c->in_len == c->in_cap && c->in_cap < MAX_REQUEST_SIZE) {
+            size_t cap = c->in_cap ? c->in_cap * 2 : BUF_SIZE;
+            if (cap > MAX_REQUEST_SIZE) cap = MAX_REQUEST_SIZE;
+            char *p = realloc(c->in, cap);
+            if (!p) {
+                eof = 1;
+                break;
+            }
+            c->in = p;
+            c->in_cap = cap;
+        }
+        size_t space = c->in_cap - c->in_len;
+        if (space == 0) {
+            c->stalled = 1;
+            break;
+        }
+        ssize_t n = recv(c->ci.sockfd, c->in + c->in_len, space, 0);
+        if (n > 0) {
+            c->in_len += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            eof = 1;
+            break;
+        }
+    }
+
+    if (eof) c->closing = 1;
+    int schedule = !c->scheduled && has_line_locked(c);
+    if (schedule) {
+        c->scheduled = 1;
+        c->refs++;
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    if (schedule) pool_submit(conn_process, c);
+
+    if (eof) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->ci.sockfd, NULL);
+        handle_disconnect(&c->ci);
+        stats_conn_closed();
+        conn_release(c);
+    }
+}
+
+static void on_accept(int listenfd) {
+    while (1) {
+        int connfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+
+        Conn *c = conn_new(connfd);
+        if (!c) {
+            close(connfd);
+            continue;
+        }
+        stats_conn_opened();
+        conn_arm(c, EPOLL_CTL_ADD);
+    }
+}
+
+int reactor_run(int listenfd) {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return 0;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;  // NULL marks the listening socket
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0) {
+        perror("epoll_ctl");
+        return 0;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            return 0;
+        }
+
+        for (int i = 0; i < n; i++) {
+            Conn *c = (Conn *)events[i].data.ptr;
+            if (!c) {
+                on_accept(listenfd);
+                continue;
+            }
+
+            if (events[i].events & EPOLLOUT) {
+                pthread_mutex_lock(&c->lock);
+                conn_flush_locked(c);
+                pthread_mutex_unlock(&c->lock);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                conn_on_readable(c);
+        }
+    }
+}
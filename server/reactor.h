@@ -0,0 +1,23 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stddef.h>
+#include "handler.h"
+
+// Runs the epoll event loop on listenfd. Complete request lines are handed
+// to the worker pool; this call only returns on a fatal epoll error.
+int reactor_run(int listenfd);
+
+// Queue bytes for a client. Safe to call from worker threads; whatever the
+// socket cannot take right now is flushed by the event loop later.
+void conn_write(ClientInfo *ci, const char *data, size_t len);
+
+// 0 once the peer has gone. After that no new per-connection state should
+// be attached (see handle_disconnect).
+int conn_is_open(ClientInfo *ci);
+
+// Switch a connection to binary frames (protocol.h) for all further input
+// and output. Called by the worker handling HELLO|BIN, after its reply.
+void conn_set_binary(ClientInfo *ci);
+
+#endif
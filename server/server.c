@@ -2,22 +2,62 @@
 #include "log.h"
 #include "common.h"
 #include "handler.h"
+#include "pool.h"
+#include "reactor.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 #include <unistd.h>
 #include <arpa/inet.h>
-#include <pthread.h>
+#include <sys/resource.h>
+
+// Every idle client holds one descriptor; lift the soft limit as far as allowed.
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static void on_sighup(int sig) {
+    (void)sig;
+    log_reopen();
+}
+
+// Optional integer override from the environment, e.g. QLCV_WORKERS=16.
+static int env_int(const char *name, int def) {
+    const char *v = getenv(name);
+    if (!v || !*v) return def;
+    int n = atoi(v);
+    return n > 0 ? n : def;
+}
 
 int main() {
     if (!db_init("db/database.db")) {
         fprintf(stderr, "Init DB failed\n");
         return 1;
     }
+    // QLCV_LOG sets the levels at startup; log/log.conf, if present, wins:
+    // the flusher started by log_init reads it first thing, and again
+    // whenever it changes (see log_configure)
+    const char *levels = getenv("QLCV_LOG");
+    if (levels) log_configure(levels);
+    log_config_file("log/log.conf");
     log_init("log/server.log");
+    // SIGHUP reopens log/server.log, for rotation by an outside tool
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sighup;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &sa, NULL);
+    handler_init();
+    raise_fd_limit();
 
-    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    int listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (listenfd < 0) {
         perror("socket");
         return 1;
@@ -34,32 +74,29 @@ int main() {
         return 1;
     }
 
-    if (listen(listenfd, MAX_CLIENT) < 0) {
+    if (listen(listenfd, SOMAXCONN) < 0) {
         perror("listen");
         return 1;
     }
 
-    printf("Server listening on port %d...\n", SERVER_PORT);
-
-    while (1) {
-        struct sockaddr_in cli_addr;
-        socklen_t cli_len = sizeof(cli_addr);
-        int connfd = accept(listenfd, (struct sockaddr*)&cli_addr, &cli_len);
-        if (connfd < 0) {
-            perror("accept");
-            continue;
-        }
+    int workers = env_int("QLCV_WORKERS", WORKER_THREADS);
+    int queue_size = env_int("QLCV_QUEUE_SIZE", WORK_QUEUE_SIZE);
+    if (!pool_init(workers, queue_size)) {
+        fprintf(stderr, "Cannot start worker pool\n");
+        return 1;
+    }
 
-        ClientInfo *ci = malloc(sizeof(ClientInfo));
-        ci->sockfd = connfd;
-        ci->user_id = -1;
+    printf("Server listening on port %d (%d workers, queue %d)...\n",
+           SERVER_PORT, workers, queue_size);
+    stats_start_dump(env_int("QLCV_STATS_INTERVAL", STATS_DUMP_INTERVAL));
+    db_set_slow_query_ms(env_int("QLCV_SLOW_QUERY_MS", DB_SLOW_QUERY_MS));
 
-        pthread_t tid;
-        pthread_create(&tid, NULL, client_handler, ci);
-        pthread_detach(tid);
-    }
+    // accepts, reads and writes all happen on this thread; commands run on the pool
+    reactor_run(listenfd);
 
+    pool_shutdown();
     db_close();
+    log_close();
     close(listenfd);
     return 0;
 }
@@ -0,0 +1,125 @@
+#include "stats.h"
+#include "common.h"
+#include "db.h"
+#include "hist.h"
+#include "log.h"
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    const char *name;
+    unsigned long requests;
+    unsigned long errors;
+    Hist phase[STAT_PHASES];
+} CmdStats;
+
+static CmdStats cmds[STATS_MAX_COMMANDS];
+static int ncmds;
+static long connections;
+
+int stats_add_command(const char *name) {
+    if (ncmds == STATS_MAX_COMMANDS) return -1;
+    cmds[ncmds].name = name;
+    return ncmds++;
+}
+
+void stats_record(int id, const unsigned long us[STAT_PHASES], int failed) {
+    if (id < 0 || id >= ncmds) return;
+    CmdStats *c = &cmds[id];
+    __atomic_add_fetch(&c->requests, 1, __ATOMIC_RELAXED);
+    if (failed) __atomic_add_fetch(&c->errors, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < STAT_PHASES; i++) hist_add(&c->phase[i], us[i]);
+}
+
+void stats_conn_opened(void) {
+    __atomic_add_fetch(&connections, 1, __ATOMIC_RELAXED);
+}
+
+void stats_conn_closed(void) {
+    __atomic_sub_fetch(&connections, 1, __ATOMIC_RELAXED);
+}
+
+static void gauge(Buf *out, const char *name, unsigned long long v) {
+    buf_row(out, 2);
+    buf_col_str(out, NULL, name);
+    buf_col_int(out, NULL, (int)v);
+    buf_row_end(out);
+}
+
+void stats_write(Buf *out) {
+    PoolStats ps;
+    unsigned long long hits, misses, batches, ops;
+    unsigned long written, dropped;
+    pool_get_stats(&ps);
+    db_stmt_cache_stats(&hits, &misses);
+    db_write_stats(&batches, &ops);
+    log_stats(&written, &dropped);
+
+    gauge(out, "connections", (unsigned long long)__atomic_load_n(&connections, __ATOMIC_RELAXED));
+    gauge(out, "pool_depth", (unsigned long long)ps.depth);
+    gauge(out, "pool_max_depth", (unsigned long long)ps.max_depth);
+    gauge(out, "pool_full_waits", ps.full_waits);
+    gauge(out, "pool_wait_max_us", ps.wait_ns_max / 1000);
+    gauge(out, "stmt_cache_hits", hits);
+    gauge(out, "stmt_cache_misses", misses);
+    gauge(out, "write_batches", batches);
+    gauge(out, "write_ops", ops);
+    gauge(out, "log_written", written);
+    gauge(out, "log_dropped", dropped);
+
+    for (int i = 0; i < ncmds; i++) {
+        const CmdStats *c = &cmds[i];
+        unsigned long n = __atomic_load_n(&c->requests, __ATOMIC_RELAXED);
+        if (n == 0) continue;
+        const Hist *t = &c->phase[STAT_TOTAL];
+        buf_row(out, 10);
+        buf_col_str(out, NULL, c->name);
+        buf_col_int(out, "n=", (int)n);
+        buf_col_int(out, "err=", (int)__atomic_load_n(&c->errors, __ATOMIC_RELAXED));
+        buf_col_int(out, "p50=", (int)hist_quantile(t, 0.50));
+        buf_col_int(out, "p99=", (int)hist_quantile(t, 0.99));
+        buf_col_int(out, "max=", (int)__atomic_load_n(&t->max, __ATOMIC_RELAXED));
+        buf_col_int(out, "parse99=", (int)hist_quantile(&c->phase[STAT_PARSE], 0.99));
+        buf_col_int(out, "perm99=", (int)hist_quantile(&c->phase[STAT_PERM], 0.99));
+        buf_col_int(out, "db99=", (int)hist_quantile(&c->phase[STAT_DB], 0.99));
+        buf_col_int(out, "send99=", (int)hist_quantile(&c->phase[STAT_SEND], 0.99));
+        buf_row_end(out);
+    }
+
+    db_profile_stats(out);
+}
+
+static void *dump_main(void *arg) {
+    int interval = (int)(long)arg;
+    Buf b;
+    buf_init(&b);
+    for (;;) {
+        sleep((unsigned)interval);
+        for (int i = 0; i < ncmds; i++) {
+            const CmdStats *c = &cmds[i];
+            unsigned long n = __atomic_load_n(&c->requests, __ATOMIC_RELAXED);
+            if (n == 0) continue;
+            const Hist *t = &c->phase[STAT_TOTAL];
+            buf_reset(&b);
+            buf_printf(&b, "%s n=%lu err=%lu p50=%luus p99=%luus max=%luus db99=%luus", c->name, n,
+                       __atomic_load_n(&c->errors, __ATOMIC_RELAXED), hist_quantile(t, 0.50),
+                       hist_quantile(t, 0.99), __atomic_load_n(&t->max, __ATOMIC_RELAXED),
+                       hist_quantile(&c->phase[STAT_DB], 0.99));
+            log_message("STATS", b.data);
+        }
+    }
+    return NULL;
+}
+
+void stats_start_dump(int interval_s) {
+    pthread_t tid;
+    if (interval_s <= 0) return;
+    if (pthread_create(&tid, NULL, dump_main, (void *)(long)interval_s) == 0)
+        pthread_detach(tid);
+    else
+        perror("stats dump");
+}
@@ -0,0 +1,32 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "buf.h"
+
+// Where a request's time goes: splitting and lookup, the permission
+// check, the handler itself (mostly SQLite), handing the response to the
+// connection; and the whole.
+enum { STAT_PARSE, STAT_PERM, STAT_DB, STAT_SEND, STAT_TOTAL, STAT_PHASES };
+
+// Add a command to track and return its id, or -1 past STATS_MAX_COMMANDS.
+// Called during startup only.
+int stats_add_command(const char *name);
+
+// Count one request of command id; us[] holds each phase in microseconds.
+// Safe from any thread, lock-free.
+void stats_record(int id, const unsigned long us[STAT_PHASES], int failed);
+
+void stats_conn_opened(void);
+void stats_conn_closed(void);
+
+// Append the STATS answer to out: one row per server gauge (name, value),
+// then one per command seen so far (name, requests, errors, total p50, p99
+// and max, and p99 of each phase; times in microseconds), then the SQL
+// statement profile (db_profile_stats).
+void stats_write(Buf *out);
+
+// Write a one-line summary per active command to the log every
+// interval_s seconds, from a thread of its own.
+void stats_start_dump(int interval_s);
+
+#endif